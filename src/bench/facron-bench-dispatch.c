@@ -0,0 +1,341 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Feeds synthetic fanotify events through the rules of a configuration, the
+ * way facron does with the events of a read, and reports the cost of their
+ * dispatch. The configuration is either generated, with the given number of
+ * rules whose paths have the given depth, a share of them wildcard patterns,
+ * or read from a file, and the paths of the events either hit a rule or
+ * live right next to one. The commands are counted, never run. The same
+ * events then go through a pipeline of 1, 2, 4... up to the given number of
+ * workers, one per CPU by default.
+ *
+ * USAGE: facron-bench-dispatch [rules|configuration] [depth] [hit %] [events] [pattern %] [workers]
+ */
+
+#include "config.h"
+#include "facron-conf.h"
+#include "facron-dispatch.h"
+#include "facron-loop.h"
+#include "facron-metrics.h"
+#include "facron-pipeline.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/fanotify.h>
+
+#include <linux/limits.h>
+
+#define DEFAULT_RULES    1000
+#define DEFAULT_DEPTH    6
+#define DEFAULT_HITS     10
+#define DEFAULT_EVENTS   1000000
+#define DEFAULT_PATTERNS 0
+/* events per synthetic read, about what a busy 256K buffer brings */
+#define BATCH_EVENTS     256
+#define FANOUT           8
+
+typedef struct fanotify_event_metadata FacronMetadata;
+
+static char conf_path[] = "/tmp/facron-bench-XXXXXX";
+
+static struct
+{
+    char **paths;
+    size_t n_paths;
+    FacronMetadata *metadata;
+    const char **event_paths;
+    atomic_ullong actions;
+    unsigned long long state;
+} bench = { NULL, 0, NULL, NULL, 0, 88172645463325252ULL };
+
+/* xorshift64, for runs which compare */
+static unsigned long long
+bench_random (void)
+{
+    bench.state ^= bench.state << 13;
+    bench.state ^= bench.state >> 7;
+    bench.state ^= bench.state << 17;
+    return bench.state;
+}
+
+/* Rule i watches the children of a directory, a file or a pattern, below intermediate directories spreading the rules */
+static bool
+write_conf (size_t n_rules, size_t depth, unsigned int patterns)
+{
+    int fd = mkstemp (conf_path);
+    FILE *file = (fd < 0) ? NULL : fdopen (fd, "w");
+
+    if (!file)
+    {
+        fprintf (stderr, "Error: could not create a temporary configuration: %s\n", strerror (errno));
+        return false;
+    }
+
+    for (size_t i = 0; i < n_rules; ++i)
+    {
+        fprintf (file, "/bench");
+        for (size_t level = 0; level + 3 < depth; ++level)
+            fprintf (file, "/d%zu", (i >> (level * 3)) % FANOUT);
+
+        if (bench_random () % 100 < patterns)
+            fprintf (file, "/p%zu/*.log FAN_CLOSE_WRITE /bin/true $$\n", i);
+        else if (i % 2)
+            fprintf (file, "/r%zu/file FAN_CLOSE_WRITE /bin/true $$\n", i);
+        else
+            fprintf (file, "/r%zu FAN_CLOSE_WRITE|FAN_EVENT_ON_CHILD /bin/true $$\n", i);
+    }
+
+    return !fclose (file);
+}
+
+/* A path the pattern matches, taking the first choice of each bracket */
+static void
+instantiate (const char *pattern, char *path)
+{
+    while (*pattern)
+    {
+        if (*pattern == '*' || *pattern == '?')
+        {
+            *path++ = 'x';
+            ++pattern;
+        }
+        else if (*pattern == '[')
+        {
+            const char *close = strchr (pattern + 1, ']');
+            *path++ = (pattern[1] == '!' || pattern[1] == '^') ? '_' : pattern[1];
+            pattern = (close) ? close + 1 : pattern + 1;
+        }
+        else
+            *path++ = *pattern++;
+    }
+    *path = '\0';
+}
+
+/* The hits of each rule, then the paths next to them no rule watches */
+static void
+build_paths (const FacronConfGeneration *generation)
+{
+    size_t n_rules;
+    const FacronRule *const *rules = facron_conf_get_rules (generation, &n_rules);
+
+    bench.paths = (char **) malloc (2 * n_rules * sizeof (char *));
+    for (size_t i = 0; i < n_rules; ++i)
+    {
+        const char *child = (facron_rule_watches_children (rules[i])) ? "/file" : "";
+        char path[PATH_MAX];
+        char miss[PATH_MAX + sizeof (".miss/file")];
+
+        instantiate (facron_rule_get_path (rules[i]), path);
+        snprintf (miss, sizeof (miss), "%s.miss%s", path, child);
+        strcat (path, child);
+        bench.paths[i] = strdup (path);
+        bench.paths[n_rules + i] = strdup (miss);
+    }
+    bench.n_paths = n_rules;
+}
+
+static void
+count_action (const FacronConfEntry *entry, const FacronEvent *event, void *user_data)
+{
+    (void) entry;
+    (void) event;
+    (void) user_data;
+    atomic_fetch_add_explicit (&bench.actions, 1, memory_order_relaxed);
+}
+
+static bool
+count_on_worker (const FacronConfEntry *entry, const FacronEvent *event, unsigned long long read_ns, void *user_data)
+{
+    (void) read_ns;
+    count_action (entry, event, user_data);
+    return true;
+}
+
+/* Hands the event over to the workers instead of matching it */
+static bool
+push_event (const FacronConfGeneration *generation, const FacronEvent *event, void *user_data)
+{
+    facron_pipeline_push ((FacronPipeline *) user_data, generation, event, 0);
+    return false;
+}
+
+/* The events, in the layout fanotify uses, and the paths their file descriptors would resolve to */
+static void
+fill_events (FacronMetadata *metadata, const char **paths, size_t n, unsigned int hits)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        size_t rule = bench_random () % bench.n_paths;
+
+        metadata[i] = (FacronMetadata) {
+            .event_len = sizeof (FacronMetadata),
+            .vers = FANOTIFY_METADATA_VERSION,
+            .metadata_len = sizeof (FacronMetadata),
+            .mask = FAN_CLOSE_WRITE,
+            .fd = -1,
+            .pid = 1,
+        };
+        paths[i] = bench.paths[(bench_random () % 100 < hits) ? rule : bench.n_paths + rule];
+    }
+}
+
+/* Feeds the events a read at a time, until the pipeline, if any, is done with them all */
+static double
+run (FacronDispatch *dispatch, FacronPipeline *pipeline, const FacronConfGeneration *generation, size_t n_events)
+{
+    unsigned long long start = facron_loop_now ();
+
+    for (size_t done = 0; done < n_events; done += BATCH_EVENTS)
+    {
+        size_t n = (n_events - done < BATCH_EVENTS) ? n_events - done : BATCH_EVENTS;
+        const FacronMetadata *metadata = bench.metadata + done;
+        const char **paths = bench.event_paths + done;
+        int len = n * sizeof (FacronMetadata);
+        size_t i = 0;
+
+        for (const FacronMetadata *event = metadata; FAN_EVENT_OK (event, len); event = FAN_EVENT_NEXT (event, len), ++i)
+        {
+            size_t path_len = strlen (paths[i]);
+            memcpy (facron_dispatch_reserve (dispatch), paths[i], path_len);
+            facron_dispatch_push (dispatch, event, path_len);
+        }
+        facron_dispatch_flush (dispatch, generation);
+        if (pipeline)
+            facron_pipeline_kick (pipeline);
+    }
+    if (pipeline)
+        facron_pipeline_drain (pipeline);
+
+    return (facron_loop_now () - start) / 1000000.0;
+}
+
+static void
+report (const char *label, size_t n_events, double elapsed)
+{
+    printf ("%s %.2fms, %.0f events/s, %.1fns per event, %llu commands\n",
+            label,
+            elapsed,
+            (elapsed > 0) ? n_events * 1000.0 / elapsed : 0.0,
+            (n_events) ? elapsed * 1000000.0 / n_events : 0.0,
+            (unsigned long long) atomic_load (&bench.actions));
+}
+
+int
+main (int argc, char *argv[])
+{
+    const char *path = conf_path;
+    size_t n_rules = DEFAULT_RULES;
+    size_t depth = (argc > 2) ? strtoul (argv[2], NULL, 10) : DEFAULT_DEPTH;
+    unsigned int hits = (argc > 3) ? strtoul (argv[3], NULL, 10) : DEFAULT_HITS;
+    size_t n_events = (argc > 4) ? strtoul (argv[4], NULL, 10) : DEFAULT_EVENTS;
+    unsigned int patterns = (argc > 5) ? strtoul (argv[5], NULL, 10) : DEFAULT_PATTERNS;
+    long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    unsigned int max_workers = (argc > 6) ? strtoul (argv[6], NULL, 10) : (n_cpus > 0) ? n_cpus : 1;
+
+    if (argc > 1 && argv[1][0] == '/')
+        path = argv[1];
+    else if (argc > 1)
+        n_rules = strtoul (argv[1], NULL, 10);
+
+    if (path == conf_path && (!n_rules || depth < 3 || !write_conf (n_rules, depth, patterns)))
+    {
+        fprintf (stderr, "Error: could not generate %zu rules of depth %zu\n", n_rules, depth);
+        return EXIT_FAILURE;
+    }
+
+    unsigned long long start = facron_loop_now ();
+    FacronConf *conf = facron_conf_new (path, false);
+    FacronConfGeneration *generation = facron_conf_acquire (conf);
+    double loaded = (facron_loop_now () - start) / 1000000.0;
+    FacronMetrics *metrics = facron_metrics_new (conf);
+    FacronDispatch *dispatch = facron_dispatch_new (metrics, NULL, &count_action, NULL);
+    FacronLoop *loop = facron_loop_new ();
+
+    if (path == conf_path)
+        unlink (conf_path);
+
+    build_paths (generation);
+    if (!bench.n_paths)
+    {
+        fprintf (stderr, "Error: the configuration has no rule\n");
+        return EXIT_FAILURE;
+    }
+    printf ("conf     %zu rules loaded in %.2fms\n", bench.n_paths, loaded);
+
+    bench.metadata = (FacronMetadata *) malloc (n_events * sizeof (FacronMetadata));
+    bench.event_paths = (const char **) malloc (n_events * sizeof (const char *));
+    fill_events (bench.metadata, bench.event_paths, n_events, hits);
+
+    /* warms the caches up */
+    run (dispatch, NULL, generation, (n_events < 10000) ? n_events : 10000);
+    bench.actions = 0;
+    unsigned long long dispatched = facron_metrics_get (metrics, FACRON_METRIC_EVENTS_DISPATCHED);
+    unsigned long long candidates = facron_metrics_get (metrics, FACRON_METRIC_CANDIDATES);
+
+    double elapsed = run (dispatch, NULL, generation, n_events);
+
+    dispatched = facron_metrics_get (metrics, FACRON_METRIC_EVENTS_DISPATCHED) - dispatched;
+    candidates = facron_metrics_get (metrics, FACRON_METRIC_CANDIDATES) - candidates;
+    printf ("dispatch %zu events, %u%% hits: %llu dispatched, %llu commands, %.2f candidate rules per event\n",
+            n_events,
+            hits,
+            dispatched,
+            (unsigned long long) atomic_load (&bench.actions),
+            (dispatched) ? (double) candidates / dispatched : 0.0);
+    report ("dispatch", n_events, elapsed);
+
+    /* the loop thread sorts and drops the duplicates, the workers match */
+    for (unsigned int n_workers = 1; max_workers && n_workers <= max_workers; n_workers = (n_workers < max_workers && 2 * n_workers > max_workers) ? max_workers : 2 * n_workers)
+    {
+        FacronPipeline *pipeline = facron_pipeline_new (loop, metrics, n_workers, &count_on_worker, &count_action, NULL);
+        FacronDispatch *front = facron_dispatch_new (metrics, &push_event, &count_action, pipeline);
+        char label[32];
+
+        if (!pipeline)
+            break;
+        bench.actions = 0;
+        elapsed = run (front, pipeline, generation, n_events);
+        snprintf (label, sizeof (label), "pipeline %u workers", n_workers);
+        report (label, n_events, elapsed);
+        facron_dispatch_free (front);
+        facron_pipeline_free (pipeline);
+        if (n_workers == max_workers)
+            break;
+    }
+
+    free (bench.metadata);
+    free (bench.event_paths);
+    for (size_t i = 0; i < 2 * bench.n_paths; ++i)
+        free (bench.paths[i]);
+    free (bench.paths);
+    facron_dispatch_free (dispatch);
+    facron_loop_free (loop);
+    facron_metrics_free (metrics);
+    facron_conf_generation_unref (generation);
+    facron_conf_free (conf);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,237 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Queues a batch of close_write events on freshly written files, then drains
+ * it once with the read () loop facron uses by default and once through
+ * io_uring, closing the event fds along the way. Needs CAP_SYS_ADMIN.
+ *
+ * USAGE: facron-bench-reader [events] [buffer size]
+ */
+
+#include "config.h"
+#include "facron-loop.h"
+#include "facron-uring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/fanotify.h>
+
+#include <linux/limits.h>
+
+/* The default fanotify queue holds 16384 events */
+#define DEFAULT_EVENTS 10000
+#define DEFAULT_BUFFER_SIZE (256 * 1024)
+
+typedef struct fanotify_event_metadata FacronMetadata;
+
+static struct
+{
+    FacronLoop *loop;
+    FacronUring *uring;
+    char *buf;
+    size_t size;
+    size_t expected;
+
+    size_t events;
+    unsigned long long wakeups;
+    unsigned long long reads;
+    unsigned long long closes;
+} bench;
+
+static char dir[] = "/tmp/facron-bench-XXXXXX";
+
+static void
+cleanup_files (size_t n)
+{
+    char path[PATH_MAX];
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        sprintf (path, "%s/%zu", dir, i);
+        unlink (path);
+    }
+    rmdir (dir);
+}
+
+/* Each file is distinct, so that fanotify does not merge the events */
+static bool
+generate_events (size_t n)
+{
+    char path[PATH_MAX];
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        sprintf (path, "%s/%zu", dir, i);
+        int fd = open (path, O_WRONLY|O_CREAT|O_CLOEXEC, 0600);
+        if (fd < 0)
+        {
+            fprintf (stderr, "Error: could not open %s: %s\n", path, strerror (errno));
+            return false;
+        }
+        close (fd);
+    }
+
+    return true;
+}
+
+static void
+consume (ssize_t len)
+{
+    for (FacronMetadata *metadata = (FacronMetadata *) bench.buf; FAN_EVENT_OK (metadata, len); metadata = FAN_EVENT_NEXT (metadata, len))
+    {
+        ++bench.events;
+        if (metadata->fd < 0)
+            continue;
+        ++bench.closes;
+        if (bench.uring)
+            facron_uring_close (bench.uring, metadata->fd);
+        else
+            close (metadata->fd);
+    }
+
+    if (bench.events >= bench.expected)
+        facron_loop_quit (bench.loop, true);
+}
+
+static void
+handle_events (int fd, unsigned int events, void *user_data)
+{
+    (void) events;
+    (void) user_data;
+
+    ++bench.wakeups;
+    for (;;)
+    {
+        ssize_t len = read (fd, bench.buf, bench.size);
+
+        ++bench.reads;
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return;
+        consume (len);
+    }
+}
+
+static void
+handle_uring_events (char *buf, ssize_t len, void *user_data)
+{
+    (void) buf;
+    (void) user_data;
+
+    ++bench.wakeups;
+    ++bench.reads;
+    if (len <= 0)
+    {
+        fprintf (stderr, "Error: could not read fanotify events\n");
+        facron_loop_quit (bench.loop, false);
+        return;
+    }
+    consume (len);
+}
+
+static void
+report (const char *name, unsigned long long start)
+{
+    double elapsed = (facron_loop_now () - start) / 1000000.0; /* in ms */
+
+    printf ("%-8s %zu events in %.2fms (%.0f events/s), %llu wakeups, %llu reads, %llu closes\n",
+            name,
+            bench.events,
+            elapsed,
+            (elapsed > 0) ? bench.events * 1000.0 / elapsed : 0.0,
+            bench.wakeups,
+            bench.reads,
+            bench.closes);
+}
+
+static void
+reset (void)
+{
+    bench.events = 0;
+    bench.wakeups = 0;
+    bench.reads = 0;
+    bench.closes = 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+    bench.expected = (argc > 1) ? strtoul (argv[1], NULL, 10) : DEFAULT_EVENTS;
+    bench.size = (argc > 2) ? strtoul (argv[2], NULL, 10) : DEFAULT_BUFFER_SIZE;
+
+    int fanotify_fd = fanotify_init (FAN_CLASS_NOTIF|FAN_CLOEXEC|FAN_NONBLOCK, O_RDONLY|O_LARGEFILE|O_CLOEXEC);
+    if (fanotify_fd < 0)
+    {
+        fprintf (stderr, "Error: could not initialize fanotify: %s\n", strerror (errno));
+        return EXIT_FAILURE;
+    }
+    if (!mkdtemp (dir))
+    {
+        fprintf (stderr, "Error: could not create a temporary directory: %s\n", strerror (errno));
+        return EXIT_FAILURE;
+    }
+    if (fanotify_mark (fanotify_fd, FAN_MARK_ADD, FAN_CLOSE_WRITE|FAN_EVENT_ON_CHILD, AT_FDCWD, dir) < 0)
+    {
+        fprintf (stderr, "Error: could not watch %s: %s\n", dir, strerror (errno));
+        rmdir (dir);
+        return EXIT_FAILURE;
+    }
+
+    bench.buf = (char *) malloc (bench.size);
+    bench.loop = facron_loop_new ();
+
+    bool ok = generate_events (bench.expected);
+    if (ok)
+    {
+        facron_loop_add_fd (bench.loop, fanotify_fd, EPOLLIN, &handle_events, NULL);
+        unsigned long long start = facron_loop_now ();
+        ok = facron_loop_run (bench.loop);
+        report ("read", start);
+        facron_loop_remove_fd (bench.loop, fanotify_fd);
+    }
+
+    reset ();
+    if (ok && (ok = generate_events (bench.expected)))
+    {
+        unsigned long long start = facron_loop_now ();
+        if ((bench.uring = facron_uring_new (bench.loop, fanotify_fd, bench.buf, bench.size, &handle_uring_events, NULL)))
+        {
+            ok = facron_loop_run (bench.loop);
+            report ("io_uring", start);
+            fflush (stdout);
+            facron_uring_dump_stats (bench.uring);
+            facron_uring_free (bench.uring);
+        }
+    }
+
+    cleanup_files (bench.expected);
+    facron_loop_free (bench.loop);
+    free (bench.buf);
+    close (fanotify_fd);
+
+    return (ok) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
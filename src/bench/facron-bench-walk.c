@@ -0,0 +1,204 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Builds a tree of the given number of directories, or takes an existing
+ * one, then times its discovery with 1, 2, 4... threads, and the placement
+ * and removal of a mark on each of its directories when allowed to. The
+ * dentry cache is warmed up by a first walk, so that the runs compare.
+ *
+ * USAGE: facron-bench-walk [directories|root]
+ */
+
+#include "config.h"
+#include "facron-loop.h"
+#include "facron-walk.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+
+#include <linux/limits.h>
+
+#define DEFAULT_DIRS 20000
+#define FANOUT       16
+#define MAX_THREADS  16
+
+static char dir[] = "/tmp/facron-bench-XXXXXX";
+
+static struct
+{
+    char **dirs;
+    size_t n_dirs;
+} tree;
+
+/* Directory i lives in directory (i - 1) / FANOUT, the root being directory 0 */
+static bool
+build_tree (size_t n)
+{
+    tree.dirs = (char **) calloc (n, sizeof (char *));
+    tree.dirs[0] = strdup (dir);
+    tree.n_dirs = 1;
+
+    for (size_t i = 1; i < n; ++i)
+    {
+        char path[PATH_MAX];
+
+        snprintf (path, sizeof (path), "%s/%zu", tree.dirs[(i - 1) / FANOUT], i);
+        if (mkdir (path, 0700) < 0)
+        {
+            fprintf (stderr, "Error: could not create %s: %s\n", path, strerror (errno));
+            return false;
+        }
+        tree.dirs[tree.n_dirs++] = strdup (path);
+    }
+
+    return true;
+}
+
+static void
+cleanup_tree (void)
+{
+    while (tree.n_dirs)
+    {
+        rmdir (tree.dirs[--tree.n_dirs]);
+        free (tree.dirs[tree.n_dirs]);
+    }
+    free (tree.dirs);
+}
+
+static void
+count_dir (const char *path, size_t len, void *user_data)
+{
+    (void) path;
+    (void) len;
+    ++*(size_t *) user_data;
+}
+
+typedef struct
+{
+    int fanotify_fd;
+    size_t failed;
+} FacronBenchMarks;
+
+static void
+mark_dir (const char *path, size_t len, void *user_data)
+{
+    FacronBenchMarks *marks = (FacronBenchMarks *) user_data;
+    (void) len;
+
+    if (fanotify_mark (marks->fanotify_fd, FAN_MARK_ADD, FAN_CLOSE_WRITE|FAN_EVENT_ON_CHILD, AT_FDCWD, path) < 0)
+        ++marks->failed;
+}
+
+static double
+elapsed_ms (unsigned long long start)
+{
+    return (facron_loop_now () - start) / 1000000.0;
+}
+
+static void
+bench_marks (const char *root)
+{
+    FacronBenchMarks marks = { fanotify_init (FAN_CLASS_NOTIF|FAN_CLOEXEC|FAN_UNLIMITED_MARKS, O_RDONLY|O_CLOEXEC), 0 };
+
+    if (marks.fanotify_fd < 0)
+    {
+        printf ("marks    skipped: %s\n", strerror (errno));
+        return;
+    }
+
+    unsigned long long start = facron_loop_now ();
+    size_t n = facron_walk (root, 0, NULL, &mark_dir, &marks);
+    double walked = elapsed_ms (start);
+
+    start = facron_loop_now ();
+    fanotify_mark (marks.fanotify_fd, FAN_MARK_FLUSH, 0, AT_FDCWD, root);
+    double flushed = elapsed_ms (start);
+
+    printf ("marks    %zu directories walked and marked in %.2fms (%.0f marks/s), %zu failed, removed in %.2fms\n",
+            n,
+            walked,
+            (walked > 0) ? n * 1000.0 / walked : 0.0,
+            marks.failed,
+            flushed);
+    close (marks.fanotify_fd);
+}
+
+int
+main (int argc, char *argv[])
+{
+    const char *root = dir;
+    size_t n_dirs = DEFAULT_DIRS;
+
+    if (argc > 1 && argv[1][0] == '/')
+        root = argv[1];
+    else if (argc > 1)
+        n_dirs = strtoul (argv[1], NULL, 10);
+
+    if (root == dir)
+    {
+        if (!n_dirs || !mkdtemp (dir))
+        {
+            fprintf (stderr, "Error: could not create a temporary directory: %s\n", strerror (errno));
+            return EXIT_FAILURE;
+        }
+        unsigned long long start = facron_loop_now ();
+        bool ok = build_tree (n_dirs);
+        printf ("build    %zu directories in %.2fms\n", tree.n_dirs, elapsed_ms (start));
+        if (!ok)
+        {
+            cleanup_tree ();
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t found = 0;
+    facron_walk (root, 0, NULL, &count_dir, &found);
+
+    long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    for (unsigned int n_threads = 1; n_threads <= MAX_THREADS; n_threads *= 2)
+    {
+        found = 0;
+        unsigned long long start = facron_loop_now ();
+        facron_walk (root, n_threads, NULL, &count_dir, &found);
+        double elapsed = elapsed_ms (start);
+
+        printf ("walk     %2u threads: %zu directories in %.2fms (%.0f directories/s)\n",
+                n_threads,
+                found,
+                elapsed,
+                (elapsed > 0) ? found * 1000.0 / elapsed : 0.0);
+        if (n_cpus > 0 && n_threads >= (unsigned long) n_cpus * 2)
+            break;
+    }
+
+    bench_marks (root);
+
+    if (root == dir)
+        cleanup_tree ();
+
+    return EXIT_SUCCESS;
+}
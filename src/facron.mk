@@ -21,14 +21,60 @@ sbin_PROGRAMS += \
 
 sbin_facron_SOURCES = \
 	src/facron/facron.c \
+	src/facron/facron-batch.h \
+	src/facron/facron-batch.c \
+	src/facron/facron-command.h \
+	src/facron/facron-command.c \
 	src/facron/facron-conf.h \
 	src/facron/facron-conf.c \
 	src/facron/facron-conf-entry.h \
 	src/facron/facron-conf-entry.c \
+	src/facron/facron-coprocess.h \
+	src/facron/facron-coprocess.c \
+	src/facron/facron-debounce.h \
+	src/facron/facron-debounce.c \
+	src/facron/facron-dispatch.h \
+	src/facron/facron-dispatch.c \
+	src/facron/facron-executor.h \
+	src/facron/facron-executor.c \
+	src/facron/facron-exclude.h \
+	src/facron/facron-exclude.c \
+	src/facron/facron-fid.h \
+	src/facron/facron-fid.c \
+	src/facron/facron-glob.h \
+	src/facron/facron-glob.c \
+	src/facron/facron-hash.h \
+	src/facron/facron-hash.c \
 	src/facron/facron-lexer.h \
 	src/facron/facron-lexer.c \
+	src/facron/facron-limiter.h \
+	src/facron/facron-limiter.c \
+	src/facron/facron-loop.h \
+	src/facron/facron-loop.c \
+	src/facron/facron-marks.h \
+	src/facron/facron-marks.c \
+	src/facron/facron-metrics.h \
+	src/facron/facron-metrics.c \
 	src/facron/facron-parser.h \
 	src/facron/facron-parser.c \
+	src/facron/facron-pipeline.h \
+	src/facron/facron-pipeline.c \
+	src/facron/facron-radix.h \
+	src/facron/facron-radix.c \
+	src/facron/facron-record.h \
+	src/facron/facron-record.c \
+	src/facron/facron-reload.h \
+	src/facron/facron-reload.c \
+	src/facron/facron-replay.h \
+	src/facron/facron-replay.c \
+	src/facron/facron-rescan.h \
+	src/facron/facron-rescan.c \
+	src/facron/facron-rule.h \
+	src/facron/facron-rule.c \
+	src/facron/facron-uring.h \
+	src/facron/facron-uring.c \
+	src/facron/facron-walk.h \
+	src/facron/facron-walk.c \
 	$(NULL)
 
 sbin_facron_CFLAGS = \
@@ -37,3 +83,86 @@ sbin_facron_CFLAGS = \
 
 sbin_facron_LDADD = \
 	$(NULL)
+
+# Compares the plain read () loop with io_uring, needs to run as root
+
+noinst_PROGRAMS += \
+	bench/facron-bench-reader \
+	$(NULL)
+
+bench_facron_bench_reader_SOURCES = \
+	src/bench/facron-bench-reader.c \
+	src/facron/facron-loop.h \
+	src/facron/facron-loop.c \
+	src/facron/facron-uring.h \
+	src/facron/facron-uring.c \
+	$(NULL)
+
+bench_facron_bench_reader_CFLAGS = \
+	$(AM_CFLAGS) \
+	-I$(srcdir)/src/facron \
+	$(NULL)
+
+# Times the discovery of a tree with an increasing number of threads, and
+# its marking when run as root
+
+noinst_PROGRAMS += \
+	bench/facron-bench-walk \
+	$(NULL)
+
+bench_facron_bench_walk_SOURCES = \
+	src/bench/facron-bench-walk.c \
+	src/facron/facron-loop.h \
+	src/facron/facron-loop.c \
+	src/facron/facron-walk.h \
+	src/facron/facron-walk.c \
+	$(NULL)
+
+bench_facron_bench_walk_CFLAGS = \
+	$(AM_CFLAGS) \
+	-I$(srcdir)/src/facron \
+	$(NULL)
+
+# Feeds synthetic events through the rules of a generated or given
+# configuration and reports the cost of their dispatch
+
+noinst_PROGRAMS += \
+	bench/facron-bench-dispatch \
+	$(NULL)
+
+bench_facron_bench_dispatch_SOURCES = \
+	src/bench/facron-bench-dispatch.c \
+	src/facron/facron-command.h \
+	src/facron/facron-command.c \
+	src/facron/facron-conf.h \
+	src/facron/facron-conf.c \
+	src/facron/facron-conf-entry.h \
+	src/facron/facron-conf-entry.c \
+	src/facron/facron-dispatch.h \
+	src/facron/facron-dispatch.c \
+	src/facron/facron-exclude.h \
+	src/facron/facron-exclude.c \
+	src/facron/facron-glob.h \
+	src/facron/facron-glob.c \
+	src/facron/facron-hash.h \
+	src/facron/facron-hash.c \
+	src/facron/facron-lexer.h \
+	src/facron/facron-lexer.c \
+	src/facron/facron-loop.h \
+	src/facron/facron-loop.c \
+	src/facron/facron-metrics.h \
+	src/facron/facron-metrics.c \
+	src/facron/facron-parser.h \
+	src/facron/facron-parser.c \
+	src/facron/facron-pipeline.h \
+	src/facron/facron-pipeline.c \
+	src/facron/facron-radix.h \
+	src/facron/facron-radix.c \
+	src/facron/facron-rule.h \
+	src/facron/facron-rule.c \
+	$(NULL)
+
+bench_facron_bench_dispatch_CFLAGS = \
+	$(AM_CFLAGS) \
+	-I$(srcdir)/src/facron \
+	$(NULL)
@@ -0,0 +1,178 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "facron-batch.h"
+#include "facron-hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Keep the command line well below ARG_MAX whatever the batch size is */
+#define MAX_BATCH_BYTES (1024 * 1024)
+
+/*
+ * Paths matched by an entry are collected, without duplicates, until
+ * either the batch is full or its window elapses, the command is then run
+ * once for all of them.
+ */
+
+typedef struct
+{
+    FacronBatch *batch;
+    const FacronConfEntry *entry;
+    FacronLoopTimer *timer;
+    FacronHash *seen;
+    char **paths;
+    size_t n_paths;
+    size_t paths_size;
+    size_t bytes;
+} FacronBatchPending;
+
+struct FacronBatch
+{
+    FacronLoop *loop;
+    FacronHash *pending; /* entry -> FacronBatchPending */
+    FacronBatchFunc func;
+    void *user_data;
+    unsigned long long pushed;
+    unsigned long long batches;
+};
+
+static void
+facron_batch_pending_free (FacronBatchPending *pending)
+{
+    for (size_t i = 0; i < pending->n_paths; ++i)
+        free (pending->paths[i]);
+    free (pending->paths);
+    facron_hash_free (pending->seen, NULL);
+    free (pending);
+}
+
+static void
+facron_batch_fire (FacronBatchPending *pending)
+{
+    FacronBatch *batch = pending->batch;
+
+    facron_hash_remove (batch->pending, &pending->entry, sizeof (const FacronConfEntry *));
+    ++batch->batches;
+    batch->func (pending->entry, pending->paths, pending->n_paths, batch->user_data);
+    facron_batch_pending_free (pending);
+}
+
+static void
+facron_batch_timeout (void *user_data)
+{
+    facron_batch_fire ((FacronBatchPending *) user_data);
+}
+
+void
+facron_batch_push (FacronBatch *batch, const FacronConfEntry *entry, const char *path, size_t len)
+{
+    FacronBatchPending *pending = (FacronBatchPending *) facron_hash_lookup (batch->pending, &entry, sizeof (const FacronConfEntry *));
+
+    ++batch->pushed;
+
+    if (!pending)
+    {
+        pending = (FacronBatchPending *) calloc (1, sizeof (FacronBatchPending));
+        pending->batch = batch;
+        pending->entry = entry;
+        pending->seen = facron_hash_new ();
+        pending->timer = facron_loop_add_timer (batch->loop, entry->options.batch_window_ms, &facron_batch_timeout, pending);
+        facron_hash_insert (batch->pending, &pending->entry, sizeof (const FacronConfEntry *), pending);
+    }
+    else if (facron_hash_lookup (pending->seen, path, len))
+        return;
+
+    if (pending->n_paths == pending->paths_size)
+    {
+        pending->paths_size = (pending->paths_size) ? pending->paths_size * 2 : 16;
+        pending->paths = (char **) realloc (pending->paths, pending->paths_size * sizeof (char *));
+    }
+    pending->paths[pending->n_paths] = strndup (path, len);
+    facron_hash_insert (pending->seen, path, len, pending->paths[pending->n_paths]);
+    ++pending->n_paths;
+    pending->bytes += len + 1;
+
+    if (pending->n_paths >= entry->options.batch_size || pending->bytes >= MAX_BATCH_BYTES)
+    {
+        facron_loop_remove_timer (batch->loop, pending->timer);
+        facron_batch_fire (pending);
+    }
+}
+
+static void
+flush_pending (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronBatchPending *pending = (FacronBatchPending *) value;
+    (void) key;
+    (void) key_len;
+    (void) user_data;
+
+    facron_loop_remove_timer (pending->batch->loop, pending->timer);
+    facron_batch_fire (pending);
+}
+
+void
+facron_batch_flush (FacronBatch *batch)
+{
+    facron_hash_foreach (batch->pending, &flush_pending, NULL);
+}
+
+void
+facron_batch_dump_stats (const FacronBatch *batch)
+{
+    fprintf (stderr, "Notice: %llu batched events, %llu batches run (%.2f events per batch), %zu pending\n",
+             batch->pushed,
+             batch->batches,
+             batch->batches ? (double) batch->pushed / batch->batches : 0.0,
+             facron_hash_size (batch->pending));
+}
+
+static void
+free_pending (void *value)
+{
+    FacronBatchPending *pending = (FacronBatchPending *) value;
+
+    facron_loop_remove_timer (pending->batch->loop, pending->timer);
+    facron_batch_pending_free (pending);
+}
+
+void
+facron_batch_free (FacronBatch *batch)
+{
+    facron_hash_free (batch->pending, &free_pending);
+    free (batch);
+}
+
+FacronBatch *
+facron_batch_new (FacronLoop *loop, FacronBatchFunc func, void *user_data)
+{
+    FacronBatch *batch = (FacronBatch *) malloc (sizeof (FacronBatch));
+
+    batch->loop = loop;
+    batch->pending = facron_hash_new ();
+    batch->func = func;
+    batch->user_data = user_data;
+    batch->pushed = 0;
+    batch->batches = 0;
+
+    return batch;
+}
@@ -0,0 +1,39 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_BATCH_H__
+#define __FACRON_BATCH_H__
+
+#include "facron-conf-entry.h"
+#include "facron-loop.h"
+
+typedef struct FacronBatch FacronBatch;
+
+typedef void (*FacronBatchFunc) (const FacronConfEntry *entry, char *const *paths, size_t n_paths, void *user_data);
+
+void facron_batch_push  (FacronBatch *batch, const FacronConfEntry *entry, const char *path, size_t len);
+void facron_batch_flush (FacronBatch *batch);
+
+void facron_batch_dump_stats (const FacronBatch *batch);
+
+void facron_batch_free (FacronBatch *batch);
+
+FacronBatch *facron_batch_new (FacronLoop *loop, FacronBatchFunc func, void *user_data);
+
+#endif /* __FACRON_BATCH_H__ */
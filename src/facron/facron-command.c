@@ -0,0 +1,357 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "facron-command.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Room for an unsigned int printed in decimal */
+#define MAX_NUMBER_LEN 10
+
+typedef enum
+{
+    LITERAL,
+    PATH,      /* $$ */
+    DIRNAME,   /* $@ */
+    BASENAME,  /* $# */
+    INCREMENT, /* $+ */
+    DECREMENT, /* $- */
+    COUNTER,   /* $= */
+    PATHS      /* $* */
+} FacronCommandSlotType;
+
+typedef struct
+{
+    FacronCommandSlotType type;
+    const char *literal;
+    size_t len;
+} FacronCommandSlot;
+
+/* n_slots and slots are packed right after this header */
+struct FacronCommand
+{
+    size_t argc;
+    bool uses_counter; /* $+, $- or $= */
+    size_t *n_slots; /* per argument */
+    FacronCommandSlot *slots;
+};
+
+static FacronCommandSlotType
+facron_command_placeholder (char c)
+{
+    switch (c)
+    {
+    case '$':
+        return PATH;
+    case '@':
+        return DIRNAME;
+    case '#':
+        return BASENAME;
+    case '+':
+        return INCREMENT;
+    case '-':
+        return DECREMENT;
+    case '=':
+        return COUNTER;
+    default:
+        return LITERAL;
+    }
+}
+
+/* The placeholders which can be part of a larger argument, the others have to be arguments on their own */
+static inline bool
+facron_command_is_embeddable (FacronCommandSlotType type)
+{
+    return type == PATH || type == DIRNAME || type == BASENAME;
+}
+
+/*
+ * Counts the slots of arg, and fills them if slots is not NULL. Inside a
+ * larger argument, a backslash right before $$, $@ or $# keeps it as is,
+ * without the backslash.
+ */
+static size_t
+facron_command_scan (const char *arg, FacronCommandSlot *slots)
+{
+    size_t n = 0;
+
+    if (arg[0] == '$' && arg[1] && !arg[2])
+    {
+        FacronCommandSlotType type = (arg[1] == '*') ? PATHS : facron_command_placeholder (arg[1]);
+
+        if (type != LITERAL)
+        {
+            if (slots)
+                slots[0] = (FacronCommandSlot) { type, NULL, 0 };
+            return 1;
+        }
+    }
+
+    const char *literal = arg;
+    const char *c = arg;
+
+    while (*c)
+    {
+        bool escaped = (c[0] == '\\' && c[1] == '$');
+        const char *dollar = (escaped) ? c + 1 : c;
+        FacronCommandSlotType type = (dollar[0] == '$') ? facron_command_placeholder (dollar[1]) : LITERAL;
+
+        if (!facron_command_is_embeddable (type))
+        {
+            ++c;
+            continue;
+        }
+
+        if (c != literal)
+        {
+            if (slots)
+                slots[n] = (FacronCommandSlot) { LITERAL, literal, c - literal };
+            ++n;
+        }
+        if (escaped)
+        {
+            /* the placeholder starts the next literal */
+            literal = dollar;
+            c = dollar + 2;
+            continue;
+        }
+        if (slots)
+            slots[n] = (FacronCommandSlot) { type, NULL, 0 };
+        ++n;
+        c += 2;
+        literal = c;
+    }
+
+    if (c != literal)
+    {
+        if (slots)
+            slots[n] = (FacronCommandSlot) { LITERAL, literal, c - literal };
+        ++n;
+    }
+
+    return n;
+}
+
+size_t
+facron_command_size (char *const *argv, size_t argc)
+{
+    size_t n_slots = 0;
+
+    for (size_t i = 0; i < argc; ++i)
+        n_slots += facron_command_scan (argv[i], NULL);
+
+    return sizeof (FacronCommand) + argc * sizeof (size_t) + n_slots * sizeof (FacronCommandSlot);
+}
+
+FacronCommand *
+facron_command_compile (void *mem, char *const *argv, size_t argc)
+{
+    FacronCommand *command = (FacronCommand *) mem;
+
+    command->argc = argc;
+    command->uses_counter = false;
+    command->n_slots = (size_t *) (command + 1);
+    command->slots = (FacronCommandSlot *) (command->n_slots + argc);
+
+    FacronCommandSlot *slots = command->slots;
+    for (size_t i = 0; i < argc; ++i)
+    {
+        command->n_slots[i] = facron_command_scan (argv[i], slots);
+        for (size_t j = 0; j < command->n_slots[i]; ++j)
+        {
+            if (slots[j].type == INCREMENT || slots[j].type == DECREMENT || slots[j].type == COUNTER)
+                command->uses_counter = true;
+        }
+        slots += command->n_slots[i];
+    }
+
+    return command;
+}
+
+bool
+facron_command_uses_counter (const FacronCommand *command)
+{
+    return command->uses_counter;
+}
+
+/* A lone literal slot runs to the end of its NUL terminated argument, which can be used as is from there */
+static inline bool
+facron_command_is_plain (const FacronCommandSlot *slot, size_t n_slots)
+{
+    return n_slots == 1 && slot->type == LITERAL;
+}
+
+static inline bool
+facron_command_is_paths (const FacronCommandSlot *slot, size_t n_slots)
+{
+    return n_slots == 1 && slot->type == PATHS;
+}
+
+static const char *
+facron_command_basename (const char *path, size_t *len)
+{
+    const char *bn = strrchr (path, '/');
+
+    bn = (bn) ? bn + 1 : path;
+    *len = strlen (bn);
+    return bn;
+}
+
+static const char *
+facron_command_dirname (const char *path, size_t *len)
+{
+    const char *c = strrchr (path, '/');
+
+    if (c && c[1] == '\0')
+    {
+        while (c != path && c[-1] == '/')
+            --c;
+        c = (const char *) memrchr (path, '/', c - path);
+    }
+
+    if (!c)
+    {
+        *len = 1;
+        return ".";
+    }
+
+    while (c != path && c[-1] == '/')
+        --c;
+    if (c != path)
+    {
+        *len = c - path;
+        return path;
+    }
+
+    *len = (path[1] == '/') ? 2 : 1;
+    return (path[1] == '/') ? "//" : "/";
+}
+
+size_t
+facron_command_measure (const FacronCommand *command, const FacronCommandContext *context, size_t *argc)
+{
+    const FacronCommandSlot *slot = command->slots;
+    const char *path = context->paths[0];
+    size_t size = 0;
+    size_t len;
+
+    *argc = 0;
+    for (size_t i = 0; i < command->argc; slot += command->n_slots[i++])
+    {
+        if (facron_command_is_paths (slot, command->n_slots[i]))
+        {
+            *argc += context->n_paths;
+            continue;
+        }
+
+        ++*argc;
+        if (facron_command_is_plain (slot, command->n_slots[i]))
+            continue;
+
+        for (size_t j = 0; j < command->n_slots[i]; ++j)
+        {
+            switch (slot[j].type)
+            {
+            case LITERAL:
+                size += slot[j].len;
+                break;
+            case PATH:
+                size += strlen (path);
+                break;
+            case DIRNAME:
+                facron_command_dirname (path, &len);
+                size += len;
+                break;
+            case BASENAME:
+                facron_command_basename (path, &len);
+                size += len;
+                break;
+            default:
+                size += MAX_NUMBER_LEN;
+                break;
+            }
+        }
+        ++size;
+    }
+
+    return size;
+}
+
+void
+facron_command_render (const FacronCommand *command, const FacronCommandContext *context, char *buf, char **argv)
+{
+    const FacronCommandSlot *slot = command->slots;
+    const char *path = context->paths[0];
+    const char *str;
+    size_t len;
+
+    for (size_t i = 0; i < command->argc; slot += command->n_slots[i++])
+    {
+        if (facron_command_is_paths (slot, command->n_slots[i]))
+        {
+            memcpy (argv, context->paths, context->n_paths * sizeof (char *));
+            argv += context->n_paths;
+            continue;
+        }
+
+        if (facron_command_is_plain (slot, command->n_slots[i]))
+        {
+            *argv++ = (char *) slot->literal;
+            continue;
+        }
+
+        *argv++ = buf;
+        for (size_t j = 0; j < command->n_slots[i]; ++j)
+        {
+            switch (slot[j].type)
+            {
+            case LITERAL:
+                buf = mempcpy (buf, slot[j].literal, slot[j].len);
+                break;
+            case PATH:
+                buf = stpcpy (buf, path);
+                break;
+            case DIRNAME:
+                str = facron_command_dirname (path, &len);
+                buf = mempcpy (buf, str, len);
+                break;
+            case BASENAME:
+                buf = stpcpy (buf, facron_command_basename (path, &len));
+                break;
+            case INCREMENT:
+                buf += sprintf (buf, "%u", ++*context->counter);
+                break;
+            case DECREMENT:
+                buf += sprintf (buf, "%u", --*context->counter);
+                break;
+            case COUNTER:
+                buf += sprintf (buf, "%u", *context->counter);
+                break;
+            case PATHS:
+                break;
+            }
+        }
+        *buf++ = '\0';
+    }
+
+    *argv = NULL;
+}
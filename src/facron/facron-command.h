@@ -0,0 +1,54 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_COMMAND_H__
+#define __FACRON_COMMAND_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A command line compiled once into a list of literal and placeholder slots
+ * per argument, rendered for each event into a caller provided buffer.
+ * $$, $@ and $# may be embedded in a larger argument (--file=$$), where
+ * \$$, \$@ and \$# keep them as is, the other placeholders are only
+ * replaced when they are a whole argument.
+ */
+typedef struct FacronCommand FacronCommand;
+
+typedef struct
+{
+    char *const *paths;
+    size_t n_paths;
+    unsigned int *counter; /* for $+, $- and $= */
+} FacronCommandContext;
+
+/* mem must hold facron_command_size bytes, the literals are not copied so argv must outlive the template */
+size_t         facron_command_size    (char *const *argv, size_t argc);
+FacronCommand *facron_command_compile (void *mem, char *const *argv, size_t argc);
+
+/* Whether rendering touches the counter of the context */
+bool facron_command_uses_counter (const FacronCommand *command);
+
+/* Returns the size of the buffer needed by render, argc is set to the number of arguments */
+size_t facron_command_measure (const FacronCommand *command, const FacronCommandContext *context, size_t *argc);
+/* argv must hold argc + 1 pointers, it is NULL terminated */
+void   facron_command_render  (const FacronCommand *command, const FacronCommandContext *context, char *buf, char **argv);
+
+#endif /* __FACRON_COMMAND_H__ */
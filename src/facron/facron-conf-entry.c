@@ -18,27 +18,124 @@
  */
 
 #include "facron-conf-entry.h"
+#include "facron-glob.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 void
 facron_conf_entry_free (FacronConfEntry *entry, bool follow)
 {
-    free (entry->path);
-    for (int i = 0; i < 512 && entry->command[i]; ++i)
-        free (entry->command[i]);
-    if (follow && entry->next)
-        facron_conf_entry_free (entry->next, true);
-    free (entry);
+    for (FacronConfEntry *next; entry; entry = next)
+    {
+        next = (follow) ? entry->next : NULL;
+        free (entry);
+    }
+}
+
+static bool
+facron_conf_strv_equal (char *const *a, char *const *b, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (strcmp (a[i], b[i]))
+            return false;
+    }
+    return true;
+}
+
+static bool
+facron_conf_options_equal (const FacronConfOptions *a, const FacronConfOptions *b)
+{
+    return a->debounce_ms == b->debounce_ms &&
+           a->batch_size == b->batch_size &&
+           a->batch_window_ms == b->batch_window_ms &&
+           a->coprocess == b->coprocess &&
+           a->nul == b->nul &&
+           a->recursive == b->recursive &&
+           a->max_running == b->max_running &&
+           a->queue_size == b->queue_size &&
+           a->overflow == b->overflow;
+}
+
+bool
+facron_conf_overflow_parse (const char *value, FacronOverflow *overflow)
+{
+    if (!strcmp (value, "drop_oldest"))
+        *overflow = FACRON_OVERFLOW_DROP_OLDEST;
+    else if (!strcmp (value, "drop_newest"))
+        *overflow = FACRON_OVERFLOW_DROP_NEWEST;
+    else if (!strcmp (value, "coalesce"))
+        *overflow = FACRON_OVERFLOW_COALESCE;
+    else
+        return false;
+    return true;
+}
+
+bool
+facron_conf_entry_same_action (const FacronConfEntry *a, const FacronConfEntry *b)
+{
+    return a->argc == b->argc &&
+           a->n_excludes == b->n_excludes &&
+           facron_conf_options_equal (&a->options, &b->options) &&
+           facron_conf_strv_equal (a->command, b->command, a->argc) &&
+           facron_conf_strv_equal (a->exclude, b->exclude, a->n_excludes);
 }
 
 FacronConfEntry *
-facron_conf_entry_new (FacronConfEntry *next, char *path)
+facron_conf_entry_new (FacronConfEntry *next, const char *path,
+                       const unsigned long long *mask, size_t n_masks,
+                       char *const *command, size_t argc,
+                       char *const *exclude, size_t n_excludes,
+                       const FacronConfOptions *options)
 {
-    FacronConfEntry *entry = (FacronConfEntry *) malloc (sizeof (FacronConfEntry));
+    size_t strings_len = strlen (path) + 1;
+    for (size_t i = 0; i < argc; ++i)
+        strings_len += strlen (command[i]) + 1;
+    for (size_t i = 0; i < n_excludes; ++i)
+        strings_len += strlen (exclude[i]) + 1;
+
+    size_t template_offset = sizeof (FacronConfEntry) +
+                             n_masks * sizeof (unsigned long long) +
+                             (argc + 1) * sizeof (char *) +
+                             n_excludes * sizeof (char *) +
+                             strings_len;
+    /* keep the compiled command and exclusions pointers aligned */
+    template_offset = (template_offset + sizeof (void *) - 1) & ~(sizeof (void *) - 1);
+    size_t filter_offset = template_offset + facron_command_size (command, argc);
+    filter_offset = (filter_offset + sizeof (void *) - 1) & ~(sizeof (void *) - 1);
+
+    FacronConfEntry *entry = (FacronConfEntry *) malloc (filter_offset + ((n_excludes) ? facron_exclude_size (exclude, n_excludes) : 0));
 
     entry->next = next;
-    entry->path = path;
+    entry->same_path = NULL;
+    entry->is_duplicate = false;
+    entry->n_masks = n_masks;
+    entry->argc = argc;
+    entry->n_excludes = n_excludes;
+    entry->options = *options;
+    entry->mask = (unsigned long long *) (entry + 1);
+    entry->command = (char **) (entry->mask + n_masks);
+    entry->exclude = entry->command + argc + 1;
+    memcpy (entry->mask, mask, n_masks * sizeof (unsigned long long));
+
+    char *strings = (char *) (entry->exclude + n_excludes);
+    for (size_t i = 0; i < argc; ++i)
+    {
+        entry->command[i] = strings;
+        strings = stpcpy (strings, command[i]) + 1;
+    }
+    entry->command[argc] = NULL;
+    for (size_t i = 0; i < n_excludes; ++i)
+    {
+        entry->exclude[i] = strings;
+        strings = stpcpy (strings, exclude[i]) + 1;
+    }
+    entry->path = strings;
+    strcpy (strings, path);
+    entry->is_pattern = facron_glob_is_pattern (path);
+    entry->command_template = facron_command_compile ((char *) entry + template_offset, entry->command, argc);
+    entry->exclude_filter = (n_excludes) ? facron_exclude_compile ((char *) entry + filter_offset, entry->exclude, n_excludes) : NULL;
 
     return entry;
 }
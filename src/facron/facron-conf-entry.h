@@ -20,20 +20,70 @@
 #ifndef __FACRON_CONF_ENTRY_H__
 #define __FACRON_CONF_ENTRY_H__
 
+#include "facron-command.h"
+#include "facron-exclude.h"
+
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct FacronConfEntry FacronConfEntry;
 
+/* What happens to a command when the queue it should wait in is full */
+typedef enum
+{
+    FACRON_OVERFLOW_DROP_OLDEST, /* the command which waited the longest makes room */
+    FACRON_OVERFLOW_DROP_NEWEST, /* the new command is dropped */
+    FACRON_OVERFLOW_COALESCE, /* a command waiting for the same path stands for the new one, the new one is dropped otherwise */
+} FacronOverflow;
+
+typedef struct
+{
+    unsigned int debounce_ms; /* 0: run the command for each event */
+    unsigned int batch_size; /* 0: one path per command */
+    unsigned int batch_window_ms;
+    bool coprocess; /* feed the events to a long running command */
+    bool nul; /* coprocess records are NUL terminated instead of newline terminated */
+    bool recursive; /* children events come from the whole tree below the path */
+    unsigned int max_running; /* 0: no limit of its own on the commands running at once */
+    unsigned int queue_size; /* commands waiting for one of the running ones to exit */
+    FacronOverflow overflow;
+} FacronConfOptions;
+
+/* drop_oldest, drop_newest or coalesce */
+bool facron_conf_overflow_parse (const char *value, FacronOverflow *overflow);
+
+/*
+ * An entry is a single allocation: the masks, the NULL terminated command
+ * vector, the exclusion patterns, all the strings, the compiled command and
+ * the compiled exclusions are packed right after this header.
+ */
 struct FacronConfEntry
 {
     FacronConfEntry *next;
+    FacronConfEntry *same_path; /* next entry watching the same path, set by the conf index */
     char *path;
-    unsigned long long mask[512];
-    char *command[512];
+    unsigned long long *mask;
+    char **command;
+    FacronCommand *command_template;
+    char **exclude;
+    FacronExclude *exclude_filter; /* NULL when nothing is excluded */
+    size_t n_masks;
+    size_t argc;
+    size_t n_excludes;
+    bool is_pattern; /* the path contains wildcards */
+    bool is_duplicate; /* runs the same action as an earlier entry of its path, set by the rule of the path */
+    FacronConfOptions options;
 };
 
 void facron_conf_entry_free (FacronConfEntry *entry, bool follow);
 
-FacronConfEntry *facron_conf_entry_new (FacronConfEntry *next, char *path);
+/* Whether both entries run the same command with the same options and exclusions */
+bool facron_conf_entry_same_action (const FacronConfEntry *a, const FacronConfEntry *b);
+
+FacronConfEntry *facron_conf_entry_new (FacronConfEntry *next, const char *path,
+                                        const unsigned long long *mask, size_t n_masks,
+                                        char *const *command, size_t argc,
+                                        char *const *exclude, size_t n_excludes,
+                                        const FacronConfOptions *options);
 
 #endif /* __FACRON_CONF_ENTRY_H_ */
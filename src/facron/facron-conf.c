@@ -18,65 +18,249 @@
  */
 
 #include "facron-conf.h"
+#include "facron-glob.h"
+#include "facron-hash.h"
 #include "facron-parser.h"
+#include "facron-radix.h"
+#include "facron-rule.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include <linux/fanotify.h>
+
+/*
+ * Each (re)load builds a new immutable generation, which is handed over to
+ * the owner of the conf and becomes the current one when it publishes it.
+ * A retired generation is freed once the last reference to it is dropped.
+ *
+ * The entries of each path, or pattern, are compiled into a single rule,
+ * which is what the lookups return.
+ */
+struct FacronConfGeneration
+{
+    FacronConfEntry *entries;
+    FacronRule **rules; /* in file order */
+    size_t n_rules;
+    FacronHash *index; /* path -> FacronRule */
+    FacronRadix *children; /* rules of the directories watched with FAN_EVENT_ON_CHILD */
+    FacronGlob *patterns; /* rules whose path has wildcards, which are in neither of the above */
+    void *attachment; /* prepared along with the generation, until taken */
+    void (*free_attachment) (void *attachment);
+    atomic_uint refs;
+};
 
 struct FacronConf
 {
     FacronParser *parser;
-    FacronConfEntry *entries;
+    FacronConfGeneration *_Atomic current;
+    FacronConfGeneration *_Atomic offered; /* built but not published yet */
 };
 
-static bool
-facron_conf_load (FacronConf *conf)
+static void
+facron_conf_index (FacronConfGeneration *generation)
+{
+    FacronHash *paths = facron_hash_new (); /* path -> first entry watching it */
+
+    generation->index = facron_hash_new ();
+    generation->children = facron_radix_new ();
+    generation->patterns = facron_glob_new ();
+    generation->n_rules = 0;
+
+    /* entries are stored in reverse order, prepending them gives back the file order */
+    for (FacronConfEntry *entry = generation->entries; entry; entry = entry->next)
+    {
+        size_t len = strlen (entry->path);
+
+        entry->same_path = (FacronConfEntry *) facron_hash_lookup (paths, entry->path, len);
+        if (!entry->same_path)
+            ++generation->n_rules;
+        facron_hash_insert (paths, entry->path, len, entry);
+    }
+
+    /* the entries are visited from the last one, filling the rules from the end gives the file order */
+    generation->rules = (FacronRule **) malloc (generation->n_rules * sizeof (FacronRule *));
+    FacronRule **rule = generation->rules + generation->n_rules;
+    for (FacronConfEntry *entry = generation->entries; entry; entry = entry->next)
+    {
+        if (facron_hash_lookup (paths, entry->path, strlen (entry->path)) == entry)
+            *--rule = facron_rule_new (entry);
+    }
+
+    for (size_t i = 0; i < generation->n_rules; ++i)
+    {
+        FacronRule *r = generation->rules[i];
+        const char *path = facron_rule_get_path (r);
+
+        if (facron_glob_is_pattern (path))
+            facron_glob_insert (generation->patterns, path, r);
+        else
+        {
+            facron_hash_insert (generation->index, path, strlen (path), r);
+            if (facron_rule_watches_children (r))
+                facron_radix_insert (generation->children, path, r);
+        }
+    }
+
+    facron_hash_free (paths, NULL);
+}
+
+FacronConfGeneration *
+facron_conf_generation_ref (FacronConfGeneration *generation)
+{
+    atomic_fetch_add_explicit (&generation->refs, 1, memory_order_relaxed);
+    return generation;
+}
+
+void
+facron_conf_generation_unref (FacronConfGeneration *generation)
+{
+    if (!generation || atomic_fetch_sub_explicit (&generation->refs, 1, memory_order_acq_rel) != 1)
+        return;
+
+    for (size_t i = 0; i < generation->n_rules; ++i)
+        facron_rule_free (generation->rules[i]);
+    free (generation->rules);
+    facron_conf_entry_free (generation->entries, true);
+    facron_hash_free (generation->index, NULL);
+    facron_radix_free (generation->children);
+    facron_glob_free (generation->patterns);
+    if (generation->attachment)
+        generation->free_attachment (generation->attachment);
+    free (generation);
+}
+
+void
+facron_conf_generation_attach (FacronConfGeneration *generation, void *attachment, void (*free_attachment) (void *attachment))
+{
+    generation->attachment = attachment;
+    generation->free_attachment = free_attachment;
+}
+
+void *
+facron_conf_generation_take (FacronConfGeneration *generation)
+{
+    void *attachment = generation->attachment;
+
+    generation->attachment = NULL;
+    return attachment;
+}
+
+FacronConfGeneration *
+facron_conf_build (FacronConf *conf)
 {
     if (!facron_parser_reload (conf->parser))
-        return false;
+        return NULL;
 
     fprintf (stderr, "Notice: loading configuration\n");
 
-    for (FacronConfEntry *entry; (entry = facron_parser_parse_entry (conf->parser)); conf->entries = entry);
+    FacronConfGeneration *generation = (FacronConfGeneration *) calloc (1, sizeof (FacronConfGeneration));
+    atomic_init (&generation->refs, 1);
 
-    return true;
+    for (FacronConfEntry *entry; (entry = facron_parser_parse_entry (conf->parser)); generation->entries = entry);
+
+    facron_conf_index (generation);
+
+    return generation;
+}
+
+void
+facron_conf_offer (FacronConf *conf, FacronConfGeneration *generation)
+{
+    /* a generation offered earlier but never published is superseded */
+    facron_conf_generation_unref (atomic_exchange_explicit (&conf->offered, generation, memory_order_acq_rel));
 }
 
 bool
-facron_conf_reload (FacronConf *conf)
+facron_conf_publish (FacronConf *conf)
 {
-    FacronConfEntry *entries = conf->entries;
-    conf->entries = NULL;
-    if (!facron_conf_load (conf))
-    {
-        conf->entries = entries;
+    FacronConfGeneration *generation = atomic_exchange_explicit (&conf->offered, NULL, memory_order_acq_rel);
+
+    if (!generation)
         return false;
-    }
-    if (entries)
-        facron_conf_entry_free (entries, true);
+
+    facron_conf_generation_unref (atomic_exchange_explicit (&conf->current, generation, memory_order_acq_rel));
     return true;
 }
 
+/* Not a safe load-then-ref against another thread publishing, hence loop thread only */
+FacronConfGeneration *
+facron_conf_acquire (FacronConf *conf)
+{
+    return facron_conf_generation_ref (atomic_load_explicit (&conf->current, memory_order_acquire));
+}
+
+const FacronRule *
+facron_conf_lookup (const FacronConfGeneration *generation, const char *path, size_t len)
+{
+    return (const FacronRule *) facron_hash_lookup (generation->index, path, len);
+}
+
 const FacronConfEntry *
-facron_conf_get_entries (FacronConf *conf)
+facron_conf_get_entries (const FacronConfGeneration *generation)
+{
+    return generation->entries;
+}
+
+const FacronRule *const *
+facron_conf_get_rules (const FacronConfGeneration *generation, size_t *n_rules)
 {
-    return conf->entries;
+    *n_rules = generation->n_rules;
+    return (const FacronRule *const *) generation->rules;
+}
+
+typedef struct
+{
+    FacronConfRuleFunc func;
+    void *user_data;
+} FacronConfClosure;
+
+static void
+facron_conf_ancestor_cb (void *value, size_t distance, void *user_data)
+{
+    FacronConfClosure *closure = (FacronConfClosure *) user_data;
+    closure->func ((const FacronRule *) value, distance, closure->user_data);
+}
+
+size_t
+facron_conf_foreach_ancestor (const FacronConfGeneration *generation, const char *path, size_t len, FacronConfRuleFunc func, void *user_data)
+{
+    FacronConfClosure closure = { func, user_data };
+    return facron_radix_foreach_ancestor (generation->children, path, len, &facron_conf_ancestor_cb, &closure);
+}
+
+size_t
+facron_conf_foreach_pattern (const FacronConfGeneration *generation, const char *path, size_t len, FacronConfRuleFunc func, void *user_data)
+{
+    FacronConfClosure closure = { func, user_data };
+    return facron_glob_match (generation->patterns, path, len, &facron_conf_ancestor_cb, &closure);
 }
 
 void
 facron_conf_free (FacronConf *conf)
 {
-    if (conf->entries)
-        facron_conf_entry_free (conf->entries, true);
+    facron_conf_generation_unref (atomic_load (&conf->offered));
+    facron_conf_generation_unref (atomic_load (&conf->current));
     facron_parser_free (conf->parser);
     free (conf);
 }
 
 FacronConf *
-facron_conf_new (void)
+facron_conf_new (const char *path, bool check_paths)
 {
     FacronConf *conf = (FacronConf *) malloc (sizeof (FacronConf));
+    FacronConfGeneration *generation;
 
-    conf->parser = facron_parser_new ();
-    conf->entries = NULL;
-    facron_conf_load (conf);
+    conf->parser = facron_parser_new (path, check_paths);
+    atomic_init (&conf->offered, NULL);
+    /* an unreadable configuration file means an empty configuration */
+    if (!(generation = facron_conf_build (conf)))
+    {
+        generation = (FacronConfGeneration *) calloc (1, sizeof (FacronConfGeneration));
+        atomic_init (&generation->refs, 1);
+        facron_conf_index (generation);
+    }
+    atomic_init (&conf->current, generation);
 
     return conf;
 }
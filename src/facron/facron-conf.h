@@ -21,17 +21,52 @@
 #define __FACRON_CONF_H__
 
 #include "facron-conf-entry.h"
+#include "facron-rule.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct FacronConf FacronConf;
+/* An immutable snapshot of the configuration, valid as long as a reference to it is held */
+typedef struct FacronConfGeneration FacronConfGeneration;
 
-bool facron_conf_reload (FacronConf *conf);
+/* distance is the number of path components between the path of rule and the looked up path */
+typedef void (*FacronConfRuleFunc) (const FacronRule *rule, size_t distance, void *user_data);
 
-const FacronConfEntry *facron_conf_get_entries (FacronConf *conf);
+/* Parses the configuration file into a new generation, one thread at a time, NULL if it cannot be read */
+FacronConfGeneration *facron_conf_build   (FacronConf *conf);
+/* Hands a built generation over, from any thread */
+void                  facron_conf_offer   (FacronConf *conf, FacronConfGeneration *generation);
+/*
+ * Publishing and acquiring are for the loop thread only: acquire takes its
+ * reference after loading the current generation, which is safe because
+ * publish, which drops the old one, cannot run in between.
+ */
+/* Makes the last offered generation the current one, false if none was offered */
+bool                  facron_conf_publish (FacronConf *conf);
+/* Returns a new reference to the current generation */
+FacronConfGeneration *facron_conf_acquire (FacronConf *conf);
+
+FacronConfGeneration *facron_conf_generation_ref   (FacronConfGeneration *generation);
+void                  facron_conf_generation_unref (FacronConfGeneration *generation);
+
+/* Data prepared for a generation before it is offered, freed with it unless taken. Taking is for the loop thread */
+void  facron_conf_generation_attach (FacronConfGeneration *generation, void *attachment, void (*free_attachment) (void *attachment));
+void *facron_conf_generation_take   (FacronConfGeneration *generation);
+
+const FacronConfEntry *facron_conf_get_entries (const FacronConfGeneration *generation);
+/* In file order */
+const FacronRule *const *facron_conf_get_rules (const FacronConfGeneration *generation, size_t *n_rules);
+
+const FacronRule *facron_conf_lookup (const FacronConfGeneration *generation, const char *path, size_t len);
+
+size_t facron_conf_foreach_ancestor (const FacronConfGeneration *generation, const char *path, size_t len, FacronConfRuleFunc func, void *user_data);
+/* Rules whose pattern matches the path (distance 0) or its parent (distance 1) */
+size_t facron_conf_foreach_pattern  (const FacronConfGeneration *generation, const char *path, size_t len, FacronConfRuleFunc func, void *user_data);
 
 void facron_conf_free (FacronConf *conf);
 
-FacronConf *facron_conf_new (void);
+/* check_paths drops the entries whose path cannot be read, which only tools working offline skip */
+FacronConf *facron_conf_new (const char *path, bool check_paths);
 
 #endif /* __FACRON_CONF_H_ */
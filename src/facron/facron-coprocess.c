@@ -0,0 +1,358 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "facron-coprocess.h"
+#include "facron-hash.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+
+#include <linux/limits.h>
+
+/* Records waiting for a slow or restarting worker, beyond that they are dropped */
+#define MAX_BUFFERED (4 * 1024 * 1024)
+/* A worker dying faster than that is restarted after RESTART_DELAY_MS */
+#define MIN_UPTIME_MS    1000
+#define RESTART_DELAY_MS 1000
+
+/*
+ * A coprocess entry starts its command once and writes a record for each
+ * matched event on its stdin:
+ *
+ *     <mask in hex> <pid> <path>\n    (or \0 with the "nul" option)
+ *
+ * The worker is restarted whenever it exits. On reload, the workers of the
+ * entries whose action did not change are handed over to the new entries,
+ * the others are stopped.
+ */
+
+typedef struct
+{
+    FacronCoprocess *coprocess;
+    const FacronConfEntry *entry;
+    pid_t pid; /* -1 when not running */
+    int fd; /* write end of its stdin */
+    bool watching; /* waiting for fd to be writable */
+    unsigned long long started;
+    FacronLoopTimer *restart;
+    char *buf;
+    size_t len;
+    size_t size;
+} FacronCoprocessWorker;
+
+struct FacronCoprocess
+{
+    FacronLoop *loop;
+    FacronExecutor *executor;
+    FacronHash *workers; /* entry -> FacronCoprocessWorker */
+    FacronHash *retired; /* entry of the replaced generation -> FacronCoprocessWorker, during a reload */
+    unsigned long long sent;
+    unsigned long long dropped;
+    unsigned long long restarts;
+};
+
+static void facron_coprocess_spawn (FacronCoprocessWorker *worker);
+
+static void
+facron_coprocess_unwatch (FacronCoprocessWorker *worker)
+{
+    if (worker->watching)
+    {
+        facron_loop_remove_fd (worker->coprocess->loop, worker->fd);
+        worker->watching = false;
+    }
+}
+
+static void
+facron_coprocess_writable (int fd, unsigned int events, void *user_data);
+
+static void
+facron_coprocess_flush (FacronCoprocessWorker *worker)
+{
+    while (worker->len && worker->fd >= 0)
+    {
+        ssize_t n = write (worker->fd, worker->buf, worker->len);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN && !worker->watching)
+                worker->watching = facron_loop_add_fd (worker->coprocess->loop, worker->fd, EPOLLOUT, &facron_coprocess_writable, worker);
+            /* on EPIPE, the exit of the worker will be reported by the executor */
+            return;
+        }
+
+        worker->len -= n;
+        memmove (worker->buf, worker->buf + n, worker->len);
+    }
+
+    facron_coprocess_unwatch (worker);
+}
+
+static void
+facron_coprocess_writable (int fd, unsigned int events, void *user_data)
+{
+    FacronCoprocessWorker *worker = (FacronCoprocessWorker *) user_data;
+    (void) fd;
+
+    if (events & (EPOLLERR|EPOLLHUP))
+        facron_coprocess_unwatch (worker);
+    else
+        facron_coprocess_flush (worker);
+}
+
+/* Whatever was not written yet is lost, returns how many records that was */
+static size_t
+facron_coprocess_drop_buffer (FacronCoprocessWorker *worker)
+{
+    char delim = (worker->entry->options.nul) ? '\0' : '\n';
+    size_t n = 0;
+
+    for (size_t i = 0; i < worker->len; ++i)
+    {
+        if (worker->buf[i] == delim)
+            ++n;
+    }
+    worker->len = 0;
+    worker->coprocess->dropped += n;
+
+    return n;
+}
+
+static void
+facron_coprocess_restart (void *user_data)
+{
+    FacronCoprocessWorker *worker = (FacronCoprocessWorker *) user_data;
+
+    worker->restart = NULL;
+    facron_coprocess_spawn (worker);
+}
+
+static void
+facron_coprocess_schedule_restart (FacronCoprocessWorker *worker, unsigned long long delay_ms)
+{
+    ++worker->coprocess->restarts;
+    worker->restart = facron_loop_add_timer (worker->coprocess->loop, delay_ms, &facron_coprocess_restart, worker);
+}
+
+static void
+facron_coprocess_exited (pid_t pid, int status, void *user_data)
+{
+    FacronCoprocessWorker *worker = (FacronCoprocessWorker *) user_data;
+    (void) pid;
+    (void) status;
+
+    fprintf (stderr, "Warning: coprocess \"%s\" exited, restarting it\n", worker->entry->command[0]);
+
+    facron_coprocess_unwatch (worker);
+    close (worker->fd);
+    worker->fd = -1;
+    worker->pid = -1;
+
+    /* whatever was not written yet is lost with the pipe */
+    facron_coprocess_drop_buffer (worker);
+
+    bool flapping = (facron_loop_now () - worker->started) < MIN_UPTIME_MS * 1000000ULL;
+    facron_coprocess_schedule_restart (worker, (flapping) ? RESTART_DELAY_MS : 0);
+}
+
+static void
+facron_coprocess_spawn (FacronCoprocessWorker *worker)
+{
+    int fds[2];
+
+    if (pipe2 (fds, O_CLOEXEC) < 0)
+    {
+        fprintf (stderr, "Error: could not create a pipe for \"%s\"\n", worker->entry->command[0]);
+        facron_coprocess_schedule_restart (worker, RESTART_DELAY_MS);
+        return;
+    }
+
+    worker->started = facron_loop_now ();
+    worker->pid = facron_executor_start (worker->coprocess->executor, worker->entry->command, fds[0], &facron_coprocess_exited, worker);
+    close (fds[0]);
+
+    if (worker->pid < 0)
+    {
+        close (fds[1]);
+        facron_coprocess_schedule_restart (worker, RESTART_DELAY_MS);
+        return;
+    }
+
+    fcntl (fds[1], F_SETFL, O_NONBLOCK);
+    worker->fd = fds[1];
+    facron_coprocess_flush (worker);
+}
+
+typedef struct
+{
+    const FacronConfEntry *entry;
+    FacronCoprocessWorker *worker;
+} FacronCoprocessMatch;
+
+static void
+match_retired (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronCoprocessWorker *worker = (FacronCoprocessWorker *) value;
+    FacronCoprocessMatch *match = (FacronCoprocessMatch *) user_data;
+    (void) key;
+    (void) key_len;
+
+    if (!match->worker &&
+        !strcmp (worker->entry->path, match->entry->path) &&
+        facron_conf_entry_same_action (worker->entry, match->entry))
+        match->worker = worker;
+}
+
+void
+facron_coprocess_start (FacronCoprocess *coprocess, const FacronConfEntry *entry)
+{
+    if (facron_hash_lookup (coprocess->workers, &entry, sizeof (const FacronConfEntry *)))
+        return;
+
+    /* the worker of an unchanged entry keeps running, along with what it still has to write */
+    FacronCoprocessMatch match = { entry, NULL };
+    if (coprocess->retired)
+        facron_hash_foreach (coprocess->retired, &match_retired, &match);
+    if (match.worker)
+    {
+        facron_hash_remove (coprocess->retired, &match.worker->entry, sizeof (const FacronConfEntry *));
+        match.worker->entry = entry;
+        facron_hash_insert (coprocess->workers, &match.worker->entry, sizeof (const FacronConfEntry *), match.worker);
+        return;
+    }
+
+    FacronCoprocessWorker *worker = (FacronCoprocessWorker *) calloc (1, sizeof (FacronCoprocessWorker));
+
+    worker->coprocess = coprocess;
+    worker->entry = entry;
+    worker->pid = -1;
+    worker->fd = -1;
+    facron_hash_insert (coprocess->workers, &worker->entry, sizeof (const FacronConfEntry *), worker);
+
+    facron_coprocess_spawn (worker);
+}
+
+void
+facron_coprocess_send (FacronCoprocess *coprocess, const FacronConfEntry *entry, const char *path, size_t len, unsigned long long mask, int pid)
+{
+    FacronCoprocessWorker *worker = (FacronCoprocessWorker *) facron_hash_lookup (coprocess->workers, &entry, sizeof (const FacronConfEntry *));
+    char record[64 + PATH_MAX];
+
+    if (!worker)
+        return;
+
+    int record_len = snprintf (record, sizeof (record), "0x%llx %d %.*s%c", mask, pid, (int) len, path, (entry->options.nul) ? '\0' : '\n');
+    if (record_len < 0 || (size_t) record_len >= sizeof (record) || worker->len + record_len > MAX_BUFFERED)
+    {
+        ++coprocess->dropped;
+        return;
+    }
+
+    if (worker->len + record_len > worker->size)
+    {
+        worker->size = (worker->size) ? worker->size : 4096;
+        while (worker->size < worker->len + record_len)
+            worker->size *= 2;
+        worker->buf = (char *) realloc (worker->buf, worker->size);
+    }
+    memcpy (worker->buf + worker->len, record, record_len);
+    worker->len += record_len;
+    ++coprocess->sent;
+
+    if (!worker->watching)
+        facron_coprocess_flush (worker);
+}
+
+static void
+facron_coprocess_worker_free (void *value)
+{
+    FacronCoprocessWorker *worker = (FacronCoprocessWorker *) value;
+
+    /* what the pipe does not take right away is lost */
+    facron_coprocess_flush (worker);
+    facron_coprocess_unwatch (worker);
+    size_t unwritten = facron_coprocess_drop_buffer (worker);
+    if (unwritten)
+        fprintf (stderr, "Warning: coprocess \"%s\" stopped with %zu records left unwritten\n", worker->entry->command[0], unwritten);
+    if (worker->pid > 0)
+        facron_executor_forget (worker->coprocess->executor, worker->pid);
+    /* closing its stdin tells the worker to exit */
+    if (worker->fd >= 0)
+        close (worker->fd);
+    if (worker->restart)
+        facron_loop_remove_timer (worker->coprocess->loop, worker->restart);
+    free (worker->buf);
+    free (worker);
+}
+
+void
+facron_coprocess_retire (FacronCoprocess *coprocess)
+{
+    facron_coprocess_stop_retired (coprocess);
+    coprocess->retired = coprocess->workers;
+    coprocess->workers = facron_hash_new ();
+}
+
+void
+facron_coprocess_stop_retired (FacronCoprocess *coprocess)
+{
+    if (!coprocess->retired)
+        return;
+    facron_hash_free (coprocess->retired, &facron_coprocess_worker_free);
+    coprocess->retired = NULL;
+}
+
+void
+facron_coprocess_dump_stats (const FacronCoprocess *coprocess)
+{
+    fprintf (stderr, "Notice: %zu coprocesses, %llu records sent, %llu dropped, %llu restarts\n",
+             facron_hash_size (coprocess->workers),
+             coprocess->sent,
+             coprocess->dropped,
+             coprocess->restarts);
+}
+
+void
+facron_coprocess_free (FacronCoprocess *coprocess)
+{
+    facron_coprocess_stop_retired (coprocess);
+    facron_hash_free (coprocess->workers, &facron_coprocess_worker_free);
+    free (coprocess);
+}
+
+FacronCoprocess *
+facron_coprocess_new (FacronLoop *loop, FacronExecutor *executor)
+{
+    FacronCoprocess *coprocess = (FacronCoprocess *) calloc (1, sizeof (FacronCoprocess));
+
+    coprocess->loop = loop;
+    coprocess->executor = executor;
+    coprocess->workers = facron_hash_new ();
+
+    return coprocess;
+}
@@ -0,0 +1,42 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_COPROCESS_H__
+#define __FACRON_COPROCESS_H__
+
+#include "facron-conf-entry.h"
+#include "facron-executor.h"
+#include "facron-loop.h"
+
+typedef struct FacronCoprocess FacronCoprocess;
+
+void facron_coprocess_start (FacronCoprocess *coprocess, const FacronConfEntry *entry);
+void facron_coprocess_send  (FacronCoprocess *coprocess, const FacronConfEntry *entry, const char *path, size_t len, unsigned long long mask, int pid);
+/* Before a reload: facron_coprocess_start hands the workers of unchanged entries over to the new ones */
+void facron_coprocess_retire       (FacronCoprocess *coprocess);
+/* After it: the workers nobody took over are stopped */
+void facron_coprocess_stop_retired (FacronCoprocess *coprocess);
+
+void facron_coprocess_dump_stats (const FacronCoprocess *coprocess);
+
+void facron_coprocess_free (FacronCoprocess *coprocess);
+
+FacronCoprocess *facron_coprocess_new (FacronLoop *loop, FacronExecutor *executor);
+
+#endif /* __FACRON_COPROCESS_H__ */
@@ -0,0 +1,170 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "facron-debounce.h"
+#include "facron-hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/limits.h>
+
+/*
+ * The first event for a given (entry, path) arms a timer, the following
+ * ones are collapsed into it until it fires (trailing edge): the command
+ * runs at most once per window for each path.
+ */
+
+typedef struct
+{
+    FacronDebounce *debounce;
+    const FacronConfEntry *entry;
+    FacronLoopTimer *timer;
+    unsigned long long mask;
+    int pid;
+    size_t key_len;
+    char key[]; /* the entry pointer followed by the NUL terminated path */
+} FacronDebouncePending;
+
+struct FacronDebounce
+{
+    FacronLoop *loop;
+    FacronHash *pending;
+    FacronDebounceFunc func;
+    void *user_data;
+    unsigned long long pushed;
+    unsigned long long fired;
+};
+
+static inline const char *
+pending_path (const FacronDebouncePending *pending)
+{
+    return pending->key + sizeof (const FacronConfEntry *);
+}
+
+static void
+facron_debounce_fire (FacronDebouncePending *pending)
+{
+    FacronDebounce *debounce = pending->debounce;
+
+    facron_hash_remove (debounce->pending, pending->key, pending->key_len);
+    ++debounce->fired;
+    debounce->func (pending->entry, pending_path (pending), pending->mask, pending->pid, debounce->user_data);
+    free (pending);
+}
+
+static void
+facron_debounce_timeout (void *user_data)
+{
+    facron_debounce_fire ((FacronDebouncePending *) user_data);
+}
+
+void
+facron_debounce_push (FacronDebounce *debounce, const FacronConfEntry *entry, const char *path, size_t len, unsigned long long mask, int pid)
+{
+    char key[sizeof (const FacronConfEntry *) + PATH_MAX];
+    size_t key_len = sizeof (const FacronConfEntry *) + len;
+
+    if (len >= PATH_MAX)
+        return;
+
+    memcpy (key, &entry, sizeof (const FacronConfEntry *));
+    memcpy (key + sizeof (const FacronConfEntry *), path, len);
+
+    ++debounce->pushed;
+
+    FacronDebouncePending *pending = (FacronDebouncePending *) facron_hash_lookup (debounce->pending, key, key_len);
+    if (pending)
+    {
+        pending->mask |= mask;
+        pending->pid = pid;
+        return;
+    }
+
+    pending = (FacronDebouncePending *) malloc (sizeof (FacronDebouncePending) + key_len + 1);
+
+    pending->debounce = debounce;
+    pending->entry = entry;
+    pending->mask = mask;
+    pending->pid = pid;
+    pending->key_len = key_len;
+    memcpy (pending->key, key, key_len);
+    pending->key[key_len] = '\0';
+    pending->timer = facron_loop_add_timer (debounce->loop, entry->options.debounce_ms, &facron_debounce_timeout, pending);
+    facron_hash_insert (debounce->pending, pending->key, key_len, pending);
+}
+
+static void
+flush_pending (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronDebouncePending *pending = (FacronDebouncePending *) value;
+    (void) key;
+    (void) key_len;
+    (void) user_data;
+
+    facron_loop_remove_timer (pending->debounce->loop, pending->timer);
+    facron_debounce_fire (pending);
+}
+
+void
+facron_debounce_flush (FacronDebounce *debounce)
+{
+    facron_hash_foreach (debounce->pending, &flush_pending, NULL);
+}
+
+void
+facron_debounce_dump_stats (const FacronDebounce *debounce)
+{
+    fprintf (stderr, "Notice: %llu debounced events, %llu commands run, %zu pending\n",
+             debounce->pushed,
+             debounce->fired,
+             facron_hash_size (debounce->pending));
+}
+
+static void
+free_pending (void *value)
+{
+    FacronDebouncePending *pending = (FacronDebouncePending *) value;
+
+    facron_loop_remove_timer (pending->debounce->loop, pending->timer);
+    free (pending);
+}
+
+void
+facron_debounce_free (FacronDebounce *debounce)
+{
+    facron_hash_free (debounce->pending, &free_pending);
+    free (debounce);
+}
+
+FacronDebounce *
+facron_debounce_new (FacronLoop *loop, FacronDebounceFunc func, void *user_data)
+{
+    FacronDebounce *debounce = (FacronDebounce *) malloc (sizeof (FacronDebounce));
+
+    debounce->loop = loop;
+    debounce->pending = facron_hash_new ();
+    debounce->func = func;
+    debounce->user_data = user_data;
+    debounce->pushed = 0;
+    debounce->fired = 0;
+
+    return debounce;
+}
@@ -0,0 +1,40 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_DEBOUNCE_H__
+#define __FACRON_DEBOUNCE_H__
+
+#include "facron-conf-entry.h"
+#include "facron-loop.h"
+
+typedef struct FacronDebounce FacronDebounce;
+
+/* mask is the union of the masks of the collapsed events, pid the one of the last event */
+typedef void (*FacronDebounceFunc) (const FacronConfEntry *entry, const char *path, unsigned long long mask, int pid, void *user_data);
+
+void facron_debounce_push  (FacronDebounce *debounce, const FacronConfEntry *entry, const char *path, size_t len, unsigned long long mask, int pid);
+void facron_debounce_flush (FacronDebounce *debounce);
+
+void facron_debounce_dump_stats (const FacronDebounce *debounce);
+
+void facron_debounce_free (FacronDebounce *debounce);
+
+FacronDebounce *facron_debounce_new (FacronLoop *loop, FacronDebounceFunc func, void *user_data);
+
+#endif /* __FACRON_DEBOUNCE_H__ */
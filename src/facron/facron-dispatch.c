@@ -0,0 +1,262 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "facron-dispatch.h"
+#include "facron-exclude.h"
+#include "facron-loop.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/limits.h>
+
+typedef struct
+{
+    unsigned long long mask;
+    int pid;
+    size_t seq; /* keeps the order of the events of a path */
+    size_t offset; /* of the path in paths, until the flush */
+    const char *path;
+    size_t len;
+} FacronPendingEvent;
+
+struct FacronDispatch
+{
+    FacronMetrics *metrics;
+    FacronDispatchFilter filter;
+    FacronDispatchFunc func;
+    void *user_data;
+
+    FacronPendingEvent *events;
+    size_t n_events;
+    size_t events_size;
+    char *paths;
+    size_t paths_len;
+    size_t paths_size;
+};
+
+typedef struct
+{
+    FacronDispatch *dispatch;
+    const FacronEvent *event;
+    FacronDispatchFunc func;
+    void *user_data;
+} FacronDispatchClosure;
+
+/* The exclusions the kernel could not be told about are checked here, against the last distance components */
+static bool
+facron_dispatch_is_excluded (FacronDispatch *dispatch, const FacronConfEntry *entry, const FacronEvent *event, size_t distance)
+{
+    if (!entry->exclude_filter)
+        return false;
+
+    const char *relative = event->path + event->len;
+    while (relative > event->path && distance)
+    {
+        if (*--relative == '/')
+            --distance;
+    }
+    if (*relative == '/')
+        ++relative;
+
+    if (!facron_exclude_match (entry->exclude_filter, relative, event->path + event->len - relative, event->mask & FAN_ONDIR))
+        return false;
+
+    facron_metrics_add (dispatch->metrics, FACRON_METRIC_EXCLUDED, 1);
+    return true;
+}
+
+static void
+facron_dispatch_child (const FacronRule *rule, size_t distance, void *user_data)
+{
+    FacronDispatchClosure *closure = (FacronDispatchClosure *) user_data;
+    size_t n_actions;
+    const FacronConfEntry *const *actions = facron_rule_decide (rule, closure->event->mask, true, &n_actions);
+    bool matched = false;
+
+    for (size_t i = 0; i < n_actions; ++i)
+    {
+        /* filesystem marks report deeper descendants too, which only trees care about */
+        if ((distance == 1 || actions[i]->options.recursive) &&
+            !facron_dispatch_is_excluded (closure->dispatch, actions[i], closure->event, distance))
+        {
+            closure->func (actions[i], closure->event, closure->user_data);
+            matched = true;
+        }
+    }
+    if (matched)
+        facron_rule_count_match (rule);
+}
+
+static void
+facron_dispatch_exact (const FacronRule *rule, FacronDispatchClosure *closure)
+{
+    size_t n_actions;
+    const FacronConfEntry *const *actions = facron_rule_decide (rule, closure->event->mask, false, &n_actions);
+
+    for (size_t i = 0; i < n_actions; ++i)
+        closure->func (actions[i], closure->event, closure->user_data);
+    if (n_actions)
+        facron_rule_count_match (rule);
+}
+
+static void
+facron_dispatch_pattern (const FacronRule *rule, size_t distance, void *user_data)
+{
+    if (!distance)
+        facron_dispatch_exact (rule, (FacronDispatchClosure *) user_data);
+    else
+        facron_dispatch_child (rule, distance, user_data);
+}
+
+void
+facron_dispatch_event (FacronDispatch *dispatch, const FacronConfGeneration *generation, const FacronEvent *event)
+{
+    unsigned long long start = facron_loop_now ();
+    unsigned long long candidates = 0;
+    FacronDispatchClosure closure = { dispatch, event, dispatch->func, dispatch->user_data };
+    const FacronRule *rule = facron_conf_lookup (generation, event->path, event->len);
+
+    if (rule)
+    {
+        ++candidates;
+        facron_dispatch_exact (rule, &closure);
+    }
+
+    candidates += facron_conf_foreach_ancestor (generation, event->path, event->len, &facron_dispatch_child, &closure);
+    candidates += facron_conf_foreach_pattern (generation, event->path, event->len, &facron_dispatch_pattern, &closure);
+
+    facron_metrics_add (dispatch->metrics, FACRON_METRIC_EVENTS_DISPATCHED, 1);
+    facron_metrics_add (dispatch->metrics, FACRON_METRIC_CANDIDATES, candidates);
+    facron_metrics_raise (dispatch->metrics, FACRON_METRIC_MAX_CANDIDATES, candidates);
+    facron_metrics_observe (dispatch->metrics, FACRON_HISTOGRAM_DISPATCH, facron_loop_now () - start);
+}
+
+static void
+facron_dispatch_tree (const FacronRule *rule, size_t distance, void *user_data)
+{
+    FacronDispatchClosure *closure = (FacronDispatchClosure *) user_data;
+    size_t n_actions;
+    const FacronConfEntry *const *actions = facron_rule_get_actions (rule, &n_actions);
+
+    for (size_t i = 0; i < n_actions; ++i)
+    {
+        if (actions[i]->options.recursive && !facron_dispatch_is_excluded (closure->dispatch, actions[i], closure->event, distance))
+            closure->func (actions[i], closure->event, closure->user_data);
+    }
+}
+
+void
+facron_dispatch_foreach_tree (FacronDispatch *dispatch, const FacronConfGeneration *generation, const FacronEvent *event,
+                              FacronDispatchFunc func, void *user_data)
+{
+    FacronDispatchClosure closure = { dispatch, event, func, user_data };
+    facron_conf_foreach_ancestor (generation, event->path, event->len, &facron_dispatch_tree, &closure);
+}
+
+char *
+facron_dispatch_reserve (FacronDispatch *dispatch)
+{
+    if (dispatch->paths_len + PATH_MAX > dispatch->paths_size)
+    {
+        while (dispatch->paths_len + PATH_MAX > dispatch->paths_size)
+            dispatch->paths_size = (dispatch->paths_size) ? dispatch->paths_size * 2 : 16 * PATH_MAX;
+        dispatch->paths = (char *) realloc (dispatch->paths, dispatch->paths_size);
+    }
+    return dispatch->paths + dispatch->paths_len;
+}
+
+void
+facron_dispatch_push (FacronDispatch *dispatch, const struct fanotify_event_metadata *metadata, size_t len)
+{
+    if (dispatch->n_events == dispatch->events_size)
+    {
+        dispatch->events_size = (dispatch->events_size) ? dispatch->events_size * 2 : 256;
+        dispatch->events = (FacronPendingEvent *) realloc (dispatch->events, dispatch->events_size * sizeof (FacronPendingEvent));
+    }
+
+    dispatch->paths[dispatch->paths_len + len] = '\0';
+    dispatch->events[dispatch->n_events] = (FacronPendingEvent) { metadata->mask, metadata->pid, dispatch->n_events, dispatch->paths_len, NULL, len };
+    ++dispatch->n_events;
+    dispatch->paths_len += len + 1;
+}
+
+static int
+facron_dispatch_compare (const void *a, const void *b)
+{
+    const FacronPendingEvent *event_a = (const FacronPendingEvent *) a;
+    const FacronPendingEvent *event_b = (const FacronPendingEvent *) b;
+    int cmp = strcmp (event_a->path, event_b->path);
+
+    return (cmp) ? cmp : (event_a->seq > event_b->seq) - (event_a->seq < event_b->seq);
+}
+
+size_t
+facron_dispatch_flush (FacronDispatch *dispatch, const FacronConfGeneration *generation)
+{
+    size_t n_dispatched = 0;
+
+    /* the paths do not move anymore */
+    for (size_t i = 0; i < dispatch->n_events; ++i)
+        dispatch->events[i].path = dispatch->paths + dispatch->events[i].offset;
+    qsort (dispatch->events, dispatch->n_events, sizeof (FacronPendingEvent), &facron_dispatch_compare);
+
+    for (size_t i = 0; i < dispatch->n_events; ++i)
+    {
+        const FacronPendingEvent *pending = &dispatch->events[i];
+        FacronEvent event = { pending->mask, pending->pid, pending->path, pending->len };
+
+        if (i && pending->mask == pending[-1].mask && pending->len == pending[-1].len && !memcmp (pending->path, pending[-1].path, pending->len))
+        {
+            facron_metrics_add (dispatch->metrics, FACRON_METRIC_DUPLICATES, 1);
+            continue;
+        }
+        if (dispatch->filter && !dispatch->filter (generation, &event, dispatch->user_data))
+            continue;
+
+        facron_dispatch_event (dispatch, generation, &event);
+        ++n_dispatched;
+    }
+
+    dispatch->n_events = 0;
+    dispatch->paths_len = 0;
+    return n_dispatched;
+}
+
+void
+facron_dispatch_free (FacronDispatch *dispatch)
+{
+    free (dispatch->events);
+    free (dispatch->paths);
+    free (dispatch);
+}
+
+FacronDispatch *
+facron_dispatch_new (FacronMetrics *metrics, FacronDispatchFilter filter, FacronDispatchFunc func, void *user_data)
+{
+    FacronDispatch *dispatch = (FacronDispatch *) calloc (1, sizeof (FacronDispatch));
+
+    dispatch->metrics = metrics;
+    dispatch->filter = filter;
+    dispatch->func = func;
+    dispatch->user_data = user_data;
+
+    return dispatch;
+}
@@ -0,0 +1,67 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_DISPATCH_H__
+#define __FACRON_DISPATCH_H__
+
+#include "facron-conf.h"
+#include "facron-metrics.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/fanotify.h>
+
+/*
+ * Matches the events against the rules of a generation. The events of a read
+ * are pushed with their paths, then flushed sorted by path, the identical
+ * events of a burst being dispatched only once.
+ */
+typedef struct FacronDispatch FacronDispatch;
+
+typedef struct
+{
+    unsigned long long mask;
+    int pid;
+    const char *path;
+    size_t len;
+} FacronEvent;
+
+/* Sees each distinct event of a flush before it is matched, false skips it */
+typedef bool (*FacronDispatchFilter) (const FacronConfGeneration *generation, const FacronEvent *event, void *user_data);
+/* Runs the action of entry for event */
+typedef void (*FacronDispatchFunc)   (const FacronConfEntry *entry, const FacronEvent *event, void *user_data);
+
+/* Room for the path of the next event, PATH_MAX bytes long */
+char  *facron_dispatch_reserve (FacronDispatch *dispatch);
+/* The len bytes written in the reserved room are the path of metadata */
+void   facron_dispatch_push    (FacronDispatch *dispatch, const struct fanotify_event_metadata *metadata, size_t len);
+size_t facron_dispatch_flush   (FacronDispatch *dispatch, const FacronConfGeneration *generation);
+
+void facron_dispatch_event (FacronDispatch *dispatch, const FacronConfGeneration *generation, const FacronEvent *event);
+/* Calls func for the recursive entries whose trees event, a new directory, joins */
+void facron_dispatch_foreach_tree (FacronDispatch *dispatch, const FacronConfGeneration *generation, const FacronEvent *event,
+                                   FacronDispatchFunc func, void *user_data);
+
+void facron_dispatch_free (FacronDispatch *dispatch);
+
+/* filter may be NULL */
+FacronDispatch *facron_dispatch_new (FacronMetrics *metrics, FacronDispatchFilter filter, FacronDispatchFunc func, void *user_data);
+
+#endif /* __FACRON_DISPATCH_H__ */
@@ -0,0 +1,194 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "facron-exclude.h"
+
+#include <fnmatch.h>
+#include <string.h>
+
+#include <linux/limits.h>
+
+typedef enum
+{
+    NAME,      /* .git */
+    SUFFIX,    /* *.swp */
+    GLOB,      /* *~.[0-9] */
+    PATH_GLOB  /* build/obj-* */
+} FacronExcludeType;
+
+typedef struct
+{
+    FacronExcludeType type;
+    const char *pattern; /* without its trailing '/', NUL terminated */
+    size_t len;
+    bool dir_only;
+} FacronExcludeRule;
+
+/* the stripped patterns are packed right after the rules */
+struct FacronExclude
+{
+    size_t n_rules;
+    FacronExcludeRule rules[];
+};
+
+static inline bool
+is_glob (const char *str, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (str[i] == '*' || str[i] == '?' || str[i] == '[' || str[i] == '\\')
+            return true;
+    }
+    return false;
+}
+
+bool
+facron_exclude_is_name (const char *pattern, size_t *len)
+{
+    *len = strlen (pattern);
+    if (*len && pattern[*len - 1] == '/')
+        --*len;
+
+    return *len && !memchr (pattern, '/', *len) && !is_glob (pattern, *len) &&
+           strcmp (pattern, ".") && strcmp (pattern, "..");
+}
+
+size_t
+facron_exclude_size (char *const *patterns, size_t n_patterns)
+{
+    size_t size = sizeof (FacronExclude) + n_patterns * sizeof (FacronExcludeRule);
+
+    for (size_t i = 0; i < n_patterns; ++i)
+        size += strlen (patterns[i]) + 1;
+
+    return size;
+}
+
+FacronExclude *
+facron_exclude_compile (void *mem, char *const *patterns, size_t n_patterns)
+{
+    FacronExclude *exclude = (FacronExclude *) mem;
+    char *strings = (char *) (exclude->rules + n_patterns);
+
+    exclude->n_rules = n_patterns;
+    for (size_t i = 0; i < n_patterns; ++i)
+    {
+        FacronExcludeRule *rule = &exclude->rules[i];
+        const char *pattern = patterns[i];
+        size_t len = strlen (pattern);
+
+        rule->dir_only = (len > 1 && pattern[len - 1] == '/');
+        if (rule->dir_only)
+            --len;
+        /* anchored to the watched path */
+        if (len > 1 && pattern[0] == '/')
+        {
+            ++pattern;
+            --len;
+            rule->type = PATH_GLOB;
+        }
+        else if (memchr (pattern, '/', len))
+            rule->type = PATH_GLOB;
+        else if (pattern[0] == '*' && !is_glob (pattern + 1, len - 1))
+        {
+            /* only the suffix is compared */
+            ++pattern;
+            --len;
+            rule->type = SUFFIX;
+        }
+        else
+            rule->type = (is_glob (pattern, len)) ? GLOB : NAME;
+
+        rule->pattern = strings;
+        rule->len = len;
+        memcpy (strings, pattern, len);
+        strings[len] = '\0';
+        strings += len + 1;
+    }
+
+    return exclude;
+}
+
+static bool
+facron_exclude_match_component (const FacronExcludeRule *rule, const char *component, size_t len, char *name, bool *copied)
+{
+    switch (rule->type)
+    {
+    case NAME:
+        return len == rule->len && !memcmp (component, rule->pattern, len);
+    case SUFFIX:
+        return len >= rule->len && !memcmp (component + len - rule->len, rule->pattern, rule->len);
+    case GLOB:
+        /* fnmatch needs the component on its own */
+        if (!*copied)
+        {
+            memcpy (name, component, len);
+            name[len] = '\0';
+            *copied = true;
+        }
+        return !fnmatch (rule->pattern, name, 0);
+    default:
+        return false;
+    }
+}
+
+bool
+facron_exclude_match (const FacronExclude *exclude, const char *relative, size_t len, bool is_dir)
+{
+    const char *end = relative + len;
+    char name[NAME_MAX + 1];
+
+    for (const char *component = relative; component < end;)
+    {
+        const char *slash = (const char *) memchr (component, '/', end - component);
+        const char *component_end = (slash) ? slash : end;
+        size_t component_len = component_end - component;
+        bool last = !slash;
+        bool copied = false;
+
+        if (component_len > NAME_MAX)
+            return false;
+
+        for (size_t i = 0; i < exclude->n_rules; ++i)
+        {
+            const FacronExcludeRule *rule = &exclude->rules[i];
+
+            if (rule->dir_only && last && !is_dir)
+                continue;
+            if (facron_exclude_match_component (rule, component, component_len, name, &copied))
+                return true;
+        }
+
+        component = component_end + 1;
+    }
+
+    for (size_t i = 0; i < exclude->n_rules; ++i)
+    {
+        const FacronExcludeRule *rule = &exclude->rules[i];
+
+        if (rule->type != PATH_GLOB || fnmatch (rule->pattern, relative, FNM_PATHNAME|FNM_LEADING_DIR))
+            continue;
+        /* a match of the whole path is about the file itself */
+        if (!rule->dir_only || is_dir || fnmatch (rule->pattern, relative, FNM_PATHNAME))
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,44 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_EXCLUDE_H__
+#define __FACRON_EXCLUDE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * The exclusion patterns of an entry, compiled once. A pattern without a '/'
+ * is matched against each component of the path below the watched one, a
+ * pattern containing one against the whole relative path; a trailing '/'
+ * restricts it to directories.
+ */
+typedef struct FacronExclude FacronExclude;
+
+/* mem must hold facron_exclude_size bytes, the patterns are copied */
+size_t         facron_exclude_size    (char *const *patterns, size_t n_patterns);
+FacronExclude *facron_exclude_compile (void *mem, char *const *patterns, size_t n_patterns);
+
+/* relative must be NUL terminated, is_dir tells whether the event is about a directory */
+bool facron_exclude_match (const FacronExclude *exclude, const char *relative, size_t len, bool is_dir);
+
+/* Whether pattern names a single file or directory, whose name is len bytes long */
+bool facron_exclude_is_name (const char *pattern, size_t *len);
+
+#endif /* __FACRON_EXCLUDE_H__ */
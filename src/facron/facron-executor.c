@@ -0,0 +1,190 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "facron-executor.h"
+#include "facron-hash.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+extern char **environ;
+
+/*
+ * Commands are spawned with posix_spawn (clone (CLONE_VM|CLONE_VFORK) in
+ * the libc) and reaped asynchronously when the loop delivers SIGCHLD,
+ * so that the event loop never waits for a child. The workers of a
+ * pipeline spawn commands too, those whose exit is watched are only started
+ * from the loop.
+ */
+
+struct FacronExecutor
+{
+    FacronLoop *loop;
+    posix_spawnattr_t attr;
+    FacronMetrics *metrics;
+    FacronHash *watched; /* pid -> FacronExecutorWatch */
+    atomic_uint in_flight;
+};
+
+typedef struct
+{
+    FacronExecutorExitFunc func;
+    void *user_data;
+} FacronExecutorWatch;
+
+static void
+facron_executor_reap (int signum, void *user_data)
+{
+    FacronExecutor *executor = (FacronExecutor *) user_data;
+    (void) signum;
+
+    /* SIGCHLD may be coalesced, it only tells us to look */
+    pid_t pid;
+    int status;
+    while ((pid = waitpid (-1, &status, WNOHANG)) > 0)
+    {
+        facron_metrics_set (executor->metrics, FACRON_METRIC_IN_FLIGHT, atomic_fetch_sub (&executor->in_flight, 1) - 1);
+
+        FacronExecutorWatch *watch = (FacronExecutorWatch *) facron_hash_remove (executor->watched, &pid, sizeof (pid_t));
+        if (watch)
+        {
+            watch->func (pid, status, watch->user_data);
+            free (watch);
+        }
+    }
+}
+
+pid_t
+facron_executor_start (FacronExecutor *executor, char *const *command, int stdin_fd, FacronExecutorExitFunc func, void *user_data)
+{
+    posix_spawn_file_actions_t actions;
+    if (stdin_fd >= 0)
+    {
+        posix_spawn_file_actions_init (&actions);
+        posix_spawn_file_actions_adddup2 (&actions, stdin_fd, STDIN_FILENO);
+    }
+
+    /* counted before it can be reaped */
+    unsigned int in_flight = atomic_fetch_add (&executor->in_flight, 1) + 1;
+    unsigned long long start = facron_loop_now ();
+    pid_t pid;
+    int ret = posix_spawn (&pid, command[0], (stdin_fd >= 0) ? &actions : NULL, &executor->attr, command, environ);
+    facron_metrics_observe (executor->metrics, FACRON_HISTOGRAM_SPAWN, facron_loop_now () - start);
+
+    if (stdin_fd >= 0)
+        posix_spawn_file_actions_destroy (&actions);
+
+    if (ret)
+    {
+        fprintf (stderr, "Error: could not run \"%s\": %s\n", command[0], strerror (ret));
+        facron_metrics_add (executor->metrics, FACRON_METRIC_SPAWN_FAILURES, 1);
+        atomic_fetch_sub (&executor->in_flight, 1);
+        return -1;
+    }
+
+    if (func)
+    {
+        FacronExecutorWatch *watch = (FacronExecutorWatch *) malloc (sizeof (FacronExecutorWatch));
+        watch->func = func;
+        watch->user_data = user_data;
+        facron_hash_insert (executor->watched, &pid, sizeof (pid_t), watch);
+    }
+
+    facron_metrics_add (executor->metrics, FACRON_METRIC_SPAWNED, 1);
+    facron_metrics_set (executor->metrics, FACRON_METRIC_IN_FLIGHT, in_flight);
+    facron_metrics_raise (executor->metrics, FACRON_METRIC_MAX_IN_FLIGHT, in_flight);
+
+    return pid;
+}
+
+bool
+facron_executor_spawn (FacronExecutor *executor, char *const *command)
+{
+    return facron_executor_start (executor, command, -1, NULL, NULL) > 0;
+}
+
+void
+facron_executor_forget (FacronExecutor *executor, pid_t pid)
+{
+    free (facron_hash_remove (executor->watched, &pid, sizeof (pid_t)));
+}
+
+unsigned int
+facron_executor_in_flight (const FacronExecutor *executor)
+{
+    return atomic_load (&executor->in_flight);
+}
+
+void
+facron_executor_dump_stats (const FacronExecutor *executor)
+{
+    fprintf (stderr, "Notice: %llu commands spawned, %llu failed, %u in flight (%llu max)\n",
+             facron_metrics_get (executor->metrics, FACRON_METRIC_SPAWNED),
+             facron_metrics_get (executor->metrics, FACRON_METRIC_SPAWN_FAILURES),
+             atomic_load (&executor->in_flight),
+             facron_metrics_get (executor->metrics, FACRON_METRIC_MAX_IN_FLIGHT));
+}
+
+void
+facron_executor_free (FacronExecutor *executor)
+{
+    facron_loop_remove_signal (executor->loop, SIGCHLD);
+    posix_spawnattr_destroy (&executor->attr);
+    facron_hash_free (executor->watched, &free);
+    free (executor);
+}
+
+FacronExecutor *
+facron_executor_new (FacronLoop *loop, FacronMetrics *metrics)
+{
+    FacronExecutor *executor = (FacronExecutor *) calloc (1, sizeof (FacronExecutor));
+
+    executor->loop = loop;
+    executor->metrics = metrics;
+    executor->watched = facron_hash_new ();
+
+    /* children get a clean signal state, not the one of the daemon */
+    sigset_t all;
+    sigset_t none;
+    sigfillset (&all);
+    sigemptyset (&none);
+    posix_spawnattr_init (&executor->attr);
+    posix_spawnattr_setflags (&executor->attr, POSIX_SPAWN_SETSIGMASK|POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setsigmask (&executor->attr, &none);
+    posix_spawnattr_setsigdefault (&executor->attr, &all);
+
+    if (!facron_loop_add_signal (loop, SIGCHLD, &facron_executor_reap, executor))
+    {
+        fprintf (stderr, "Error: could not watch children\n");
+        posix_spawnattr_destroy (&executor->attr);
+        facron_hash_free (executor->watched, &free);
+        free (executor);
+        return NULL;
+    }
+
+    return executor;
+}
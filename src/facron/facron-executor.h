@@ -0,0 +1,46 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_EXECUTOR_H__
+#define __FACRON_EXECUTOR_H__
+
+#include "facron-loop.h"
+#include "facron-metrics.h"
+
+#include <stdbool.h>
+
+#include <sys/types.h>
+
+typedef struct FacronExecutor FacronExecutor;
+
+typedef void (*FacronExecutorExitFunc) (pid_t pid, int status, void *user_data);
+
+bool  facron_executor_spawn  (FacronExecutor *executor, char *const *command);
+/* stdin_fd is dup'ed as the child's stdin unless negative, func is called once the child exited */
+pid_t facron_executor_start  (FacronExecutor *executor, char *const *command, int stdin_fd, FacronExecutorExitFunc func, void *user_data);
+void  facron_executor_forget (FacronExecutor *executor, pid_t pid);
+
+unsigned int facron_executor_in_flight  (const FacronExecutor *executor);
+void         facron_executor_dump_stats (const FacronExecutor *executor);
+
+void facron_executor_free (FacronExecutor *executor);
+
+FacronExecutor *facron_executor_new (FacronLoop *loop, FacronMetrics *metrics);
+
+#endif /* __FACRON_EXECUTOR_H__ */
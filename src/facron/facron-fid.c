@@ -0,0 +1,256 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "facron-fid.h"
+#include "facron-hash.h"
+#include "facron-loop.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include <linux/limits.h>
+
+/* A renamed directory may be reported under its old path for that long */
+#define CACHE_TTL_MS    1000
+#define MAX_CACHED_DIRS 4096
+
+/*
+ * The key of a directory is the fsid immediately followed by its struct
+ * file_handle, which is how the kernel lays them out in the info records.
+ */
+typedef union
+{
+    struct
+    {
+        __kernel_fsid_t fsid;
+        struct file_handle handle;
+    } fid;
+    unsigned char bytes[sizeof (__kernel_fsid_t) + sizeof (struct file_handle) + MAX_HANDLE_SZ];
+} FacronFidKey;
+
+typedef struct
+{
+    unsigned long long expires; /* 0 for pinned directories */
+    size_t len;
+    char path[];
+} FacronFidDir;
+
+struct FacronFid
+{
+    FacronHash *dirs; /* key -> FacronFidDir */
+    FacronHash *mounts; /* fsid -> a directory on that filesystem, for open_by_handle_at */
+    size_t n_pinned;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long failures;
+};
+
+static inline size_t
+facron_fid_key_len (const struct file_handle *handle)
+{
+    return sizeof (__kernel_fsid_t) + sizeof (struct file_handle) + handle->handle_bytes;
+}
+
+static void
+facron_fid_insert (FacronFid *fid, const void *key, size_t key_len, const char *path, size_t len, unsigned long long expires)
+{
+    FacronFidDir *dir = (FacronFidDir *) malloc (sizeof (FacronFidDir) + len + 1);
+
+    dir->expires = expires;
+    dir->len = len;
+    memcpy (dir->path, path, len + 1);
+
+    FacronFidDir *old = (FacronFidDir *) facron_hash_remove (fid->dirs, key, key_len);
+    if (old && !old->expires)
+        --fid->n_pinned;
+    free (old);
+    if (!expires)
+        ++fid->n_pinned;
+    facron_hash_insert (fid->dirs, key, key_len, dir);
+}
+
+bool
+facron_fid_pin (FacronFid *fid, const char *path)
+{
+    FacronFidKey key;
+    struct statfs st_fs;
+    struct stat st;
+    char dir[PATH_MAX];
+    int mount_id;
+
+    if (stat (path, &st) < 0 || statfs (path, &st_fs) < 0)
+        return false;
+
+    /* events on a file are reported against its parent directory */
+    size_t len = strlen (path);
+    if (len >= sizeof (dir))
+        return false;
+    memcpy (dir, path, len + 1);
+    if (!S_ISDIR (st.st_mode))
+    {
+        char *slash = strrchr (dir, '/');
+        if (!slash)
+            return false;
+        len = (slash == dir) ? 1 : (size_t) (slash - dir);
+        dir[len] = '\0';
+    }
+
+    key.fid.handle.handle_bytes = MAX_HANDLE_SZ;
+    if (name_to_handle_at (AT_FDCWD, dir, &key.fid.handle, &mount_id, 0) < 0)
+        return false;
+    memcpy (&key.fid.fsid, &st_fs.f_fsid, sizeof (__kernel_fsid_t));
+
+    if (!facron_hash_lookup (fid->mounts, &key.fid.fsid, sizeof (__kernel_fsid_t)))
+        facron_hash_insert (fid->mounts, &key.fid.fsid, sizeof (__kernel_fsid_t), strdup (dir));
+
+    facron_fid_insert (fid, key.bytes, facron_fid_key_len (&key.fid.handle), dir, len, 0);
+    return true;
+}
+
+static void
+facron_fid_evict (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronFid *fid = (FacronFid *) user_data;
+    FacronFidDir *dir = (FacronFidDir *) value;
+
+    if (dir->expires)
+        free (facron_hash_remove (fid->dirs, key, key_len));
+}
+
+static FacronFidDir *
+facron_fid_lookup_dir (FacronFid *fid, const struct fanotify_event_info_fid *info, const struct file_handle *handle)
+{
+    const void *key = &info->fsid;
+    size_t key_len = facron_fid_key_len (handle);
+    unsigned long long now = facron_loop_now ();
+    FacronFidDir *dir = (FacronFidDir *) facron_hash_lookup (fid->dirs, key, key_len);
+
+    if (dir && (!dir->expires || dir->expires > now))
+    {
+        ++fid->hits;
+        return dir;
+    }
+
+    ++fid->misses;
+
+    const char *mount_path = (const char *) facron_hash_lookup (fid->mounts, &info->fsid, sizeof (__kernel_fsid_t));
+    if (!mount_path)
+        return NULL;
+
+    int mount_fd = open (mount_path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (mount_fd < 0)
+        return NULL;
+    int fd = open_by_handle_at (mount_fd, (struct file_handle *) handle, O_PATH|O_CLOEXEC);
+    close (mount_fd);
+    if (fd < 0)
+        return NULL;
+
+    char proc_path[32];
+    char path[PATH_MAX];
+    sprintf (proc_path, "/proc/self/fd/%d", fd);
+    ssize_t len = readlink (proc_path, path, sizeof (path) - 1);
+    close (fd);
+    if (len < 0)
+        return NULL;
+    path[len] = '\0';
+
+    if (facron_hash_size (fid->dirs) - fid->n_pinned >= MAX_CACHED_DIRS)
+        facron_hash_foreach (fid->dirs, &facron_fid_evict, fid);
+    facron_fid_insert (fid, key, key_len, path, len, now + CACHE_TTL_MS * 1000000ULL);
+
+    return (FacronFidDir *) facron_hash_lookup (fid->dirs, key, key_len);
+}
+
+bool
+facron_fid_resolve (FacronFid *fid, const struct fanotify_event_info_fid *info, char *path, size_t *len)
+{
+    const struct file_handle *handle = (const struct file_handle *) info->handle;
+    FacronFidDir *dir = facron_fid_lookup_dir (fid, info, handle);
+
+    if (!dir)
+    {
+        ++fid->failures;
+        return false;
+    }
+
+    const char *name = (info->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) ? (const char *) handle->f_handle + handle->handle_bytes : NULL;
+    /* "." is the directory itself */
+    if (!name || !strcmp (name, "."))
+    {
+        memcpy (path, dir->path, dir->len + 1);
+        *len = dir->len;
+        return true;
+    }
+
+    int n = snprintf (path, PATH_MAX, "%s/%s", (dir->len == 1) ? "" : dir->path, name);
+    if (n < 0 || n >= PATH_MAX)
+    {
+        ++fid->failures;
+        return false;
+    }
+    *len = n;
+    return true;
+}
+
+void
+facron_fid_clear (FacronFid *fid)
+{
+    facron_hash_free (fid->dirs, &free);
+    facron_hash_free (fid->mounts, &free);
+    fid->dirs = facron_hash_new ();
+    fid->mounts = facron_hash_new ();
+    fid->n_pinned = 0;
+}
+
+void
+facron_fid_dump_stats (const FacronFid *fid)
+{
+    fprintf (stderr, "Notice: %zu directories known by handle (%zu pinned), %llu hits, %llu misses, %llu unresolved\n",
+             facron_hash_size (fid->dirs),
+             fid->n_pinned,
+             fid->hits,
+             fid->misses,
+             fid->failures);
+}
+
+void
+facron_fid_free (FacronFid *fid)
+{
+    facron_hash_free (fid->dirs, &free);
+    facron_hash_free (fid->mounts, &free);
+    free (fid);
+}
+
+FacronFid *
+facron_fid_new (void)
+{
+    FacronFid *fid = (FacronFid *) calloc (1, sizeof (FacronFid));
+
+    fid->dirs = facron_hash_new ();
+    fid->mounts = facron_hash_new ();
+
+    return fid;
+}
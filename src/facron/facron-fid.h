@@ -0,0 +1,46 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_FID_H__
+#define __FACRON_FID_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <linux/fanotify.h>
+
+/*
+ * Resolves the (fsid, directory handle, name) records reported with
+ * FAN_REPORT_DFID_NAME into paths, through a cache of directory paths.
+ */
+typedef struct FacronFid FacronFid;
+
+/* Remembers the directory of a watched path, so that its events resolve without any syscall */
+bool facron_fid_pin     (FacronFid *fid, const char *path);
+/* path must hold PATH_MAX bytes */
+bool facron_fid_resolve (FacronFid *fid, const struct fanotify_event_info_fid *info, char *path, size_t *len);
+void facron_fid_clear   (FacronFid *fid);
+
+void facron_fid_dump_stats (const FacronFid *fid);
+
+void facron_fid_free (FacronFid *fid);
+
+FacronFid *facron_fid_new (void);
+
+#endif /* __FACRON_FID_H__ */
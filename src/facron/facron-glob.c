@@ -0,0 +1,323 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "facron-glob.h"
+#include "facron-hash.h"
+
+#include <fnmatch.h>
+#include <glob.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#include <linux/limits.h>
+
+/*
+ * Like the radix tree, the literal components are edges of a single hash
+ * table keyed by the parent node and the component. The wildcard components
+ * hang off their parent node, and are the only ones needing fnmatch: a walk
+ * keeps the set of nodes matching the path so far, and steps all of them at
+ * once for each component.
+ */
+
+typedef struct FacronGlobNode FacronGlobNode;
+
+typedef struct
+{
+    char *pattern;
+    FacronGlobNode *node;
+} FacronGlobWildcard;
+
+struct FacronGlobNode
+{
+    void **values;
+    size_t n_values;
+    FacronGlobWildcard *wildcards;
+    size_t n_wildcards;
+};
+
+struct FacronGlob
+{
+    FacronGlobNode root;
+    FacronHash *edges;
+    size_t n_nodes;
+};
+
+typedef struct
+{
+    const FacronGlobNode *parent;
+    char component[NAME_MAX + 1];
+} FacronGlobEdge;
+
+/* The walk keeps its nodes on the stack unless the patterns branch a lot */
+#define STACK_NODES 64
+
+static inline bool
+is_wildcard (const char *str, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (str[i] == '*' || str[i] == '?' || str[i] == '[')
+            return true;
+    }
+    return false;
+}
+
+bool
+facron_glob_is_pattern (const char *path)
+{
+    return is_wildcard (path, strlen (path));
+}
+
+static void
+facron_glob_expand_dirs (const char *pattern, FacronGlobDirFunc func, void *user_data)
+{
+    glob_t matches;
+    struct stat st;
+
+    if (glob (pattern, GLOB_ONLYDIR|GLOB_NOSORT, NULL, &matches))
+        return;
+
+    /* GLOB_ONLYDIR is only a hint */
+    for (size_t i = 0; i < matches.gl_pathc; ++i)
+    {
+        if (!stat (matches.gl_pathv[i], &st) && S_ISDIR (st.st_mode))
+            func (matches.gl_pathv[i], user_data);
+    }
+
+    globfree (&matches);
+}
+
+void
+facron_glob_expand (const char *pattern, bool children, FacronGlobDirFunc func, void *user_data)
+{
+    char parent[PATH_MAX];
+    const char *slash = strrchr (pattern, '/');
+
+    if (!slash || (size_t) (slash - pattern) >= PATH_MAX)
+        return;
+
+    size_t len = (slash == pattern) ? 1 : (size_t) (slash - pattern);
+    memcpy (parent, pattern, len);
+    parent[len] = '\0';
+
+    facron_glob_expand_dirs (parent, func, user_data);
+    if (children)
+        facron_glob_expand_dirs (pattern, func, user_data);
+}
+
+static inline size_t
+facron_glob_edge (FacronGlobEdge *edge, const FacronGlobNode *parent, const char *component, size_t len)
+{
+    edge->parent = parent;
+    memcpy (edge->component, component, len);
+    return offsetof (FacronGlobEdge, component) + len;
+}
+
+static const char *
+next_component (const char *path, const char *end, size_t *len)
+{
+    while (path < end && *path == '/')
+        ++path;
+
+    const char *c = path;
+    while (c < end && *c != '/')
+        ++c;
+    *len = c - path;
+
+    return path;
+}
+
+static FacronGlobNode *
+facron_glob_wildcard_child (FacronGlob *glob, FacronGlobNode *node, const char *component, size_t len)
+{
+    for (size_t i = 0; i < node->n_wildcards; ++i)
+    {
+        if (!strncmp (node->wildcards[i].pattern, component, len) && !node->wildcards[i].pattern[len])
+            return node->wildcards[i].node;
+    }
+
+    node->wildcards = (FacronGlobWildcard *) realloc (node->wildcards, (node->n_wildcards + 1) * sizeof (FacronGlobWildcard));
+
+    FacronGlobWildcard *wildcard = &node->wildcards[node->n_wildcards++];
+    wildcard->pattern = strndup (component, len);
+    wildcard->node = (FacronGlobNode *) calloc (1, sizeof (FacronGlobNode));
+    ++glob->n_nodes;
+
+    return wildcard->node;
+}
+
+void
+facron_glob_insert (FacronGlob *glob, const char *pattern, void *value)
+{
+    const char *end = pattern + strlen (pattern);
+    FacronGlobNode *node = &glob->root;
+    FacronGlobEdge edge;
+    size_t len;
+
+    for (const char *c = next_component (pattern, end, &len); len; c = next_component (c + len, end, &len))
+    {
+        if (len > NAME_MAX)
+            return;
+
+        if (is_wildcard (c, len))
+        {
+            node = facron_glob_wildcard_child (glob, node, c, len);
+            continue;
+        }
+
+        size_t key_len = facron_glob_edge (&edge, node, c, len);
+        FacronGlobNode *child = (FacronGlobNode *) facron_hash_lookup (glob->edges, &edge, key_len);
+        if (!child)
+        {
+            child = (FacronGlobNode *) calloc (1, sizeof (FacronGlobNode));
+            facron_hash_insert (glob->edges, &edge, key_len, child);
+            ++glob->n_nodes;
+        }
+        node = child;
+    }
+
+    node->values = (void **) realloc (node->values, (node->n_values + 1) * sizeof (void *));
+    node->values[node->n_values++] = value;
+}
+
+static size_t
+facron_glob_report (const FacronGlobNode **nodes, size_t n_nodes, size_t distance, FacronGlobFunc func, void *user_data)
+{
+    size_t visited = 0;
+
+    for (size_t i = 0; i < n_nodes; ++i)
+    {
+        for (size_t j = 0; j < nodes[i]->n_values; ++j)
+            func (nodes[i]->values[j], distance, user_data);
+        visited += nodes[i]->n_values;
+    }
+
+    return visited;
+}
+
+size_t
+facron_glob_match (const FacronGlob *glob, const char *path, size_t len, FacronGlobFunc func, void *user_data)
+{
+    const FacronGlobNode *stack_nodes[2][STACK_NODES];
+    const FacronGlobNode **nodes = stack_nodes[0];
+    const FacronGlobNode **next = stack_nodes[1];
+    const char *end = path + len;
+    char component[NAME_MAX + 1];
+    FacronGlobEdge edge;
+    size_t n_nodes = 1;
+    size_t visited = 0;
+    size_t clen;
+    size_t rest;
+
+    /* a walk never holds more nodes than the trie */
+    if (glob->n_nodes + 1 > STACK_NODES)
+    {
+        nodes = (const FacronGlobNode **) malloc (2 * (glob->n_nodes + 1) * sizeof (const FacronGlobNode *));
+        next = nodes + glob->n_nodes + 1;
+    }
+    const FacronGlobNode **allocated = (nodes != stack_nodes[0]) ? nodes : NULL;
+
+    nodes[0] = &glob->root;
+
+    for (const char *c = next_component (path, end, &clen); clen && n_nodes; c = next_component (c + clen, end, &clen))
+    {
+        size_t n_next = 0;
+
+        if (clen > NAME_MAX)
+        {
+            n_nodes = 0;
+            break;
+        }
+
+        /* the nodes matching the parent of the path */
+        next_component (c + clen, end, &rest);
+        if (!rest)
+            visited += facron_glob_report (nodes, n_nodes, 1, func, user_data);
+
+        memcpy (component, c, clen);
+        component[clen] = '\0';
+
+        for (size_t i = 0; i < n_nodes; ++i)
+        {
+            const FacronGlobNode *child = (const FacronGlobNode *) facron_hash_lookup (glob->edges, &edge, facron_glob_edge (&edge, nodes[i], c, clen));
+            if (child)
+                next[n_next++] = child;
+
+            for (size_t j = 0; j < nodes[i]->n_wildcards; ++j)
+            {
+                if (!fnmatch (nodes[i]->wildcards[j].pattern, component, FNM_PERIOD))
+                    next[n_next++] = nodes[i]->wildcards[j].node;
+            }
+        }
+
+        const FacronGlobNode **swap = nodes;
+        nodes = next;
+        next = swap;
+        n_nodes = n_next;
+    }
+
+    visited += facron_glob_report (nodes, n_nodes, 0, func, user_data);
+
+    free (allocated);
+    return visited;
+}
+
+/* wildcard children belong to their parent, the other ones to the edges */
+static void
+facron_glob_node_clear (FacronGlobNode *node)
+{
+    for (size_t i = 0; i < node->n_wildcards; ++i)
+    {
+        free (node->wildcards[i].pattern);
+        facron_glob_node_clear (node->wildcards[i].node);
+        free (node->wildcards[i].node);
+    }
+    free (node->wildcards);
+    free (node->values);
+}
+
+static void
+facron_glob_node_free (void *data)
+{
+    FacronGlobNode *node = (FacronGlobNode *) data;
+
+    facron_glob_node_clear (node);
+    free (node);
+}
+
+void
+facron_glob_free (FacronGlob *glob)
+{
+    facron_hash_free (glob->edges, &facron_glob_node_free);
+    facron_glob_node_clear (&glob->root);
+    free (glob);
+}
+
+FacronGlob *
+facron_glob_new (void)
+{
+    FacronGlob *glob = (FacronGlob *) calloc (1, sizeof (FacronGlob));
+
+    glob->edges = facron_hash_new ();
+
+    return glob;
+}
@@ -0,0 +1,55 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_GLOB_H__
+#define __FACRON_GLOB_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Path patterns, whose components may hold fnmatch wildcards, sharing a trie
+ * of components so that a path is matched against all of them in a single
+ * walk.
+ */
+typedef struct FacronGlob FacronGlob;
+
+/* distance is 0 when the pattern matches the path, 1 when it matches its parent */
+typedef void (*FacronGlobFunc) (void *value, size_t distance, void *user_data);
+typedef void (*FacronGlobDirFunc) (const char *dir, void *user_data);
+
+/* Whether path contains wildcards */
+bool facron_glob_is_pattern (const char *path);
+
+/*
+ * Finds the existing directories whose children must be watched for pattern:
+ * the ones which may hold matches, and the matches themselves when their
+ * own children matter.
+ */
+void facron_glob_expand (const char *pattern, bool children, FacronGlobDirFunc func, void *user_data);
+
+void facron_glob_insert (FacronGlob *glob, const char *pattern, void *value);
+
+size_t facron_glob_match (const FacronGlob *glob, const char *path, size_t len, FacronGlobFunc func, void *user_data);
+
+void facron_glob_free (FacronGlob *glob);
+
+FacronGlob *facron_glob_new (void);
+
+#endif /* __FACRON_GLOB_H__ */
@@ -0,0 +1,192 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "facron-hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_BUCKETS 64
+
+typedef struct FacronHashNode FacronHashNode;
+
+struct FacronHashNode
+{
+    FacronHashNode *next;
+    void *value;
+    uint32_t hash;
+    size_t key_len;
+    char key[];
+};
+
+struct FacronHash
+{
+    FacronHashNode **buckets;
+    size_t n_buckets; /* always a power of two */
+    size_t size;
+};
+
+/* FNV-1a */
+uint32_t
+facron_hash_bytes (const void *key, size_t key_len)
+{
+    const unsigned char *k = (const unsigned char *) key;
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < key_len; ++i)
+    {
+        h ^= k[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+static FacronHashNode **
+facron_hash_find (const FacronHash *hash, const void *key, size_t key_len, uint32_t h)
+{
+    FacronHashNode **node = &hash->buckets[h & (hash->n_buckets - 1)];
+
+    for (; *node; node = &(*node)->next)
+    {
+        if ((*node)->hash == h && (*node)->key_len == key_len && !memcmp ((*node)->key, key, key_len))
+            break;
+    }
+
+    return node;
+}
+
+static void
+facron_hash_grow (FacronHash *hash)
+{
+    size_t n_buckets = hash->n_buckets * 2;
+    FacronHashNode **buckets = (FacronHashNode **) calloc (n_buckets, sizeof (FacronHashNode *));
+
+    for (size_t i = 0; i < hash->n_buckets; ++i)
+    {
+        for (FacronHashNode *node = hash->buckets[i], *next; node; node = next)
+        {
+            next = node->next;
+            node->next = buckets[node->hash & (n_buckets - 1)];
+            buckets[node->hash & (n_buckets - 1)] = node;
+        }
+    }
+
+    free (hash->buckets);
+    hash->buckets = buckets;
+    hash->n_buckets = n_buckets;
+}
+
+void *
+facron_hash_lookup (const FacronHash *hash, const void *key, size_t key_len)
+{
+    FacronHashNode *node = *facron_hash_find (hash, key, key_len, facron_hash_bytes (key, key_len));
+    return node ? node->value : NULL;
+}
+
+void
+facron_hash_insert (FacronHash *hash, const void *key, size_t key_len, void *value)
+{
+    uint32_t h = facron_hash_bytes (key, key_len);
+    FacronHashNode **slot = facron_hash_find (hash, key, key_len, h);
+
+    if (*slot)
+    {
+        (*slot)->value = value;
+        return;
+    }
+
+    FacronHashNode *node = (FacronHashNode *) malloc (sizeof (FacronHashNode) + key_len);
+
+    node->next = NULL;
+    node->value = value;
+    node->hash = h;
+    node->key_len = key_len;
+    memcpy (node->key, key, key_len);
+    *slot = node;
+
+    if (++hash->size > hash->n_buckets)
+        facron_hash_grow (hash);
+}
+
+void *
+facron_hash_remove (FacronHash *hash, const void *key, size_t key_len)
+{
+    FacronHashNode **slot = facron_hash_find (hash, key, key_len, facron_hash_bytes (key, key_len));
+    FacronHashNode *node = *slot;
+
+    if (!node)
+        return NULL;
+
+    void *value = node->value;
+    *slot = node->next;
+    free (node);
+    --hash->size;
+
+    return value;
+}
+
+size_t
+facron_hash_size (const FacronHash *hash)
+{
+    return hash->size;
+}
+
+void
+facron_hash_foreach (const FacronHash *hash, FacronHashFunc func, void *user_data)
+{
+    for (size_t i = 0; i < hash->n_buckets; ++i)
+    {
+        for (FacronHashNode *node = hash->buckets[i], *next; node; node = next)
+        {
+            /* func may remove the current node */
+            next = node->next;
+            func (node->key, node->key_len, node->value, user_data);
+        }
+    }
+}
+
+void
+facron_hash_free (FacronHash *hash, FacronHashFreeFunc free_value)
+{
+    for (size_t i = 0; i < hash->n_buckets; ++i)
+    {
+        for (FacronHashNode *node = hash->buckets[i], *next; node; node = next)
+        {
+            next = node->next;
+            if (free_value)
+                free_value (node->value);
+            free (node);
+        }
+    }
+    free (hash->buckets);
+    free (hash);
+}
+
+FacronHash *
+facron_hash_new (void)
+{
+    FacronHash *hash = (FacronHash *) malloc (sizeof (FacronHash));
+
+    hash->buckets = (FacronHashNode **) calloc (INITIAL_BUCKETS, sizeof (FacronHashNode *));
+    hash->n_buckets = INITIAL_BUCKETS;
+    hash->size = 0;
+
+    return hash;
+}
@@ -0,0 +1,45 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_HASH_H__
+#define __FACRON_HASH_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct FacronHash FacronHash;
+
+typedef void (*FacronHashFunc) (const void *key, size_t key_len, void *value, void *user_data);
+typedef void (*FacronHashFreeFunc) (void *value);
+
+uint32_t facron_hash_bytes (const void *key, size_t key_len);
+
+void *facron_hash_lookup (const FacronHash *hash, const void *key, size_t key_len);
+void  facron_hash_insert (FacronHash *hash, const void *key, size_t key_len, void *value);
+void *facron_hash_remove (FacronHash *hash, const void *key, size_t key_len);
+
+size_t facron_hash_size    (const FacronHash *hash);
+void   facron_hash_foreach (const FacronHash *hash, FacronHashFunc func, void *user_data);
+
+void facron_hash_free (FacronHash *hash, FacronHashFreeFunc free_value);
+
+FacronHash *facron_hash_new (void);
+
+#endif /* __FACRON_HASH_H__ */
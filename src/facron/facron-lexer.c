@@ -27,6 +27,7 @@
 
 struct FacronLexer
 {
+    char *path;
     FILE *file;
     char *line;
     char *line_beg;
@@ -344,6 +345,28 @@ facron_lexer_read_string (FacronLexer *lexer)
     return strdup (line_beg);
 }
 
+bool
+facron_lexer_read_block (FacronLexer *lexer, char open, char close, char **block)
+{
+    *block = NULL;
+
+    if (!lexer->line || lexer->len <= 0 || lexer->line[0] != open)
+        return true;
+
+    char *end = (char *) memchr (lexer->line + 1, close, lexer->len - 1);
+    if (!end)
+    {
+        fprintf (stderr, "Error: missing '%c' after '%c'\n", close, open);
+        return false;
+    }
+
+    *block = strndup (lexer->line + 1, end - lexer->line - 1);
+    lexer->len -= end + 1 - lexer->line;
+    lexer->line = end + 1;
+
+    return true;
+}
+
 void
 facron_lexer_skip_spaces (FacronLexer *lexer)
 {
@@ -405,13 +428,13 @@ facron_lexer_reload_file (FacronLexer *lexer)
     if (lexer->file)
         fclose (lexer->file);
 
-    lexer->file = fopen (SYSCONFDIR "/facron.conf", "ro");
+    lexer->file = fopen (lexer->path, "ro");
     lexer->line = lexer->line_beg = NULL;
     lexer->index = 0;
 
     if (!lexer->file)
     {
-        fprintf (stderr, "Error: could not load configuration file, does \"" SYSCONFDIR "/facron.conf\" exist?\n");
+        fprintf (stderr, "Error: could not load configuration file, does \"%s\" exist?\n", lexer->path);
         return false;
     }
 
@@ -425,14 +448,16 @@ facron_lexer_free (FacronLexer *lexer)
         fclose (lexer->file);
     if (lexer->line_beg)
         free (lexer->line_beg);
+    free (lexer->path);
     free (lexer);
 }
 
 FacronLexer *
-facron_lexer_new (void)
+facron_lexer_new (const char *path)
 {
     FacronLexer *lexer = (FacronLexer *) malloc (sizeof (FacronLexer));
 
+    lexer->path = strdup (path);
     lexer->file = NULL;
     facron_lexer_reload_file (lexer);
 
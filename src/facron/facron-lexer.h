@@ -232,6 +232,7 @@ bool  facron_lexer_read_line    (FacronLexer *lexer);
 bool  facron_lexer_invalid_line (FacronLexer *lexer);
 bool  facron_lexer_end_of_line  (FacronLexer *lexer);
 char *facron_lexer_read_string  (FacronLexer *lexer);
+bool  facron_lexer_read_block   (FacronLexer *lexer, char open, char close, char **block);
 void  facron_lexer_skip_spaces  (FacronLexer *lexer);
 
 FacronResult facron_lexer_next_token (FacronLexer *lexer, unsigned long long *mask);
@@ -240,6 +241,6 @@ bool facron_lexer_reload_file (FacronLexer *lexer);
 
 void facron_lexer_free (FacronLexer *lexer);
 
-FacronLexer *facron_lexer_new (void);
+FacronLexer *facron_lexer_new (const char *path);
 
 #endif /* __FACRON_CONF_LEXER_H__ */
@@ -0,0 +1,415 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "facron-limiter.h"
+#include "facron-hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/limits.h>
+
+/*
+ * The commands of an action share a group, keyed by the path and the
+ * command of the action rather than by the entry, so that its count of
+ * running commands carries on over reloads. The waiting commands are
+ * linked in the order they came in, which is the order they start in, and
+ * in the queue of their group. A command waits when either limit is
+ * reached, and when either queue is full, the policy of that queue picks
+ * the command which goes.
+ */
+
+typedef struct FacronLimiterGroup FacronLimiterGroup;
+typedef struct FacronLimiterCommand FacronLimiterCommand;
+
+struct FacronLimiterCommand
+{
+    FacronLimiterCommand *prev; /* in the order the commands came in */
+    FacronLimiterCommand *next;
+    FacronLimiterCommand *group_prev; /* in the queue of the group */
+    FacronLimiterCommand *group_next;
+    FacronLimiterGroup *group;
+    char **argv;
+    char *key; /* the group pointer followed by the path */
+    size_t key_len; /* 0 when there is no path to coalesce by */
+};
+
+struct FacronLimiterGroup
+{
+    FacronLimiter *limiter;
+    char *key; /* the path of the action then its command, NUL separated */
+    size_t key_len;
+    unsigned int max_running; /* 0: only the global limit applies */
+    unsigned int queue_size;
+    FacronOverflow overflow;
+    unsigned int running;
+    size_t n_waiting;
+    FacronLimiterCommand *head;
+    FacronLimiterCommand *tail;
+};
+
+struct FacronLimiter
+{
+    FacronExecutor *executor;
+    FacronMetrics *metrics;
+    unsigned int max_running;
+    unsigned int queue_size;
+    FacronOverflow overflow;
+    FacronHash *groups; /* key -> FacronLimiterGroup */
+    FacronHash *waiting; /* group and path -> FacronLimiterCommand */
+    FacronLimiterCommand *head;
+    FacronLimiterCommand *tail;
+    size_t n_waiting;
+    unsigned int running;
+    unsigned int most_running;
+};
+
+bool
+facron_limiter_limits (const FacronLimiter *limiter, const FacronConfEntry *entry)
+{
+    return limiter->max_running || entry->options.max_running;
+}
+
+/* The group of the action, with the limits of its current entry */
+static FacronLimiterGroup *
+facron_limiter_group (FacronLimiter *limiter, const FacronConfEntry *entry)
+{
+    size_t key_len = strlen (entry->path) + 1;
+    for (size_t i = 0; i < entry->argc; ++i)
+        key_len += strlen (entry->command[i]) + 1;
+
+    char *key = (char *) malloc (key_len);
+    char *end = stpcpy (key, entry->path) + 1;
+    for (size_t i = 0; i < entry->argc; ++i)
+        end = stpcpy (end, entry->command[i]) + 1;
+
+    FacronLimiterGroup *group = (FacronLimiterGroup *) facron_hash_lookup (limiter->groups, key, key_len);
+    if (group)
+        free (key);
+    else
+    {
+        group = (FacronLimiterGroup *) calloc (1, sizeof (FacronLimiterGroup));
+        group->limiter = limiter;
+        group->key = key;
+        group->key_len = key_len;
+        facron_hash_insert (limiter->groups, key, key_len, group);
+    }
+
+    group->max_running = entry->options.max_running;
+    group->queue_size = entry->options.queue_size;
+    group->overflow = entry->options.overflow;
+
+    return group;
+}
+
+static void
+facron_limiter_group_free (void *value)
+{
+    FacronLimiterGroup *group = (FacronLimiterGroup *) value;
+
+    free (group->key);
+    free (group);
+}
+
+/* Forgets the group once nothing runs nor waits for it */
+static void
+facron_limiter_group_release (FacronLimiterGroup *group)
+{
+    if (group->running || group->n_waiting)
+        return;
+    facron_hash_remove (group->limiter->groups, group->key, group->key_len);
+    facron_limiter_group_free (group);
+}
+
+static inline bool
+facron_limiter_has_room (const FacronLimiter *limiter, const FacronLimiterGroup *group)
+{
+    return (!limiter->max_running || limiter->running < limiter->max_running) &&
+           (!group->max_running || group->running < group->max_running);
+}
+
+static FacronLimiterCommand *
+facron_limiter_command_new (FacronLimiterGroup *group, const char *path, size_t path_len, char *const *argv)
+{
+    size_t argc = 0;
+    size_t strings_len = 0;
+    size_t key_len = (path_len < PATH_MAX) ? sizeof (FacronLimiterGroup *) + path_len : 0;
+
+    for (; argv[argc]; ++argc)
+        strings_len += strlen (argv[argc]) + 1;
+
+    FacronLimiterCommand *command = (FacronLimiterCommand *) malloc (sizeof (FacronLimiterCommand) + (argc + 1) * sizeof (char *) + key_len + strings_len);
+
+    command->group = group;
+    command->argv = (char **) (command + 1);
+    command->key = (char *) (command->argv + argc + 1);
+    command->key_len = key_len;
+    if (key_len)
+    {
+        memcpy (command->key, &group, sizeof (FacronLimiterGroup *));
+        memcpy (command->key + sizeof (FacronLimiterGroup *), path, path_len);
+    }
+
+    char *strings = command->key + key_len;
+    for (size_t i = 0; i < argc; ++i)
+    {
+        command->argv[i] = strings;
+        strings = stpcpy (strings, argv[i]) + 1;
+    }
+    command->argv[argc] = NULL;
+
+    return command;
+}
+
+static void
+facron_limiter_link (FacronLimiter *limiter, FacronLimiterCommand *command)
+{
+    FacronLimiterGroup *group = command->group;
+
+    command->next = NULL;
+    command->prev = limiter->tail;
+    if (limiter->tail)
+        limiter->tail->next = command;
+    else
+        limiter->head = command;
+    limiter->tail = command;
+
+    command->group_next = NULL;
+    command->group_prev = group->tail;
+    if (group->tail)
+        group->tail->group_next = command;
+    else
+        group->head = command;
+    group->tail = command;
+
+    if (command->key_len)
+        facron_hash_insert (limiter->waiting, command->key, command->key_len, command);
+    ++group->n_waiting;
+    ++limiter->n_waiting;
+    facron_metrics_set (limiter->metrics, FACRON_METRIC_PENDING, limiter->n_waiting);
+}
+
+static void
+facron_limiter_unlink (FacronLimiter *limiter, FacronLimiterCommand *command)
+{
+    FacronLimiterGroup *group = command->group;
+
+    if (command->prev)
+        command->prev->next = command->next;
+    else
+        limiter->head = command->next;
+    if (command->next)
+        command->next->prev = command->prev;
+    else
+        limiter->tail = command->prev;
+
+    if (command->group_prev)
+        command->group_prev->group_next = command->group_next;
+    else
+        group->head = command->group_next;
+    if (command->group_next)
+        command->group_next->group_prev = command->group_prev;
+    else
+        group->tail = command->group_prev;
+
+    if (command->key_len)
+        facron_hash_remove (limiter->waiting, command->key, command->key_len);
+    --group->n_waiting;
+    --limiter->n_waiting;
+    facron_metrics_set (limiter->metrics, FACRON_METRIC_PENDING, limiter->n_waiting);
+}
+
+static void facron_limiter_exited (pid_t pid, int status, void *user_data);
+
+static bool
+facron_limiter_start (FacronLimiter *limiter, FacronLimiterGroup *group, char *const *argv)
+{
+    if (facron_executor_start (limiter->executor, argv, -1, &facron_limiter_exited, group) < 0)
+        return false;
+
+    ++group->running;
+    if (++limiter->running > limiter->most_running)
+        limiter->most_running = limiter->running;
+    return true;
+}
+
+/* Starts the waiting commands the limits now allow, oldest first */
+static void
+facron_limiter_schedule (FacronLimiter *limiter)
+{
+    FacronLimiterCommand *next;
+
+    for (FacronLimiterCommand *command = limiter->head; command; command = next)
+    {
+        FacronLimiterGroup *group = command->group;
+
+        next = command->next;
+        if (limiter->max_running && limiter->running >= limiter->max_running)
+            break;
+        if (!facron_limiter_has_room (limiter, group))
+            continue;
+
+        facron_limiter_unlink (limiter, command);
+        facron_limiter_start (limiter, group, command->argv);
+        free (command);
+        /* when it could not start */
+        facron_limiter_group_release (group);
+    }
+}
+
+static void
+facron_limiter_exited (pid_t pid, int status, void *user_data)
+{
+    FacronLimiterGroup *group = (FacronLimiterGroup *) user_data;
+    FacronLimiter *limiter = group->limiter;
+    (void) pid;
+    (void) status;
+
+    --group->running;
+    --limiter->running;
+    /* before the schedule, which may release it too */
+    facron_limiter_group_release (group);
+    facron_limiter_schedule (limiter);
+}
+
+/* Applies the overflow policy of a full queue, oldest being its first command. False when the new command is the one to go */
+static bool
+facron_limiter_make_room (FacronLimiter *limiter, FacronLimiterGroup *group, FacronOverflow overflow, FacronLimiterCommand *oldest)
+{
+    facron_metrics_add (limiter->metrics, FACRON_METRIC_DROPPED, 1);
+
+    if (overflow != FACRON_OVERFLOW_DROP_OLDEST || !oldest)
+    {
+        facron_limiter_group_release (group);
+        return false;
+    }
+
+    FacronLimiterGroup *dropped = oldest->group;
+    facron_limiter_unlink (limiter, oldest);
+    free (oldest);
+    if (dropped != group)
+        facron_limiter_group_release (dropped);
+    return true;
+}
+
+bool
+facron_limiter_run (FacronLimiter *limiter, const FacronConfEntry *entry, const char *path, char *const *argv)
+{
+    FacronLimiterGroup *group = facron_limiter_group (limiter, entry);
+
+    /* the commands already waiting for the group go first */
+    if (!group->n_waiting && facron_limiter_has_room (limiter, group))
+    {
+        bool started = facron_limiter_start (limiter, group, argv);
+        facron_limiter_group_release (group);
+        return started;
+    }
+
+    size_t path_len = (path) ? strlen (path) : PATH_MAX;
+    FacronOverflow overflow = (group->max_running) ? group->overflow : limiter->overflow;
+    if (overflow == FACRON_OVERFLOW_COALESCE && path_len < PATH_MAX)
+    {
+        char key[sizeof (FacronLimiterGroup *) + PATH_MAX];
+
+        memcpy (key, &group, sizeof (FacronLimiterGroup *));
+        memcpy (key + sizeof (FacronLimiterGroup *), path, path_len);
+        if (facron_hash_lookup (limiter->waiting, key, sizeof (FacronLimiterGroup *) + path_len))
+        {
+            facron_metrics_add (limiter->metrics, FACRON_METRIC_COALESCED, 1);
+            return false;
+        }
+    }
+
+    /* the queue of the action, then the one shared by all */
+    if (group->max_running && group->n_waiting >= group->queue_size &&
+        !facron_limiter_make_room (limiter, group, group->overflow, group->head))
+        return false;
+    if (limiter->n_waiting >= limiter->queue_size &&
+        !facron_limiter_make_room (limiter, group, limiter->overflow, limiter->head))
+        return false;
+
+    facron_limiter_link (limiter, facron_limiter_command_new (group, path, path_len, argv));
+    facron_metrics_add (limiter->metrics, FACRON_METRIC_QUEUED, 1);
+    return false;
+}
+
+static void
+dump_group (const void *key, size_t key_len, void *value, void *user_data)
+{
+    const FacronLimiterGroup *group = (const FacronLimiterGroup *) value;
+    (void) key_len;
+    (void) user_data;
+
+    if (!group->max_running)
+        return;
+    fprintf (stderr, "Notice: \"%s\" running \"%s\": %u of %u running, %zu of %u waiting\n",
+             (const char *) key,
+             (const char *) key + strlen ((const char *) key) + 1,
+             group->running,
+             group->max_running,
+             group->n_waiting,
+             group->queue_size);
+}
+
+void
+facron_limiter_dump_stats (const FacronLimiter *limiter)
+{
+    fprintf (stderr, "Notice: %u limited commands running (%u max), %zu waiting, %llu queued, %llu dropped, %llu coalesced\n",
+             limiter->running,
+             limiter->most_running,
+             limiter->n_waiting,
+             facron_metrics_get (limiter->metrics, FACRON_METRIC_QUEUED),
+             facron_metrics_get (limiter->metrics, FACRON_METRIC_DROPPED),
+             facron_metrics_get (limiter->metrics, FACRON_METRIC_COALESCED));
+    facron_hash_foreach (limiter->groups, &dump_group, NULL);
+}
+
+void
+facron_limiter_free (FacronLimiter *limiter)
+{
+    if (limiter->n_waiting)
+        fprintf (stderr, "Notice: %zu waiting commands dropped\n", limiter->n_waiting);
+
+    for (FacronLimiterCommand *command = limiter->head, *next; command; command = next)
+    {
+        next = command->next;
+        free (command);
+    }
+    facron_hash_free (limiter->waiting, NULL);
+    facron_hash_free (limiter->groups, &facron_limiter_group_free);
+    free (limiter);
+}
+
+FacronLimiter *
+facron_limiter_new (FacronExecutor *executor, FacronMetrics *metrics,
+                    unsigned int max_running, unsigned int queue_size, FacronOverflow overflow)
+{
+    FacronLimiter *limiter = (FacronLimiter *) calloc (1, sizeof (FacronLimiter));
+
+    limiter->executor = executor;
+    limiter->metrics = metrics;
+    limiter->max_running = max_running;
+    limiter->queue_size = queue_size;
+    limiter->overflow = overflow;
+    limiter->groups = facron_hash_new ();
+    limiter->waiting = facron_hash_new ();
+
+    return limiter;
+}
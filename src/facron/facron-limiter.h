@@ -0,0 +1,52 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_LIMITER_H__
+#define __FACRON_LIMITER_H__
+
+#include "facron-conf-entry.h"
+#include "facron-executor.h"
+#include "facron-metrics.h"
+
+#include <stdbool.h>
+
+/*
+ * Bounds the commands running at once, for the whole daemon and for the
+ * actions which set their own limit. The commands which cannot run yet wait
+ * in bounded queues, in order, and are started as the running ones exit.
+ * Only the loop thread may use it.
+ */
+typedef struct FacronLimiter FacronLimiter;
+
+/* Whether the commands of entry have to go through the limiter */
+bool facron_limiter_limits (const FacronLimiter *limiter, const FacronConfEntry *entry);
+
+/* argv is copied when it has to wait, path is what it coalesces by, NULL for none. True when it was started right away */
+bool facron_limiter_run (FacronLimiter *limiter, const FacronConfEntry *entry, const char *path, char *const *argv);
+
+void facron_limiter_dump_stats (const FacronLimiter *limiter);
+
+/* The commands still waiting are dropped */
+void facron_limiter_free (FacronLimiter *limiter);
+
+/* max_running 0 means no global limit, queue_size bounds the commands waiting overall */
+FacronLimiter *facron_limiter_new (FacronExecutor *executor, FacronMetrics *metrics,
+                                   unsigned int max_running, unsigned int queue_size, FacronOverflow overflow);
+
+#endif /* __FACRON_LIMITER_H__ */
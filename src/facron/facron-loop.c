@@ -0,0 +1,430 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "facron-loop.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#define MAX_EVENTS 64
+
+typedef struct FacronLoopWatch FacronLoopWatch;
+
+struct FacronLoopWatch
+{
+    int fd;
+    FacronLoopFunc func;
+    void *user_data;
+    FacronLoopWatch *next;
+};
+
+struct FacronLoopTimer
+{
+    unsigned long long deadline; /* ns */
+    size_t index; /* position in the heap */
+    FacronLoopTimerFunc func;
+    void *user_data;
+};
+
+typedef struct
+{
+    FacronLoopSignalFunc func;
+    void *user_data;
+} FacronLoopSignal;
+
+/*
+ * All the timers share a single timerfd, armed for the earliest deadline
+ * of a binary min-heap.
+ */
+struct FacronLoop
+{
+    int epoll_fd;
+    int timer_fd;
+    int signal_fd; /* -1 until a signal is watched */
+    sigset_t signals;
+    FacronLoopSignal handlers[NSIG];
+    FacronLoopWatch *watches;
+    FacronLoopWatch *removed; /* freed once the current batch has been dispatched */
+    FacronLoopTimer **timers;
+    size_t n_timers;
+    size_t timers_size;
+    unsigned long long armed; /* deadline the timerfd is armed for, 0 if disarmed */
+    bool running;
+    bool success;
+};
+
+unsigned long long
+facron_loop_now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void
+heap_set (FacronLoop *loop, size_t index, FacronLoopTimer *timer)
+{
+    loop->timers[index] = timer;
+    timer->index = index;
+}
+
+static void
+heap_up (FacronLoop *loop, size_t index)
+{
+    FacronLoopTimer *timer = loop->timers[index];
+
+    while (index > 0)
+    {
+        size_t parent = (index - 1) / 2;
+        if (loop->timers[parent]->deadline <= timer->deadline)
+            break;
+        heap_set (loop, index, loop->timers[parent]);
+        index = parent;
+    }
+    heap_set (loop, index, timer);
+}
+
+static void
+heap_down (FacronLoop *loop, size_t index)
+{
+    FacronLoopTimer *timer = loop->timers[index];
+
+    for (;;)
+    {
+        size_t child = 2 * index + 1;
+        if (child >= loop->n_timers)
+            break;
+        if (child + 1 < loop->n_timers && loop->timers[child + 1]->deadline < loop->timers[child]->deadline)
+            ++child;
+        if (timer->deadline <= loop->timers[child]->deadline)
+            break;
+        heap_set (loop, index, loop->timers[child]);
+        index = child;
+    }
+    heap_set (loop, index, timer);
+}
+
+static void
+heap_remove (FacronLoop *loop, FacronLoopTimer *timer)
+{
+    size_t index = timer->index;
+    FacronLoopTimer *last = loop->timers[--loop->n_timers];
+
+    if (last == timer)
+        return;
+
+    heap_set (loop, index, last);
+    heap_up (loop, index);
+    heap_down (loop, last->index);
+}
+
+static void
+facron_loop_arm (FacronLoop *loop)
+{
+    unsigned long long deadline = (loop->n_timers) ? loop->timers[0]->deadline : 0;
+
+    if (deadline == loop->armed)
+        return;
+
+    struct itimerspec its = {
+        .it_interval = { 0, 0 },
+        .it_value = { deadline / 1000000000ULL, deadline % 1000000000ULL }
+    };
+    timerfd_settime (loop->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+    loop->armed = deadline;
+}
+
+static void
+facron_loop_fire_timers (int fd, unsigned int events, void *user_data)
+{
+    FacronLoop *loop = (FacronLoop *) user_data;
+    unsigned long long expirations;
+    (void) events;
+
+    if (read (fd, &expirations, sizeof (expirations)) < 0 && errno != EAGAIN)
+        return;
+
+    loop->armed = 0;
+
+    unsigned long long now = facron_loop_now ();
+    while (loop->n_timers && loop->timers[0]->deadline <= now && loop->running)
+    {
+        FacronLoopTimer *timer = loop->timers[0];
+        heap_remove (loop, timer);
+        timer->func (timer->user_data);
+        free (timer);
+    }
+
+    facron_loop_arm (loop);
+}
+
+FacronLoopTimer *
+facron_loop_add_timer (FacronLoop *loop, unsigned long long delay_ms, FacronLoopTimerFunc func, void *user_data)
+{
+    FacronLoopTimer *timer = (FacronLoopTimer *) malloc (sizeof (FacronLoopTimer));
+
+    timer->deadline = facron_loop_now () + delay_ms * 1000000ULL;
+    timer->func = func;
+    timer->user_data = user_data;
+
+    if (loop->n_timers == loop->timers_size)
+    {
+        loop->timers_size = (loop->timers_size) ? loop->timers_size * 2 : 64;
+        loop->timers = (FacronLoopTimer **) realloc (loop->timers, loop->timers_size * sizeof (FacronLoopTimer *));
+    }
+    heap_set (loop, loop->n_timers++, timer);
+    heap_up (loop, timer->index);
+    facron_loop_arm (loop);
+
+    return timer;
+}
+
+void
+facron_loop_remove_timer (FacronLoop *loop, FacronLoopTimer *timer)
+{
+    heap_remove (loop, timer);
+    free (timer);
+    facron_loop_arm (loop);
+}
+
+bool
+facron_loop_add_fd (FacronLoop *loop, int fd, unsigned int events, FacronLoopFunc func, void *user_data)
+{
+    FacronLoopWatch *watch = (FacronLoopWatch *) malloc (sizeof (FacronLoopWatch));
+    struct epoll_event ev = { .events = events, .data.ptr = watch };
+
+    watch->fd = fd;
+    watch->func = func;
+    watch->user_data = user_data;
+
+    if (epoll_ctl (loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        fprintf (stderr, "Error: could not watch file descriptor %d\n", fd);
+        free (watch);
+        return false;
+    }
+
+    watch->next = loop->watches;
+    loop->watches = watch;
+
+    return true;
+}
+
+void
+facron_loop_remove_fd (FacronLoop *loop, int fd)
+{
+    for (FacronLoopWatch **watch = &loop->watches; *watch; watch = &(*watch)->next)
+    {
+        if ((*watch)->fd == fd)
+        {
+            FacronLoopWatch *w = *watch;
+            epoll_ctl (loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            *watch = w->next;
+            /* an event may still be pending in the current batch, disarm it */
+            w->func = NULL;
+            w->next = loop->removed;
+            loop->removed = w;
+            return;
+        }
+    }
+}
+
+static void
+facron_loop_free_watches (FacronLoopWatch *watch)
+{
+    for (FacronLoopWatch *next; watch; watch = next)
+    {
+        next = watch->next;
+        free (watch);
+    }
+}
+
+static void
+facron_loop_dispatch_signals (int fd, unsigned int events, void *user_data)
+{
+    FacronLoop *loop = (FacronLoop *) user_data;
+    struct signalfd_siginfo info;
+    (void) events;
+
+    while (read (fd, &info, sizeof (info)) == sizeof (info))
+    {
+        if (info.ssi_signo < NSIG && loop->handlers[info.ssi_signo].func)
+            loop->handlers[info.ssi_signo].func (info.ssi_signo, loop->handlers[info.ssi_signo].user_data);
+    }
+}
+
+static bool
+facron_loop_watch_signals (FacronLoop *loop, const sigset_t *signals)
+{
+    int fd = signalfd (loop->signal_fd, signals, SFD_NONBLOCK|SFD_CLOEXEC);
+
+    if (fd < 0)
+        return false;
+    if (loop->signal_fd < 0 && !facron_loop_add_fd (loop, fd, EPOLLIN, &facron_loop_dispatch_signals, loop))
+    {
+        close (fd);
+        return false;
+    }
+
+    loop->signal_fd = fd;
+    loop->signals = *signals;
+    return true;
+}
+
+bool
+facron_loop_add_signal (FacronLoop *loop, int signum, FacronLoopSignalFunc func, void *user_data)
+{
+    sigset_t signals = loop->signals;
+    sigset_t blocked;
+
+    sigaddset (&signals, signum);
+    sigemptyset (&blocked);
+    sigaddset (&blocked, signum);
+    sigprocmask (SIG_BLOCK, &blocked, NULL);
+
+    if (!facron_loop_watch_signals (loop, &signals))
+    {
+        fprintf (stderr, "Error: could not watch signal %d\n", signum);
+        sigprocmask (SIG_UNBLOCK, &blocked, NULL);
+        return false;
+    }
+
+    loop->handlers[signum].func = func;
+    loop->handlers[signum].user_data = user_data;
+    return true;
+}
+
+void
+facron_loop_remove_signal (FacronLoop *loop, int signum)
+{
+    sigset_t signals = loop->signals;
+    sigset_t blocked;
+
+    sigdelset (&signals, signum);
+    facron_loop_watch_signals (loop, &signals);
+    loop->handlers[signum].func = NULL;
+
+    sigemptyset (&blocked);
+    sigaddset (&blocked, signum);
+    sigprocmask (SIG_UNBLOCK, &blocked, NULL);
+}
+
+bool
+facron_loop_run (FacronLoop *loop)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    loop->running = true;
+    loop->success = true;
+
+    while (loop->running)
+    {
+        int n = epoll_wait (loop->epoll_fd, events, MAX_EVENTS, -1);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf (stderr, "Error: epoll_wait failed\n");
+            return false;
+        }
+
+        for (int i = 0; i < n && loop->running; ++i)
+        {
+            FacronLoopWatch *watch = (FacronLoopWatch *) events[i].data.ptr;
+            if (watch->func)
+                watch->func (watch->fd, events[i].events, watch->user_data);
+        }
+
+        facron_loop_free_watches (loop->removed);
+        loop->removed = NULL;
+    }
+
+    return loop->success;
+}
+
+void
+facron_loop_quit (FacronLoop *loop, bool success)
+{
+    loop->running = false;
+    loop->success = success;
+}
+
+void
+facron_loop_free (FacronLoop *loop)
+{
+    facron_loop_free_watches (loop->watches);
+    facron_loop_free_watches (loop->removed);
+    for (size_t i = 0; i < loop->n_timers; ++i)
+        free (loop->timers[i]);
+    free (loop->timers);
+    if (loop->signal_fd >= 0)
+        close (loop->signal_fd);
+    close (loop->timer_fd);
+    close (loop->epoll_fd);
+    free (loop);
+}
+
+FacronLoop *
+facron_loop_new (void)
+{
+    int epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    int timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+
+    if (epoll_fd < 0 || timer_fd < 0)
+    {
+        fprintf (stderr, "Error: could not create the event loop\n");
+        if (epoll_fd >= 0)
+            close (epoll_fd);
+        if (timer_fd >= 0)
+            close (timer_fd);
+        return NULL;
+    }
+
+    FacronLoop *loop = (FacronLoop *) calloc (1, sizeof (FacronLoop));
+
+    loop->epoll_fd = epoll_fd;
+    loop->timer_fd = timer_fd;
+    loop->signal_fd = -1;
+    sigemptyset (&loop->signals);
+    loop->watches = NULL;
+    loop->removed = NULL;
+    loop->timers = NULL;
+    loop->n_timers = 0;
+    loop->timers_size = 0;
+    loop->armed = 0;
+    loop->running = false;
+    loop->success = true;
+
+    if (!facron_loop_add_fd (loop, timer_fd, EPOLLIN, &facron_loop_fire_timers, loop))
+    {
+        facron_loop_free (loop);
+        return NULL;
+    }
+
+    return loop;
+}
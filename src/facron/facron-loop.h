@@ -0,0 +1,53 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_LOOP_H__
+#define __FACRON_LOOP_H__
+
+#include <stdbool.h>
+
+typedef struct FacronLoop FacronLoop;
+
+typedef struct FacronLoopTimer FacronLoopTimer;
+
+typedef void (*FacronLoopFunc) (int fd, unsigned int events, void *user_data);
+typedef void (*FacronLoopTimerFunc) (void *user_data);
+typedef void (*FacronLoopSignalFunc) (int signum, void *user_data);
+
+bool facron_loop_add_fd    (FacronLoop *loop, int fd, unsigned int events, FacronLoopFunc func, void *user_data);
+void facron_loop_remove_fd (FacronLoop *loop, int fd);
+
+/* Timers are one-shot, they are freed once they have fired or been removed */
+FacronLoopTimer *facron_loop_add_timer    (FacronLoop *loop, unsigned long long delay_ms, FacronLoopTimerFunc func, void *user_data);
+void             facron_loop_remove_timer (FacronLoop *loop, FacronLoopTimer *timer);
+
+/* The signal gets blocked and delivered through the loop, one handler per signal */
+bool facron_loop_add_signal    (FacronLoop *loop, int signum, FacronLoopSignalFunc func, void *user_data);
+void facron_loop_remove_signal (FacronLoop *loop, int signum);
+
+unsigned long long facron_loop_now (void);
+
+bool facron_loop_run  (FacronLoop *loop);
+void facron_loop_quit (FacronLoop *loop, bool success);
+
+void facron_loop_free (FacronLoop *loop);
+
+FacronLoop *facron_loop_new (void);
+
+#endif /* __FACRON_LOOP_H__ */
@@ -0,0 +1,1085 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "facron-marks.h"
+#include "facron-glob.h"
+#include "facron-hash.h"
+#include "facron-loop.h"
+#include "facron-walk.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include <linux/limits.h>
+
+/*
+ * Each watched path gets a single mark for the union of the masks of its
+ * entries. When a filesystem is watched through too many paths, a single
+ * filesystem mark replaces all of them and the events of the paths nobody
+ * cares about are filtered out by the matcher.
+ *
+ * Applying a new configuration only touches the marks that changed: new
+ * marks are placed before the stale ones are removed so that the paths
+ * watched by both configurations never miss an event.
+ *
+ * An exclusion naming a direct child of a watched path becomes an ignore
+ * mark on that child, so that the kernel drops its events, as long as no
+ * entry which could be interested in them is left: every entry watching the
+ * parent must exclude it, and nobody may watch the child itself.
+ *
+ * A recursive entry marks every directory of its tree, which is discovered
+ * by a parallel walk, leaving the excluded subtrees out. When fanotify
+ * reports names, these marks also ask for the directory entry events, so
+ * that the directories appearing later are marked as they come. The marks
+ * of the removed directories go away with their inodes.
+ *
+ * The kernel keeps the mark of a directory moved out of its tree, which
+ * can only be removed through its new path. Such marks are remembered by
+ * inode until an event shows where the directory went, or until it comes
+ * back to a watched path, which takes the mark over. A reload forgets the
+ * ones the kernel dropped along with their deleted inode, and closing the
+ * fanotify group on exit drops the rest.
+ *
+ * Planning only reads the configuration and the filesystem, so that the
+ * walks of a reload run on the reload thread: the loop is left with the
+ * fanotify_mark calls of what changed.
+ */
+
+typedef struct FacronMark
+{
+    unsigned long long mask;
+    dev_t dev;
+    ino_t ino;
+    bool has_dev; /* along with ino */
+    size_t n_paths; /* for filesystem marks */
+    size_t n_entries; /* for inode marks, and the entries excluding the path of ignore marks */
+    unsigned long long grown_ns; /* when marked as it appeared, 0 otherwise */
+    /* the inode marks of the directory holding it and of the ones it holds */
+    struct FacronMark *parent;
+    struct FacronMark *children;
+    struct FacronMark *prev;
+    struct FacronMark *next;
+    char path[];
+} FacronMark;
+
+typedef struct
+{
+    dev_t dev;
+    ino_t ino;
+} FacronMarkId;
+
+struct FacronMarks
+{
+    int fanotify_fd;
+    size_t filesystem_threshold;
+    FacronHash *inodes; /* path -> FacronMark */
+    FacronHash *filesystems; /* dev_t -> FacronMark */
+    FacronHash *ignores; /* path -> FacronMark */
+    FacronHash *moved; /* FacronMarkId -> FacronMark, with the path it left */
+    FacronHash *grown_ids; /* FacronMarkId -> path, of the marks grown since the last apply */
+    unsigned int ignore_flags;
+    unsigned long long tree_mask; /* what tree directories are marked for on top of their entries */
+    /* since the last apply */
+    size_t grown;
+    size_t forgotten;
+    size_t moved_away;
+    size_t unmarked;
+    size_t reclaimed;
+    size_t pruned;
+    /* what the last apply did */
+    size_t added;
+    size_t removed;
+    size_t changed;
+    size_t kept;
+    size_t failed;
+    unsigned long long apply_ns;
+    size_t discovered;
+    unsigned long long discover_ns;
+};
+
+struct FacronMarksPlan
+{
+    FacronMarks *marks; /* only its settings are read while planning */
+    FacronHash *paths;
+    FacronHash *devices;
+    FacronHash *ignored;
+    char **trees; /* the roots of the recursive entries */
+    size_t n_trees;
+    size_t discovered;
+    unsigned long long discover_ns;
+    unsigned long long started;
+    FacronHash *marked; /* the FacronMarkId the kernel has an inode mark on, when following trees */
+    /* when applying */
+    FacronHash *inodes; /* the marks once applied */
+    FacronHash *filesystems;
+    FacronHash *ignores;
+};
+
+static FacronMark *
+facron_mark_new (const char *path, size_t len)
+{
+    FacronMark *mark = (FacronMark *) calloc (1, sizeof (FacronMark) + len + 1);
+
+    memcpy (mark->path, path, len + 1);
+    return mark;
+}
+
+/* Links mark, which is in inodes, below the mark of the directory holding it */
+static void
+facron_marks_link (FacronHash *inodes, FacronMark *mark, size_t len)
+{
+    const char *slash = (const char *) memrchr (mark->path, '/', len);
+
+    mark->parent = (slash && len > 1) ? (FacronMark *) facron_hash_lookup (inodes, mark->path, (slash == mark->path) ? 1 : (size_t) (slash - mark->path)) : NULL;
+    mark->prev = NULL;
+    mark->next = NULL;
+    if (!mark->parent)
+        return;
+
+    mark->next = mark->parent->children;
+    if (mark->next)
+        mark->next->prev = mark;
+    mark->parent->children = mark;
+}
+
+static void
+facron_marks_reset_link (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronMark *mark = (FacronMark *) value;
+    (void) key;
+    (void) key_len;
+    (void) user_data;
+
+    mark->parent = mark->children = mark->prev = mark->next = NULL;
+}
+
+static void
+facron_marks_relink (const void *key, size_t key_len, void *value, void *user_data)
+{
+    (void) key;
+    facron_marks_link ((FacronHash *) user_data, (FacronMark *) value, key_len);
+}
+
+/* The marks below it are left without a parent */
+static void
+facron_marks_unlink (FacronMark *mark)
+{
+    if (mark->prev)
+        mark->prev->next = mark->next;
+    else if (mark->parent)
+        mark->parent->children = mark->next;
+    if (mark->next)
+        mark->next->prev = mark->prev;
+
+    for (FacronMark *child = mark->children; child; child = child->next)
+        child->parent = NULL;
+    mark->parent = mark->children = mark->prev = mark->next = NULL;
+}
+
+static unsigned long long
+facron_marks_entry_mask (const FacronConfEntry *entry)
+{
+    unsigned long long mask = 0;
+
+    for (size_t i = 0; i < entry->n_masks; ++i)
+        mask |= entry->mask[i];
+    return mask;
+}
+
+/*
+ * tree_mask only matters for the inode mark of path, not for the one of its
+ * filesystem. Tree directories are identified in case they are moved away.
+ */
+static void
+facron_marks_plan_path (FacronMarksPlan *plan, const char *path, unsigned long long mask, unsigned long long tree_mask)
+{
+    size_t len = strlen (path);
+    FacronMark *mark = (FacronMark *) facron_hash_lookup (plan->paths, path, len);
+    struct stat st;
+
+    if (mark)
+    {
+        mark->mask |= mask|tree_mask;
+        ++mark->n_entries;
+        if (mark->has_dev)
+            ((FacronMark *) facron_hash_lookup (plan->devices, &mark->dev, sizeof (dev_t)))->mask |= mask;
+        return;
+    }
+
+    mark = facron_mark_new (path, len);
+    mark->mask = mask|tree_mask;
+    mark->n_entries = 1;
+    facron_hash_insert (plan->paths, path, len, mark);
+
+    if ((!plan->marks->filesystem_threshold && !tree_mask) || stat (path, &st) < 0)
+        return;
+
+    mark->dev = st.st_dev;
+    mark->ino = st.st_ino;
+    mark->has_dev = true;
+    if (!plan->marks->filesystem_threshold)
+        return;
+
+    FacronMark *device = (FacronMark *) facron_hash_lookup (plan->devices, &st.st_dev, sizeof (dev_t));
+    if (!device)
+    {
+        device = facron_mark_new (path, len);
+        device->dev = st.st_dev;
+        device->has_dev = true;
+        facron_hash_insert (plan->devices, &st.st_dev, sizeof (dev_t), device);
+    }
+    device->mask |= mask;
+    ++device->n_paths;
+}
+
+typedef struct
+{
+    FacronMarks *marks; /* NULL when planning */
+    FacronMarksPlan *plan; /* NULL when growing a tree */
+    unsigned long long mask;
+    unsigned long long tree_mask;
+    const FacronConfEntry *entry; /* for trees */
+    size_t root_len;
+} FacronMarksDirs;
+
+static void
+facron_marks_plan_dir (const char *dir, void *user_data)
+{
+    FacronMarksDirs *dirs = (FacronMarksDirs *) user_data;
+    facron_marks_plan_path (dirs->plan, dir, dirs->mask, dirs->tree_mask);
+}
+
+/* The directories a pattern may match in are watched for their children */
+static void
+facron_marks_plan_pattern (FacronMarksPlan *plan, const char *path, unsigned long long mask)
+{
+    FacronMarksDirs dirs = { NULL, plan, mask|FAN_EVENT_ON_CHILD, 0, NULL, 0 };
+    facron_glob_expand (path, mask & FAN_EVENT_ON_CHILD, &facron_marks_plan_dir, &dirs);
+}
+
+/* Called from the walking threads, which only read the compiled exclusions */
+static bool
+facron_marks_skip_dir (const char *path, size_t len, void *user_data)
+{
+    const FacronMarksDirs *dirs = (const FacronMarksDirs *) user_data;
+    const char *relative = path + dirs->root_len;
+
+    if (*relative == '/')
+        ++relative;
+    return facron_exclude_match (dirs->entry->exclude_filter, relative, path + len - relative, true);
+}
+
+static void
+facron_marks_plan_tree_dir (const char *dir, size_t len, void *user_data)
+{
+    (void) len;
+    facron_marks_plan_dir (dir, user_data);
+}
+
+static void
+facron_marks_plan_tree (FacronMarksPlan *plan, const FacronConfEntry *entry, unsigned long long mask)
+{
+    FacronMarksDirs dirs = { NULL, plan, mask|FAN_EVENT_ON_CHILD, plan->marks->tree_mask, entry, strlen (entry->path) };
+    unsigned long long start = facron_loop_now ();
+    size_t n = facron_walk (entry->path, 0, (entry->exclude_filter) ? &facron_marks_skip_dir : NULL, &facron_marks_plan_tree_dir, &dirs);
+    unsigned long long elapsed = facron_loop_now () - start;
+
+    plan->trees = (char **) realloc (plan->trees, (plan->n_trees + 1) * sizeof (char *));
+    plan->trees[plan->n_trees++] = strdup (entry->path);
+    plan->discovered += n;
+    plan->discover_ns += elapsed;
+    fprintf (stderr, "Notice: discovered %zu directories below \"%s\" in %.2fms\n", n, entry->path, elapsed / 1000000.0);
+}
+
+static bool
+facron_marks_mark (FacronMarks *marks, unsigned int flags, const char *path, unsigned long long old_mask, unsigned long long new_mask)
+{
+    /* filesystem marks cover every inode, children and new directories included */
+    if (flags & FAN_MARK_FILESYSTEM)
+    {
+        old_mask &= ~(FAN_EVENT_ON_CHILD|FACRON_MARKS_TREE_EVENTS);
+        new_mask &= ~(FAN_EVENT_ON_CHILD|FACRON_MARKS_TREE_EVENTS);
+    }
+
+    if ((new_mask & ~old_mask) && fanotify_mark (marks->fanotify_fd, FAN_MARK_ADD|flags, new_mask & ~old_mask, AT_FDCWD, path) < 0)
+        return false;
+    if (old_mask & ~new_mask)
+        fanotify_mark (marks->fanotify_fd, FAN_MARK_REMOVE|flags, old_mask & ~new_mask, AT_FDCWD, path);
+
+    if (!old_mask)
+        ++marks->added;
+    else if (!new_mask)
+        ++marks->removed;
+    else if (old_mask != new_mask)
+        ++marks->changed;
+    else
+        ++marks->kept;
+
+    return true;
+}
+
+/* A directory moved away and back to a watched path still has its mark, mask gets it */
+static bool
+facron_marks_reclaim (FacronMarks *marks, dev_t dev, ino_t ino, unsigned long long *mask)
+{
+    FacronMarkId id = { dev, ino };
+    FacronMark *moved = (FacronMark *) facron_hash_remove (marks->moved, &id, sizeof (FacronMarkId));
+
+    if (!moved)
+        return false;
+
+    *mask = moved->mask;
+    free (moved);
+    ++marks->reclaimed;
+    return true;
+}
+
+static void
+facron_marks_add_filesystem (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronMarksPlan *plan = (FacronMarksPlan *) user_data;
+    FacronMark *device = (FacronMark *) value;
+    FacronMark *old = (FacronMark *) facron_hash_lookup (plan->marks->filesystems, key, key_len);
+
+    if (device->n_paths <= plan->marks->filesystem_threshold)
+        return;
+
+    if (!facron_marks_mark (plan->marks, FAN_MARK_FILESYSTEM, device->path, (old) ? old->mask : 0, device->mask))
+    {
+        fprintf (stderr, "Warning: could not place a filesystem mark through \"%s\", marking its %zu paths one by one\n", device->path, device->n_paths);
+        return;
+    }
+
+    if (!old)
+        fprintf (stderr, "Notice: watching the filesystem of \"%s\" as a whole for its %zu paths\n", device->path, device->n_paths);
+    else
+        free (facron_hash_remove (plan->marks->filesystems, key, key_len));
+    facron_hash_insert (plan->filesystems, key, key_len, facron_hash_remove (plan->devices, key, key_len));
+}
+
+static void
+facron_marks_add_inode (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronMarksPlan *plan = (FacronMarksPlan *) user_data;
+    FacronMark *mark = (FacronMark *) facron_hash_remove (plan->paths, key, key_len);
+    FacronMark *old = (FacronMark *) facron_hash_lookup (plan->marks->inodes, key, key_len);
+    unsigned long long old_mask = (old) ? old->mask : 0;
+    (void) value;
+
+    if (!old && mark->has_dev)
+        facron_marks_reclaim (plan->marks, mark->dev, mark->ino, &old_mask);
+
+    if (mark->has_dev && facron_hash_lookup (plan->filesystems, &mark->dev, sizeof (dev_t)))
+    {
+        /* the filesystem mark covers it */
+        if (!old && old_mask)
+            fanotify_mark (plan->marks->fanotify_fd, FAN_MARK_REMOVE, old_mask, AT_FDCWD, mark->path);
+        free (mark);
+    }
+    else if (!facron_marks_mark (plan->marks, 0, mark->path, old_mask, mark->mask))
+    {
+        ++plan->marks->failed;
+        free (mark);
+    }
+    else
+    {
+        if (old)
+            free (facron_hash_remove (plan->marks->inodes, key, key_len));
+        facron_hash_insert (plan->inodes, key, key_len, mark);
+    }
+}
+
+static void
+facron_marks_plan_ignores (FacronMarksPlan *plan, const FacronConfEntry *entry, unsigned long long mask)
+{
+    char path[PATH_MAX];
+    size_t len = strlen (entry->path);
+    size_t name_len;
+
+    if (len + 1 >= PATH_MAX)
+        return;
+    memcpy (path, entry->path, len);
+    if (!len || path[len - 1] != '/')
+        path[len++] = '/';
+
+    mask &= ~(FAN_EVENT_ON_CHILD|FAN_ONDIR);
+
+    for (size_t i = 0; i < entry->n_excludes; ++i)
+    {
+        const char *pattern = entry->exclude[i];
+
+        if (!facron_exclude_is_name (pattern, &name_len) || len + name_len >= PATH_MAX)
+            continue;
+
+        /* an entry votes once for each name */
+        bool seen = false;
+        for (size_t j = 0; j < i && !seen; ++j)
+        {
+            size_t other_len;
+            seen = facron_exclude_is_name (entry->exclude[j], &other_len) && other_len == name_len && !memcmp (entry->exclude[j], pattern, name_len);
+        }
+        if (seen)
+            continue;
+
+        memcpy (path + len, pattern, name_len);
+        path[len + name_len] = '\0';
+
+        FacronMark *ignore = (FacronMark *) facron_hash_lookup (plan->ignored, path, len + name_len);
+        if (!ignore)
+        {
+            ignore = facron_mark_new (path, len + name_len);
+            facron_hash_insert (plan->ignored, path, len + name_len, ignore);
+        }
+        ignore->mask |= mask;
+        ++ignore->n_entries;
+    }
+}
+
+/* Tries the FAN_MARK_IGNORE semantics first, which know about directories */
+static bool
+facron_marks_ignore (FacronMarks *marks, const char *path, unsigned long long old_mask, unsigned long long new_mask)
+{
+    if (!marks->ignore_flags)
+    {
+        marks->ignore_flags = FAN_MARK_IGNORE|FAN_MARK_IGNORED_SURV_MODIFY;
+        if (facron_marks_mark (marks, marks->ignore_flags, path, old_mask, new_mask))
+            return true;
+        if (errno != EINVAL)
+            return false;
+        marks->ignore_flags = FAN_MARK_IGNORED_MASK|FAN_MARK_IGNORED_SURV_MODIFY;
+    }
+
+    /* the legacy ignored mask cannot tell the events of a directory from the ones of its children */
+    if ((new_mask & FAN_ONDIR) && (marks->ignore_flags & FAN_MARK_IGNORED_MASK))
+        return false;
+
+    return facron_marks_mark (marks, marks->ignore_flags, path, old_mask, new_mask);
+}
+
+static void
+facron_marks_add_ignore (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronMarksPlan *plan = (FacronMarksPlan *) user_data;
+    FacronMark *ignore = (FacronMark *) value;
+    const char *slash = strrchr (ignore->path, '/');
+    size_t parent_len = (slash == ignore->path) ? 1 : (size_t) (slash - ignore->path);
+    const FacronMark *parent = (const FacronMark *) facron_hash_lookup (plan->paths, ignore->path, parent_len);
+    struct stat st;
+
+    /* otherwise the events stay visible to facron, which filters them */
+    if (!parent || ignore->n_entries < parent->n_entries || facron_hash_lookup (plan->paths, key, key_len) ||
+        lstat (ignore->path, &st) < 0)
+            return;
+
+    if (S_ISDIR (st.st_mode))
+        ignore->mask |= FAN_ONDIR;
+
+    FacronMark *old = (FacronMark *) facron_hash_lookup (plan->marks->ignores, key, key_len);
+    if (!facron_marks_ignore (plan->marks, ignore->path, (old) ? old->mask : 0, ignore->mask))
+        return;
+
+    if (old)
+        free (facron_hash_remove (plan->marks->ignores, key, key_len));
+    facron_hash_insert (plan->ignores, key, key_len, facron_hash_remove (plan->ignored, key, key_len));
+}
+
+static void
+facron_marks_remove_ignore (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronMarks *marks = (FacronMarks *) user_data;
+    FacronMark *mark = (FacronMark *) value;
+    (void) key;
+    (void) key_len;
+
+    facron_marks_mark (marks, marks->ignore_flags, mark->path, mark->mask, 0);
+}
+
+static void
+facron_marks_remove_inode (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronMarks *marks = (FacronMarks *) user_data;
+    FacronMark *mark = (FacronMark *) value;
+    (void) key;
+    (void) key_len;
+
+    facron_marks_mark (marks, 0, mark->path, mark->mask, 0);
+}
+
+static void
+facron_marks_remove_filesystem (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronMarks *marks = (FacronMarks *) user_data;
+    FacronMark *mark = (FacronMark *) value;
+    (void) key;
+    (void) key_len;
+
+    facron_marks_mark (marks, FAN_MARK_FILESYSTEM, mark->path, mark->mask, 0);
+}
+
+/* Whether path lies in one of the trees of the plan */
+static bool
+facron_marks_plan_has_tree (const FacronMarksPlan *plan, const char *path, size_t len)
+{
+    for (size_t i = 0; i < plan->n_trees; ++i)
+    {
+        size_t root_len = strlen (plan->trees[i]);
+
+        if (root_len <= len && !memcmp (path, plan->trees[i], root_len) &&
+            (root_len == len || path[root_len] == '/' || plan->trees[i][root_len - 1] == '/'))
+                return true;
+    }
+    return false;
+}
+
+/*
+ * The directories which appeared while the plan was walking may have been
+ * walked past: they keep the mark they were given if they are still in a
+ * tree, even though a changed mask or exclusion is not applied to them.
+ */
+static void
+facron_marks_remove_stale_inode (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronMarksPlan *plan = (FacronMarksPlan *) user_data;
+    FacronMark *mark = (FacronMark *) value;
+
+    if (mark->grown_ns >= plan->started && facron_marks_plan_has_tree (plan, key, key_len) &&
+        !facron_hash_lookup (plan->inodes, key, key_len))
+    {
+        facron_hash_insert (plan->inodes, key, key_len, facron_hash_remove (plan->marks->inodes, key, key_len));
+        ++plan->marks->kept;
+        return;
+    }
+
+    facron_marks_remove_inode (key, key_len, value, plan->marks);
+}
+
+/* The kernel drops the mark of a deleted directory, which fdinfo tells by inode */
+static FacronHash *
+facron_marks_read_marked (int fanotify_fd)
+{
+    char path[64];
+    char *line = NULL;
+    size_t size = 0;
+    FILE *file;
+
+    sprintf (path, "/proc/self/fdinfo/%d", fanotify_fd);
+    if (!(file = fopen (path, "re")))
+        return NULL;
+
+    FacronHash *marked = facron_hash_new ();
+    while (getline (&line, &size, file) >= 0)
+    {
+        unsigned long ino;
+        unsigned int sdev;
+
+        /* sdev is the kernel encoding, with 20 bits of minor */
+        if (sscanf (line, "fanotify ino:%lx sdev:%x", &ino, &sdev) == 2)
+        {
+            FacronMarkId id = { makedev (sdev >> 20, sdev & 0xfffff), ino };
+            facron_hash_insert (marked, &id, sizeof (FacronMarkId), marked);
+        }
+    }
+    free (line);
+    fclose (file);
+
+    return marked;
+}
+
+static void
+facron_marks_prune_moved (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronMarksPlan *plan = (FacronMarksPlan *) user_data;
+    (void) value;
+
+    if (facron_hash_lookup (plan->marked, key, key_len))
+        return;
+    free (facron_hash_remove (plan->marks->moved, key, key_len));
+    ++plan->marks->pruned;
+}
+
+FacronMarksPlan *
+facron_marks_plan (FacronMarks *marks, const FacronConfEntry *entries)
+{
+    FacronMarksPlan *plan = (FacronMarksPlan *) calloc (1, sizeof (FacronMarksPlan));
+
+    plan->marks = marks;
+    plan->paths = facron_hash_new ();
+    plan->devices = facron_hash_new ();
+    plan->ignored = facron_hash_new ();
+    plan->started = facron_loop_now ();
+    /* before the walks, so that the directories moved away meanwhile are still marked */
+    if (marks->tree_mask)
+        plan->marked = facron_marks_read_marked (marks->fanotify_fd);
+
+    for (const FacronConfEntry *entry = entries; entry; entry = entry->next)
+    {
+        unsigned long long mask = facron_marks_entry_mask (entry);
+        if (entry->is_pattern)
+            facron_marks_plan_pattern (plan, entry->path, mask);
+        else if (entry->options.recursive)
+            facron_marks_plan_tree (plan, entry, mask);
+        else
+            facron_marks_plan_path (plan, entry->path, mask, 0);
+        if (entry->n_excludes && !entry->is_pattern)
+            facron_marks_plan_ignores (plan, entry, mask);
+    }
+
+    return plan;
+}
+
+void
+facron_marks_plan_free (void *data)
+{
+    FacronMarksPlan *plan = (FacronMarksPlan *) data;
+
+    facron_hash_free (plan->paths, &free);
+    facron_hash_free (plan->devices, &free);
+    facron_hash_free (plan->ignored, &free);
+    if (plan->marked)
+        facron_hash_free (plan->marked, NULL);
+    for (size_t i = 0; i < plan->n_trees; ++i)
+        free (plan->trees[i]);
+    free (plan->trees);
+    free (plan);
+}
+
+void
+facron_marks_apply_plan (FacronMarks *marks, FacronMarksPlan *plan)
+{
+    unsigned long long start = facron_loop_now ();
+
+    plan->marks = marks;
+    plan->inodes = facron_hash_new ();
+    plan->filesystems = facron_hash_new ();
+    plan->ignores = facron_hash_new ();
+
+    marks->added = marks->removed = marks->changed = marks->kept = marks->failed = 0;
+    marks->grown = marks->forgotten = marks->moved_away = marks->unmarked = marks->reclaimed = marks->pruned = 0;
+    facron_hash_free (marks->grown_ids, &free);
+    marks->grown_ids = facron_hash_new ();
+    marks->discovered = plan->discovered;
+    marks->discover_ns = plan->discover_ns;
+
+    if (plan->marked)
+        facron_hash_foreach (marks->moved, &facron_marks_prune_moved, plan);
+
+    /* the marks still in use are moved out of marks->inodes, marks->filesystems and marks->ignores */
+    facron_hash_foreach (plan->ignored, &facron_marks_add_ignore, plan);
+    facron_hash_foreach (plan->devices, &facron_marks_add_filesystem, plan);
+    facron_hash_foreach (plan->paths, &facron_marks_add_inode, plan);
+
+    /* what is left is stale */
+    facron_hash_foreach (marks->inodes, &facron_marks_remove_stale_inode, plan);
+    facron_hash_foreach (marks->filesystems, &facron_marks_remove_filesystem, marks);
+    facron_hash_foreach (marks->ignores, &facron_marks_remove_ignore, marks);
+
+    facron_hash_free (marks->inodes, &free);
+    facron_hash_free (marks->filesystems, &free);
+    facron_hash_free (marks->ignores, &free);
+    marks->inodes = plan->inodes;
+    marks->filesystems = plan->filesystems;
+    marks->ignores = plan->ignores;
+
+    /* the kept marks may still point to the freed ones */
+    facron_hash_foreach (marks->inodes, &facron_marks_reset_link, NULL);
+    facron_hash_foreach (marks->inodes, &facron_marks_relink, marks->inodes);
+
+    facron_marks_plan_free (plan);
+
+    marks->apply_ns = facron_loop_now () - start;
+    facron_marks_dump_stats (marks);
+}
+
+void
+facron_marks_apply (FacronMarks *marks, const FacronConfEntry *entries)
+{
+    facron_marks_apply_plan (marks, facron_marks_plan (marks, entries));
+}
+
+/* Outside of any apply, so the counters of the last one are left alone */
+static void
+facron_marks_grow_dir (const char *dir, size_t len, void *user_data)
+{
+    FacronMarksDirs *dirs = (FacronMarksDirs *) user_data;
+    FacronMarks *marks = dirs->marks;
+    FacronMark *mark = (FacronMark *) facron_hash_lookup (marks->inodes, dir, len);
+    unsigned long long old_mask = (mark) ? mark->mask : 0;
+    unsigned long long new_mask;
+    struct stat st;
+    bool known = !mark && !lstat (dir, &st);
+
+    if (known)
+        facron_marks_reclaim (marks, st.st_dev, st.st_ino, &old_mask);
+    new_mask = old_mask|dirs->mask|dirs->tree_mask;
+
+    if (new_mask == old_mask && mark)
+        return;
+    if (new_mask != old_mask && fanotify_mark (marks->fanotify_fd, FAN_MARK_ADD, new_mask & ~old_mask, AT_FDCWD, dir) < 0)
+    {
+        fprintf (stderr, "Warning: could not watch the new directory \"%s\"\n", dir);
+        /* a reclaimed mark is still there */
+        if (mark || !old_mask)
+            return;
+        new_mask = old_mask;
+    }
+
+    if (!mark)
+    {
+        mark = facron_mark_new (dir, len);
+        mark->n_entries = 1;
+        if (known)
+        {
+            FacronMarkId id = { st.st_dev, st.st_ino };
+
+            mark->dev = st.st_dev;
+            mark->ino = st.st_ino;
+            mark->has_dev = true;
+            free (facron_hash_remove (marks->grown_ids, &id, sizeof (FacronMarkId)));
+            facron_hash_insert (marks->grown_ids, &id, sizeof (FacronMarkId), strndup (dir, len));
+        }
+        facron_hash_insert (marks->inodes, dir, len, mark);
+        facron_marks_link (marks->inodes, mark, len);
+    }
+    mark->mask = new_mask;
+    mark->grown_ns = facron_loop_now ();
+    ++marks->grown;
+}
+
+void
+facron_marks_grow (FacronMarks *marks, const FacronConfEntry *entry, const char *path)
+{
+    struct stat st;
+
+    /* nothing to follow without the directory entry events, nor below a filesystem mark */
+    if (!marks->tree_mask || lstat (path, &st) < 0 || !S_ISDIR (st.st_mode) ||
+        facron_hash_lookup (marks->filesystems, &st.st_dev, sizeof (dev_t)))
+            return;
+
+    /* new directories are usually small, or empty, and come in bursts: no threads */
+    FacronMarksDirs dirs = { marks, NULL, facron_marks_entry_mask (entry)|FAN_EVENT_ON_CHILD, marks->tree_mask, entry, strlen (entry->path) };
+    facron_walk (path, 1, (entry->exclude_filter) ? &facron_marks_skip_dir : NULL, &facron_marks_grow_dir, &dirs);
+}
+
+/* Whether mark is the one the directory was grown with, the id may have been taken over since */
+static bool
+facron_marks_is_grown (FacronMarks *marks, const FacronMark *mark, const char **path)
+{
+    FacronMarkId id = { mark->dev, mark->ino };
+
+    *path = (mark->has_dev) ? (const char *) facron_hash_lookup (marks->grown_ids, &id, sizeof (FacronMarkId)) : NULL;
+    return *path && !strcmp (*path, mark->path);
+}
+
+static void
+facron_marks_drop (FacronMarks *marks, FacronMark *mark)
+{
+    FacronMarkId id = { mark->dev, mark->ino };
+    const char *path;
+
+    if (facron_marks_is_grown (marks, mark, &path))
+        free (facron_hash_remove (marks->grown_ids, &id, sizeof (FacronMarkId)));
+    free (mark);
+}
+
+/* The directories without an identity cannot be told apart later on, their marks are left behind */
+static void
+facron_marks_move_away (FacronMarks *marks, FacronMark *mark)
+{
+    FacronMarkId id = { mark->dev, mark->ino };
+    const char *path;
+
+    ++marks->moved_away;
+    if (!mark->has_dev)
+    {
+        free (mark);
+        return;
+    }
+
+    /* the events come in path order: it may have been marked where it went already */
+    if (!facron_marks_is_grown (marks, mark, &path) && path)
+    {
+        FacronMark *grown = (FacronMark *) facron_hash_lookup (marks->inodes, path, strlen (path));
+
+        if (grown)
+            grown->mask |= mark->mask;
+        free (mark);
+        ++marks->reclaimed;
+        return;
+    }
+
+    if (path)
+        free (facron_hash_remove (marks->grown_ids, &id, sizeof (FacronMarkId)));
+    free (facron_hash_remove (marks->moved, &id, sizeof (FacronMarkId)));
+    facron_hash_insert (marks->moved, &id, sizeof (FacronMarkId), mark);
+}
+
+static void
+facron_marks_forget_below (FacronMarks *marks, FacronMark *mark)
+{
+    FacronMark *child = mark->children;
+
+    mark->children = NULL;
+    while (child)
+    {
+        FacronMark *next = child->next;
+
+        facron_marks_forget_below (marks, child);
+        facron_hash_remove (marks->inodes, child->path, strlen (child->path));
+        child->parent = child->prev = child->next = NULL;
+        facron_marks_move_away (marks, child);
+        ++marks->forgotten;
+        child = next;
+    }
+}
+
+void
+facron_marks_forget (FacronMarks *marks, const char *path, size_t len, bool subtree)
+{
+    FacronMark *mark = (FacronMark *) facron_hash_remove (marks->inodes, path, len);
+
+    if (!mark)
+        return;
+    ++marks->forgotten;
+
+    if (!subtree)
+    {
+        facron_marks_unlink (mark);
+        facron_marks_drop (marks, mark);
+        return;
+    }
+
+    /* only the marks below path are looked at, through the directories holding them */
+    facron_marks_forget_below (marks, mark);
+    facron_marks_unlink (mark);
+    facron_marks_move_away (marks, mark);
+}
+
+/* Leaves the mask a path watched at to is marked for */
+static void
+facron_marks_unmark (FacronMarks *marks, const FacronMark *moved, const char *to, size_t len)
+{
+    const FacronMark *mark = (const FacronMark *) facron_hash_lookup (marks->inodes, to, len);
+    unsigned long long mask = moved->mask & ~((mark) ? mark->mask : 0);
+
+    if (mask)
+        fanotify_mark (marks->fanotify_fd, FAN_MARK_REMOVE, mask, AT_FDCWD, to);
+    ++marks->unmarked;
+}
+
+typedef struct
+{
+    FacronMarks *marks;
+    const char *from;
+    size_t from_len;
+    char *to; /* PATH_MAX bytes */
+    size_t to_len;
+} FacronMarksUnmark;
+
+/* The directories which moved along with the one found at to */
+static void
+facron_marks_unmark_below (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronMarksUnmark *unmark = (FacronMarksUnmark *) user_data;
+    FacronMark *mark = (FacronMark *) value;
+    size_t len = strlen (mark->path);
+    struct stat st;
+
+    if (len <= unmark->from_len || mark->path[unmark->from_len] != '/' || memcmp (mark->path, unmark->from, unmark->from_len) ||
+        unmark->to_len + len - unmark->from_len >= PATH_MAX)
+            return;
+
+    memcpy (unmark->to + unmark->to_len, mark->path + unmark->from_len, len - unmark->from_len + 1);
+    /* unless it moved on its own since */
+    if (lstat (unmark->to, &st) < 0 || st.st_dev != mark->dev || st.st_ino != mark->ino)
+        return;
+
+    facron_marks_unmark (unmark->marks, mark, unmark->to, unmark->to_len + len - unmark->from_len);
+    free (facron_hash_remove (unmark->marks->moved, key, key_len));
+}
+
+static void
+facron_marks_unmark_dir (FacronMarks *marks, const char *dir, size_t len)
+{
+    struct stat st;
+
+    /* the directories marked where they are now are no news */
+    if (facron_hash_lookup (marks->inodes, dir, len) || lstat (dir, &st) < 0)
+        return;
+
+    FacronMarkId id = { st.st_dev, st.st_ino };
+    FacronMark *mark = (FacronMark *) facron_hash_lookup (marks->moved, &id, sizeof (FacronMarkId));
+    if (!mark)
+        return;
+
+    char from[PATH_MAX];
+    char to[PATH_MAX];
+    size_t from_len = strlen (mark->path);
+
+    memcpy (from, mark->path, from_len + 1);
+    memcpy (to, dir, len + 1);
+
+    /* the directories above it which moved along, only the top one may have been renamed */
+    for (;;)
+    {
+        const char *from_slash = (const char *) memrchr (from, '/', from_len);
+        const char *to_slash = (const char *) memrchr (to, '/', len);
+
+        if (!from_slash || from_slash == from || !to_slash || to_slash == to || strcmp (from_slash, to_slash))
+            break;
+
+        size_t parent_len = from_slash - from;
+        size_t to_parent_len = to_slash - to;
+
+        to[to_parent_len] = '\0';
+        if (lstat (to, &st) < 0)
+        {
+            to[to_parent_len] = '/';
+            break;
+        }
+
+        FacronMarkId parent_id = { st.st_dev, st.st_ino };
+        FacronMark *parent = (FacronMark *) facron_hash_lookup (marks->moved, &parent_id, sizeof (FacronMarkId));
+        if (!parent || strncmp (parent->path, from, parent_len) || parent->path[parent_len])
+        {
+            to[to_parent_len] = '/';
+            break;
+        }
+
+        from[parent_len] = '\0';
+        from_len = parent_len;
+        len = to_parent_len;
+        mark = parent;
+        id = parent_id;
+    }
+
+    FacronMarksUnmark unmark = { marks, from, from_len, to, len };
+
+    facron_hash_remove (marks->moved, &id, sizeof (FacronMarkId));
+    facron_marks_unmark (marks, mark, to, len);
+    free (mark);
+    facron_hash_foreach (marks->moved, &facron_marks_unmark_below, &unmark);
+}
+
+void
+facron_marks_unmark_moved (FacronMarks *marks, const char *path, size_t len, unsigned long long mask)
+{
+    char dir[PATH_MAX];
+    const char *slash;
+
+    /*
+     * Filesystem marks never ask for the directory entry events, which only
+     * come from the marks of tree directories: the moved ones, and the ones
+     * in inodes, whose lookup spares the lstat.
+     */
+    if (!(mask & FACRON_MARKS_TREE_EVENTS) || !facron_hash_size (marks->moved) || len >= PATH_MAX)
+        return;
+
+    if ((mask & FAN_ONDIR) && (mask & (FAN_CREATE|FAN_MOVED_TO)))
+        facron_marks_unmark_dir (marks, path, len);
+
+    if (!(slash = (const char *) memrchr (path, '/', len)))
+        return;
+    len = (slash == path) ? 1 : (size_t) (slash - path);
+    memcpy (dir, path, len);
+    dir[len] = '\0';
+    facron_marks_unmark_dir (marks, dir, len);
+}
+
+/* The marks of the directories moved away stay until the fanotify group is closed */
+void
+facron_marks_clear (FacronMarks *marks)
+{
+    facron_hash_foreach (marks->inodes, &facron_marks_remove_inode, marks);
+    facron_hash_foreach (marks->filesystems, &facron_marks_remove_filesystem, marks);
+    facron_hash_foreach (marks->ignores, &facron_marks_remove_ignore, marks);
+    facron_hash_free (marks->inodes, &free);
+    facron_hash_free (marks->filesystems, &free);
+    facron_hash_free (marks->ignores, &free);
+    facron_hash_free (marks->moved, &free);
+    facron_hash_free (marks->grown_ids, &free);
+    marks->inodes = facron_hash_new ();
+    marks->filesystems = facron_hash_new ();
+    marks->ignores = facron_hash_new ();
+    marks->moved = facron_hash_new ();
+    marks->grown_ids = facron_hash_new ();
+}
+
+void
+facron_marks_dump_stats (const FacronMarks *marks)
+{
+    fprintf (stderr, "Notice: %zu inode marks, %zu filesystem marks and %zu ignore marks, last applied in %.2fms: %zu added, %zu removed, %zu changed, %zu kept, %zu failed\n",
+             facron_hash_size (marks->inodes),
+             facron_hash_size (marks->filesystems),
+             facron_hash_size (marks->ignores),
+             marks->apply_ns / 1000000.0,
+             marks->added,
+             marks->removed,
+             marks->changed,
+             marks->kept,
+             marks->failed);
+    if (marks->discovered || marks->grown || marks->forgotten)
+        fprintf (stderr, "Notice: %zu tree directories discovered in %.2fms, %zu marked as they appeared and %zu forgotten since\n",
+                 marks->discovered,
+                 marks->discover_ns / 1000000.0,
+                 marks->grown,
+                 marks->forgotten);
+    if (marks->moved_away || marks->pruned || facron_hash_size (marks->moved))
+        fprintf (stderr, "Notice: %zu tree directories moved away since, %zu unmarked at their new path, %zu back at a watched path, %zu found deleted and %zu still marked\n",
+                 marks->moved_away,
+                 marks->unmarked,
+                 marks->reclaimed,
+                 marks->pruned,
+                 facron_hash_size (marks->moved));
+}
+
+void
+facron_marks_free (FacronMarks *marks)
+{
+    facron_hash_free (marks->inodes, &free);
+    facron_hash_free (marks->filesystems, &free);
+    facron_hash_free (marks->ignores, &free);
+    facron_hash_free (marks->moved, &free);
+    facron_hash_free (marks->grown_ids, &free);
+    free (marks);
+}
+
+FacronMarks *
+facron_marks_new (int fanotify_fd, size_t filesystem_threshold, bool follow_trees)
+{
+    FacronMarks *marks = (FacronMarks *) calloc (1, sizeof (FacronMarks));
+
+    marks->fanotify_fd = fanotify_fd;
+    marks->filesystem_threshold = filesystem_threshold;
+    marks->tree_mask = (follow_trees) ? FACRON_MARKS_TREE_EVENTS|FAN_ONDIR : 0;
+    marks->inodes = facron_hash_new ();
+    marks->filesystems = facron_hash_new ();
+    marks->ignores = facron_hash_new ();
+    marks->moved = facron_hash_new ();
+    marks->grown_ids = facron_hash_new ();
+
+    return marks;
+}
@@ -0,0 +1,62 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_MARKS_H__
+#define __FACRON_MARKS_H__
+
+#include "facron-conf-entry.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/fanotify.h>
+
+/* What the directories of recursive entries are also marked for, to follow their tree */
+#define FACRON_MARKS_TREE_EVENTS (FAN_CREATE|FAN_DELETE|FAN_MOVED_FROM|FAN_MOVED_TO)
+
+typedef struct FacronMarks FacronMarks;
+typedef struct FacronMarksPlan FacronMarksPlan;
+
+/* Walks the trees and works out the marks of entries, from any thread: only the settings of marks are read */
+FacronMarksPlan *facron_marks_plan      (FacronMarks *marks, const FacronConfEntry *entries);
+void             facron_marks_plan_free (void *plan);
+
+/* Places the marks which changed since the last apply and frees plan */
+void facron_marks_apply_plan (FacronMarks *marks, FacronMarksPlan *plan);
+void facron_marks_apply      (FacronMarks *marks, const FacronConfEntry *entries);
+void facron_marks_clear (FacronMarks *marks);
+
+/* Marks a directory which appeared in the tree of entry, along with the ones it holds */
+void facron_marks_grow   (FacronMarks *marks, const FacronConfEntry *entry, const char *path);
+/* Drops the mark of a directory which left its tree, and the ones below it when moved away */
+void facron_marks_forget (FacronMarks *marks, const char *path, size_t len, bool subtree);
+/* Removes the marks of the directories moved away once an event at path shows where one went */
+void facron_marks_unmark_moved (FacronMarks *marks, const char *path, size_t len, unsigned long long mask);
+
+void facron_marks_dump_stats (const FacronMarks *marks);
+
+void facron_marks_free (FacronMarks *marks);
+
+/*
+ * A filesystem watched through more than filesystem_threshold paths gets a
+ * single mark, 0 disables it. follow_trees needs fanotify to report names.
+ */
+FacronMarks *facron_marks_new (int fanotify_fd, size_t filesystem_threshold, bool follow_trees);
+
+#endif /* __FACRON_MARKS_H__ */
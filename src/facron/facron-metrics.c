@@ -0,0 +1,531 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "facron-metrics.h"
+#include "facron-hash.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/*
+ * Histograms count their samples in buckets of powers of two nanoseconds,
+ * which costs a bit scan per sample and covers any duration in 64 buckets,
+ * the ones between a microsecond and half a minute being exported.
+ *
+ * Everything is updated with relaxed atomics, as the workers of a pipeline
+ * dispatch events concurrently, and read whenever the metrics are shown.
+ *
+ * The events matched by a rule are counted by the rule itself, the counts
+ * of the rules of the replaced generations are kept here, by path.
+ *
+ * A client of the socket gets the metrics once it sent its request, which
+ * is not parsed: an HTTP request gets an HTTP response, anything else the
+ * bare text. The connection is closed once everything is written.
+ */
+
+#define N_BUCKETS      64
+#define FIRST_EXPORTED 10 /* 1.024us */
+#define LAST_EXPORTED  35 /* 34.4s */
+#define TOP_RULES      5
+
+typedef struct
+{
+    atomic_ullong buckets[N_BUCKETS]; /* bucket i holds the samples below 2^i ns, and not below the previous one */
+    atomic_ullong count;
+    atomic_ullong sum_ns;
+    atomic_ullong max_ns;
+} FacronMetricsHistogram;
+
+typedef struct
+{
+    const char *name;
+    const char *help;
+    const char *type;
+} FacronMetricsInfo;
+
+static const FacronMetricsInfo metrics_info[N_FACRON_METRICS] = {
+    [FACRON_METRIC_READS]             = { "facron_reads_total", "Reads of the fanotify queue", "counter" },
+    [FACRON_METRIC_FULL_READS]        = { "facron_full_reads_total", "Reads which may have been cut short by the buffer", "counter" },
+    [FACRON_METRIC_EVENTS_READ]       = { "facron_events_read_total", "Events read from the fanotify queue", "counter" },
+    [FACRON_METRIC_EVENTS_DISPATCHED] = { "facron_events_dispatched_total", "Events matched against the rules", "counter" },
+    [FACRON_METRIC_DUPLICATES]        = { "facron_duplicate_events_total", "Events dropped as identical to the previous one of their path", "counter" },
+    [FACRON_METRIC_EXCLUDED]          = { "facron_excluded_events_total", "Events dropped by an exclusion", "counter" },
+    [FACRON_METRIC_CANDIDATES]        = { "facron_candidate_rules_total", "Rules examined while dispatching the events", "counter" },
+    [FACRON_METRIC_OVERFLOWS]         = { "facron_queue_overflows_total", "Overflows of the fanotify queue", "counter" },
+    [FACRON_METRIC_UNRESOLVED]        = { "facron_unresolved_events_total", "Events whose path could not be found", "counter" },
+    [FACRON_METRIC_SPAWNED]           = { "facron_commands_spawned_total", "Commands spawned", "counter" },
+    [FACRON_METRIC_SPAWN_FAILURES]    = { "facron_command_failures_total", "Commands which could not be spawned", "counter" },
+    [FACRON_METRIC_QUEUED]            = { "facron_commands_queued_total", "Commands which waited for a concurrency limit", "counter" },
+    [FACRON_METRIC_DROPPED]           = { "facron_commands_dropped_total", "Commands dropped by a full queue", "counter" },
+    [FACRON_METRIC_COALESCED]         = { "facron_commands_coalesced_total", "Commands merged into one waiting for the same path", "counter" },
+    [FACRON_METRIC_IN_FLIGHT]         = { "facron_commands_in_flight", "Commands still running", "gauge" },
+    [FACRON_METRIC_PENDING]           = { "facron_commands_pending", "Commands waiting for a concurrency limit", "gauge" },
+    [FACRON_METRIC_MAX_IN_FLIGHT]     = { "facron_commands_in_flight_max", "Most commands running at once", "gauge" },
+    [FACRON_METRIC_MAX_READ_EVENTS]   = { "facron_read_events_max", "Most events brought by a single read", "gauge" },
+    [FACRON_METRIC_MAX_CANDIDATES]    = { "facron_candidate_rules_max", "Most rules examined for a single event", "gauge" },
+};
+
+typedef struct
+{
+    const char *name;
+    const char *help;
+    const char *label; /* for the stats */
+} FacronHistogramInfo;
+
+static const FacronHistogramInfo histograms_info[N_FACRON_HISTOGRAMS] = {
+    [FACRON_HISTOGRAM_EVENT_TO_SPAWN] = { "facron_event_to_spawn_seconds", "Time from the read of an event to the spawn of its command, for the commands run right away", "event to spawn latency" },
+    [FACRON_HISTOGRAM_DISPATCH]       = { "facron_dispatch_seconds", "Time spent dispatching an event, its commands included", "dispatch time" },
+    [FACRON_HISTOGRAM_SPAWN]          = { "facron_spawn_seconds", "Time spent spawning a command", "spawn time" },
+};
+
+typedef struct
+{
+    FacronMetrics *metrics;
+    int fd;
+    char *buf;
+    size_t len;
+    size_t offset;
+} FacronMetricsClient;
+
+struct FacronMetrics
+{
+    FacronConf *conf;
+    FacronLoop *loop;
+    atomic_ullong values[N_FACRON_METRICS];
+    FacronMetricsHistogram histograms[N_FACRON_HISTOGRAMS];
+    FacronHash *retired; /* path -> unsigned long long */
+    FacronHash *clients; /* fd -> FacronMetricsClient */
+    int listen_fd;
+    char *path;
+};
+
+void
+facron_metrics_add (FacronMetrics *metrics, FacronMetric metric, unsigned long long n)
+{
+    atomic_fetch_add_explicit (&metrics->values[metric], n, memory_order_relaxed);
+}
+
+void
+facron_metrics_set (FacronMetrics *metrics, FacronMetric metric, unsigned long long value)
+{
+    atomic_store_explicit (&metrics->values[metric], value, memory_order_relaxed);
+}
+
+static void
+facron_metrics_raise_value (atomic_ullong *current, unsigned long long value)
+{
+    unsigned long long seen = atomic_load_explicit (current, memory_order_relaxed);
+
+    while (value > seen && !atomic_compare_exchange_weak_explicit (current, &seen, value, memory_order_relaxed, memory_order_relaxed));
+}
+
+void
+facron_metrics_raise (FacronMetrics *metrics, FacronMetric metric, unsigned long long value)
+{
+    facron_metrics_raise_value (&metrics->values[metric], value);
+}
+
+unsigned long long
+facron_metrics_get (const FacronMetrics *metrics, FacronMetric metric)
+{
+    return atomic_load_explicit (&metrics->values[metric], memory_order_relaxed);
+}
+
+void
+facron_metrics_observe (FacronMetrics *metrics, FacronHistogram histogram, unsigned long long ns)
+{
+    FacronMetricsHistogram *h = &metrics->histograms[histogram];
+    unsigned int bucket = (ns) ? 64 - __builtin_clzll (ns) : 0;
+
+    atomic_fetch_add_explicit (&h->buckets[(bucket < N_BUCKETS) ? bucket : N_BUCKETS - 1], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit (&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit (&h->sum_ns, ns, memory_order_relaxed);
+    facron_metrics_raise_value (&h->max_ns, ns);
+}
+
+void
+facron_metrics_retire (FacronMetrics *metrics, const FacronConfGeneration *generation)
+{
+    size_t n_rules;
+    const FacronRule *const *rules = facron_conf_get_rules (generation, &n_rules);
+
+    for (size_t i = 0; i < n_rules; ++i)
+    {
+        unsigned long long n = facron_rule_get_n_matched (rules[i]);
+        const char *path = facron_rule_get_path (rules[i]);
+        size_t len = strlen (path);
+
+        if (!n)
+            continue;
+
+        unsigned long long *total = (unsigned long long *) facron_hash_lookup (metrics->retired, path, len);
+        if (!total)
+        {
+            total = (unsigned long long *) calloc (1, sizeof (unsigned long long));
+            facron_hash_insert (metrics->retired, path, len, total);
+        }
+        *total += n;
+    }
+}
+
+typedef void (*FacronMetricsRuleFunc) (const char *path, unsigned long long n_matched, void *user_data);
+
+typedef struct
+{
+    FacronHash *left; /* retired paths without a current rule */
+    FacronMetricsRuleFunc func;
+    void *user_data;
+} FacronMetricsRules;
+
+static void
+facron_metrics_copy_retired (const void *key, size_t key_len, void *value, void *user_data)
+{
+    facron_hash_insert ((FacronHash *) user_data, key, key_len, value);
+}
+
+static void
+facron_metrics_report_retired (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronMetricsRules *rules = (FacronMetricsRules *) user_data;
+    char *path = strndup ((const char *) key, key_len);
+
+    rules->func (path, *(unsigned long long *) value, rules->user_data);
+    free (path);
+}
+
+/* The current rules in file order, then the ones which went away */
+static void
+facron_metrics_foreach_rule (const FacronMetrics *metrics, FacronMetricsRuleFunc func, void *user_data)
+{
+    FacronMetricsRules rules = { facron_hash_new (), func, user_data };
+    FacronConfGeneration *generation = facron_conf_acquire (metrics->conf);
+    size_t n_rules;
+    const FacronRule *const *current = facron_conf_get_rules (generation, &n_rules);
+
+    facron_hash_foreach (metrics->retired, &facron_metrics_copy_retired, rules.left);
+    for (size_t i = 0; i < n_rules; ++i)
+    {
+        const char *path = facron_rule_get_path (current[i]);
+        unsigned long long *retired = (unsigned long long *) facron_hash_remove (rules.left, path, strlen (path));
+        func (path, facron_rule_get_n_matched (current[i]) + ((retired) ? *retired : 0), user_data);
+    }
+    facron_hash_foreach (rules.left, &facron_metrics_report_retired, &rules);
+
+    facron_conf_generation_unref (generation);
+    facron_hash_free (rules.left, NULL);
+}
+
+static void
+facron_metrics_render_rule (const char *path, unsigned long long n_matched, void *user_data)
+{
+    FILE *out = (FILE *) user_data;
+
+    fputs ("facron_rule_matched_events_total{path=\"", out);
+    for (const char *c = path; *c; ++c)
+    {
+        if (*c == '\\' || *c == '"')
+            fputc ('\\', out);
+        if (*c == '\n')
+            fputs ("\\n", out);
+        else
+            fputc (*c, out);
+    }
+    fprintf (out, "\"} %llu\n", n_matched);
+}
+
+static void
+facron_metrics_render (const FacronMetrics *metrics, FILE *out)
+{
+    for (int i = 0; i < N_FACRON_METRICS; ++i)
+    {
+        const FacronMetricsInfo *info = &metrics_info[i];
+        fprintf (out, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", info->name, info->help, info->name, info->type, info->name, metrics->values[i]);
+    }
+
+    for (int i = 0; i < N_FACRON_HISTOGRAMS; ++i)
+    {
+        const FacronHistogramInfo *info = &histograms_info[i];
+        const FacronMetricsHistogram *h = &metrics->histograms[i];
+        unsigned long long cumulated = 0;
+
+        fprintf (out, "# HELP %s %s\n# TYPE %s histogram\n", info->name, info->help, info->name);
+        for (int b = 0; b <= LAST_EXPORTED; ++b)
+        {
+            cumulated += h->buckets[b];
+            if (b >= FIRST_EXPORTED)
+                fprintf (out, "%s_bucket{le=\"%.9g\"} %llu\n", info->name, (double) (1ULL << b) / 1e9, cumulated);
+        }
+        fprintf (out, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9f\n%s_count %llu\n", info->name, h->count, info->name, h->sum_ns / 1e9, info->name, h->count);
+    }
+
+    fputs ("# HELP facron_rule_matched_events_total Events which ran a command of the rule of a path\n"
+           "# TYPE facron_rule_matched_events_total counter\n", out);
+    facron_metrics_foreach_rule (metrics, &facron_metrics_render_rule, out);
+}
+
+static void
+facron_metrics_close_client (FacronMetricsClient *client)
+{
+    facron_loop_remove_fd (client->metrics->loop, client->fd);
+    close (client->fd);
+    facron_hash_remove (client->metrics->clients, &client->fd, sizeof (int));
+    free (client->buf);
+    free (client);
+}
+
+static void
+facron_metrics_write (int fd, unsigned int events, void *user_data)
+{
+    FacronMetricsClient *client = (FacronMetricsClient *) user_data;
+    (void) events;
+
+    while (client->offset < client->len)
+    {
+        ssize_t n = write (fd, client->buf + client->offset, client->len - client->offset);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN)
+            return;
+        if (n <= 0)
+            break;
+        client->offset += n;
+    }
+
+    facron_metrics_close_client (client);
+}
+
+static void
+facron_metrics_read (int fd, unsigned int events, void *user_data)
+{
+    FacronMetricsClient *client = (FacronMetricsClient *) user_data;
+    char request[4096];
+    ssize_t n = read (fd, request, sizeof (request));
+    (void) events;
+
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0)
+    {
+        facron_metrics_close_client (client);
+        return;
+    }
+
+    char *body;
+    size_t body_len;
+    FILE *out = open_memstream (&body, &body_len);
+    facron_metrics_render (client->metrics, out);
+    fclose (out);
+
+    if (n > 4 && !memcmp (request, "GET ", 4))
+    {
+        out = open_memstream (&client->buf, &client->len);
+        fprintf (out, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+        fwrite (body, 1, body_len, out);
+        fclose (out);
+        free (body);
+    }
+    else
+    {
+        client->buf = body;
+        client->len = body_len;
+    }
+
+    facron_loop_remove_fd (client->metrics->loop, fd);
+    if (!facron_loop_add_fd (client->metrics->loop, fd, EPOLLOUT, &facron_metrics_write, client))
+        facron_metrics_close_client (client);
+}
+
+static void
+facron_metrics_accept (int fd, unsigned int events, void *user_data)
+{
+    FacronMetrics *metrics = (FacronMetrics *) user_data;
+    int client_fd;
+    (void) events;
+
+    while ((client_fd = accept4 (fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC)) >= 0)
+    {
+        FacronMetricsClient *client = (FacronMetricsClient *) calloc (1, sizeof (FacronMetricsClient));
+
+        client->metrics = metrics;
+        client->fd = client_fd;
+        if (!facron_loop_add_fd (metrics->loop, client_fd, EPOLLIN, &facron_metrics_read, client))
+        {
+            close (client_fd);
+            free (client);
+            continue;
+        }
+        facron_hash_insert (metrics->clients, &client_fd, sizeof (int), client);
+    }
+}
+
+bool
+facron_metrics_listen (FacronMetrics *metrics, FacronLoop *loop, const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct stat st;
+
+    if (strlen (path) >= sizeof (addr.sun_path))
+    {
+        fprintf (stderr, "Error: the metrics socket path \"%s\" is too long\n", path);
+        return false;
+    }
+    strcpy (addr.sun_path, path);
+
+    /* the socket of a previous run */
+    if (!lstat (path, &st) && S_ISSOCK (st.st_mode))
+        unlink (path);
+
+    int fd = socket (AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0 || listen (fd, SOMAXCONN) < 0)
+    {
+        fprintf (stderr, "Error: could not serve the metrics on \"%s\": %s\n", path, strerror (errno));
+        if (fd >= 0)
+            close (fd);
+        return false;
+    }
+    if (!facron_loop_add_fd (loop, fd, EPOLLIN, &facron_metrics_accept, metrics))
+    {
+        close (fd);
+        unlink (path);
+        return false;
+    }
+
+    metrics->loop = loop;
+    metrics->listen_fd = fd;
+    metrics->path = strdup (path);
+    fprintf (stderr, "Notice: serving the metrics on \"%s\"\n", path);
+
+    return true;
+}
+
+typedef struct
+{
+    const char *path;
+    unsigned long long n_matched;
+} FacronMetricsTopRule;
+
+static void
+facron_metrics_rank_rule (const char *path, unsigned long long n_matched, void *user_data)
+{
+    FacronMetricsTopRule *top = (FacronMetricsTopRule *) user_data;
+    size_t i = TOP_RULES;
+
+    while (i && n_matched > top[i - 1].n_matched)
+        --i;
+    if (i == TOP_RULES)
+        return;
+
+    free ((char *) top[TOP_RULES - 1].path);
+    memmove (top + i + 1, top + i, (TOP_RULES - 1 - i) * sizeof (FacronMetricsTopRule));
+    top[i] = (FacronMetricsTopRule) { strdup (path), n_matched };
+}
+
+/* The upper bound of the bucket holding the given fraction of the samples */
+static unsigned long long
+facron_metrics_quantile (const FacronMetricsHistogram *h, double q)
+{
+    unsigned long long cumulated = 0;
+
+    for (int b = 0; b < N_BUCKETS; ++b)
+    {
+        cumulated += h->buckets[b];
+        if (cumulated >= q * h->count)
+            return ((1ULL << b) < h->max_ns) ? 1ULL << b : h->max_ns;
+    }
+    return h->max_ns;
+}
+
+void
+facron_metrics_dump_stats (const FacronMetrics *metrics)
+{
+    for (int i = 0; i < N_FACRON_HISTOGRAMS; ++i)
+    {
+        const FacronMetricsHistogram *h = &metrics->histograms[i];
+
+        fprintf (stderr, "Notice: %s over %llu samples: %.1fus average, %.1fus p50, %.1fus p99, %.1fus max\n",
+                 histograms_info[i].label,
+                 h->count,
+                 h->count ? h->sum_ns / 1000.0 / h->count : 0.0,
+                 facron_metrics_quantile (h, 0.5) / 1000.0,
+                 facron_metrics_quantile (h, 0.99) / 1000.0,
+                 h->max_ns / 1000.0);
+    }
+
+    FacronMetricsTopRule top[TOP_RULES] = { { NULL, 0 } };
+    facron_metrics_foreach_rule (metrics, &facron_metrics_rank_rule, top);
+    for (size_t i = 0; i < TOP_RULES && top[i].path; ++i)
+    {
+        fprintf (stderr, "Notice: rule \"%s\" matched %llu events\n", top[i].path, top[i].n_matched);
+        free ((char *) top[i].path);
+    }
+}
+
+static void
+facron_metrics_free_client (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronMetricsClient *client = (FacronMetricsClient *) value;
+    (void) key;
+    (void) key_len;
+    (void) user_data;
+
+    facron_loop_remove_fd (client->metrics->loop, client->fd);
+    close (client->fd);
+    free (client->buf);
+    free (client);
+}
+
+void
+facron_metrics_free (FacronMetrics *metrics)
+{
+    facron_hash_foreach (metrics->clients, &facron_metrics_free_client, NULL);
+    facron_hash_free (metrics->clients, NULL);
+    if (metrics->listen_fd >= 0)
+    {
+        facron_loop_remove_fd (metrics->loop, metrics->listen_fd);
+        close (metrics->listen_fd);
+        unlink (metrics->path);
+    }
+    free (metrics->path);
+    facron_hash_free (metrics->retired, &free);
+    free (metrics);
+}
+
+FacronMetrics *
+facron_metrics_new (FacronConf *conf)
+{
+    FacronMetrics *metrics = (FacronMetrics *) calloc (1, sizeof (FacronMetrics));
+
+    metrics->conf = conf;
+    metrics->retired = facron_hash_new ();
+    metrics->clients = facron_hash_new ();
+    metrics->listen_fd = -1;
+
+    return metrics;
+}
@@ -0,0 +1,91 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_METRICS_H__
+#define __FACRON_METRICS_H__
+
+#include "facron-conf.h"
+#include "facron-loop.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * The counters, gauges and latency histograms of the daemon, along with
+ * the number of events each rule matched. They are printed on SIGUSR2, and
+ * can be served in the Prometheus text format on a Unix socket.
+ */
+typedef struct FacronMetrics FacronMetrics;
+
+typedef enum
+{
+    /* counters */
+    FACRON_METRIC_READS,
+    FACRON_METRIC_FULL_READS, /* reads which may have been cut short by the buffer */
+    FACRON_METRIC_EVENTS_READ,
+    FACRON_METRIC_EVENTS_DISPATCHED,
+    FACRON_METRIC_DUPLICATES,
+    FACRON_METRIC_EXCLUDED,
+    FACRON_METRIC_CANDIDATES, /* rules examined while dispatching */
+    FACRON_METRIC_OVERFLOWS,
+    FACRON_METRIC_UNRESOLVED, /* events whose path could not be found */
+    FACRON_METRIC_SPAWNED,
+    FACRON_METRIC_SPAWN_FAILURES,
+    FACRON_METRIC_QUEUED, /* commands which had to wait for a limit */
+    FACRON_METRIC_DROPPED, /* commands dropped by a full queue */
+    FACRON_METRIC_COALESCED, /* commands merged into one waiting for the same path */
+    /* gauges */
+    FACRON_METRIC_IN_FLIGHT,
+    FACRON_METRIC_PENDING, /* commands waiting for a limit */
+    FACRON_METRIC_MAX_IN_FLIGHT,
+    FACRON_METRIC_MAX_READ_EVENTS,
+    FACRON_METRIC_MAX_CANDIDATES,
+    N_FACRON_METRICS
+} FacronMetric;
+
+typedef enum
+{
+    FACRON_HISTOGRAM_EVENT_TO_SPAWN, /* from the read of an event to the spawn of its command */
+    FACRON_HISTOGRAM_DISPATCH, /* of a single event, its commands included */
+    FACRON_HISTOGRAM_SPAWN, /* of posix_spawn alone */
+    N_FACRON_HISTOGRAMS
+} FacronHistogram;
+
+void               facron_metrics_add   (FacronMetrics *metrics, FacronMetric metric, unsigned long long n);
+void               facron_metrics_set   (FacronMetrics *metrics, FacronMetric metric, unsigned long long value);
+/* Keeps the largest value seen */
+void               facron_metrics_raise (FacronMetrics *metrics, FacronMetric metric, unsigned long long value);
+unsigned long long facron_metrics_get   (const FacronMetrics *metrics, FacronMetric metric);
+
+void facron_metrics_observe (FacronMetrics *metrics, FacronHistogram histogram, unsigned long long ns);
+
+/* Keeps the counts of the rules of a generation being replaced, so that they carry on over reloads */
+void facron_metrics_retire (FacronMetrics *metrics, const FacronConfGeneration *generation);
+
+/* Serves the metrics to whoever connects to path and sends a request, like an HTTP GET */
+bool facron_metrics_listen (FacronMetrics *metrics, FacronLoop *loop, const char *path);
+
+void facron_metrics_dump_stats (const FacronMetrics *metrics);
+
+void facron_metrics_free (FacronMetrics *metrics);
+
+/* The rules are the ones of the current generation of conf */
+FacronMetrics *facron_metrics_new (FacronConf *conf);
+
+#endif /* __FACRON_METRICS_H__ */
@@ -19,18 +19,216 @@
 
 #include "config.h"
 #include "facron-conf-entry.h"
+#include "facron-glob.h"
 #include "facron-lexer.h"
 #include "facron-parser.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <sys/fanotify.h>
+
 struct FacronParser
 {
     FacronLexer *lexer;
     FacronConfEntry *previous_entry;
+    bool check_paths;
+    /* scratch vectors reused from one line to the next */
+    unsigned long long *mask;
+    size_t mask_size;
+    char **command;
+    size_t command_size;
+    char **exclude;
+    size_t exclude_size;
+    size_t n_excludes;
 };
 
+static void *
+grow (void *vector, size_t *size, size_t needed, size_t elem_size)
+{
+    if (needed <= *size)
+        return vector;
+    *size = (*size) ? *size * 2 : 8;
+    return realloc (vector, *size * elem_size);
+}
+
+/* Only digits, strtoul would take a sign or spaces, and wrap a negative value */
+static bool
+parse_number (const char *value, unsigned long *v, char **end)
+{
+    if (*value < '0' || *value > '9')
+        return false;
+
+    errno = 0;
+    *v = strtoul (value, end, 10);
+    return errno != ERANGE && *v <= UINT_MAX;
+}
+
+static bool
+parse_duration (const char *value, unsigned int *ms)
+{
+    char *end;
+    unsigned long v;
+
+    if (!parse_number (value, &v, &end))
+        return false;
+    if (!strcmp (end, "s"))
+    {
+        if (v > UINT_MAX / 1000)
+            return false;
+        v *= 1000;
+    }
+    else if (*end && strcmp (end, "ms"))
+        return false;
+
+    *ms = v;
+    return true;
+}
+
+#define DEFAULT_BATCH_SIZE      1024
+#define DEFAULT_BATCH_WINDOW_MS 1000
+#define DEFAULT_QUEUE_SIZE      64
+
+static bool
+parse_count (const char *value, unsigned int *count)
+{
+    char *end;
+    unsigned long v;
+
+    if (!parse_number (value, &v, &end) || *end || !v)
+        return false;
+
+    *count = v;
+    return true;
+}
+
+static bool
+parse_options (FacronParser *parser, char *block, FacronConfOptions *options)
+{
+    char *saveptr = NULL;
+    bool overflow = false;
+
+    for (char *key = strtok_r (block, ",", &saveptr); key; key = strtok_r (NULL, ",", &saveptr))
+    {
+        char *value = strchr (key, '=');
+        if (value)
+            *value++ = '\0';
+
+        if (!strcmp (key, "debounce"))
+        {
+            if (!value || !parse_duration (value, &options->debounce_ms))
+            {
+                fprintf (stderr, "Error: invalid duration for option \"%s\"\n", key);
+                return false;
+            }
+        }
+        else if (!strcmp (key, "batch"))
+        {
+            if (!value || !parse_count (value, &options->batch_size))
+            {
+                fprintf (stderr, "Error: invalid count for option \"%s\"\n", key);
+                return false;
+            }
+        }
+        else if (!strcmp (key, "batch_window"))
+        {
+            if (!value || !parse_duration (value, &options->batch_window_ms) || !options->batch_window_ms)
+            {
+                fprintf (stderr, "Error: invalid duration for option \"%s\"\n", key);
+                return false;
+            }
+        }
+        else if (!strcmp (key, "max") || !strcmp (key, "queue"))
+        {
+            if (!value || !parse_count (value, (key[0] == 'm') ? &options->max_running : &options->queue_size))
+            {
+                fprintf (stderr, "Error: invalid count for option \"%s\"\n", key);
+                return false;
+            }
+        }
+        else if (!strcmp (key, "overflow"))
+        {
+            if (!value || !facron_conf_overflow_parse (value, &options->overflow))
+            {
+                fprintf (stderr, "Error: invalid policy for option \"%s\", expected drop_oldest, drop_newest or coalesce\n", key);
+                return false;
+            }
+            overflow = true;
+        }
+        else if (!strcmp (key, "exclude"))
+        {
+            if (!value || !*value)
+            {
+                fprintf (stderr, "Error: missing pattern for option \"%s\"\n", key);
+                return false;
+            }
+            parser->exclude = (char **) grow (parser->exclude, &parser->exclude_size, parser->n_excludes + 1, sizeof (char *));
+            parser->exclude[parser->n_excludes++] = strdup (value);
+        }
+        else if (!strcmp (key, "coprocess") || !strcmp (key, "nul") || !strcmp (key, "recursive"))
+        {
+            if (value)
+            {
+                fprintf (stderr, "Error: option \"%s\" takes no value\n", key);
+                return false;
+            }
+            if (key[0] == 'c')
+                options->coprocess = true;
+            else if (key[0] == 'n')
+                options->nul = true;
+            else
+                options->recursive = true;
+        }
+        else
+        {
+            fprintf (stderr, "Error: unknown option \"%s\"\n", key);
+            return false;
+        }
+    }
+
+    if (options->coprocess && (options->batch_size || options->batch_window_ms))
+    {
+        fprintf (stderr, "Error: options \"coprocess\" and \"batch\" cannot be used together\n");
+        return false;
+    }
+
+    if (!options->max_running && (options->queue_size || overflow))
+    {
+        fprintf (stderr, "Error: options \"queue\" and \"overflow\" need \"max\"\n");
+        return false;
+    }
+
+    if (options->max_running && options->coprocess)
+    {
+        fprintf (stderr, "Error: options \"coprocess\" and \"max\" cannot be used together\n");
+        return false;
+    }
+
+    if (options->max_running && !options->queue_size)
+        options->queue_size = DEFAULT_QUEUE_SIZE;
+
+    if (options->batch_size || options->batch_window_ms)
+    {
+        if (!options->batch_size)
+            options->batch_size = DEFAULT_BATCH_SIZE;
+        if (!options->batch_window_ms)
+            options->batch_window_ms = DEFAULT_BATCH_WINDOW_MS;
+    }
+
+    return true;
+}
+
+static void
+free_excludes (FacronParser *parser)
+{
+    for (size_t i = 0; i < parser->n_excludes; ++i)
+        free (parser->exclude[i]);
+    parser->n_excludes = 0;
+}
+
 FacronConfEntry *
 facron_parser_parse_entry (FacronParser *parser)
 {
@@ -42,11 +240,11 @@ facron_parser_parse_entry (FacronParser *parser)
 
     char *path = facron_lexer_read_string (parser->lexer);
 
-    if (access (path, R_OK))
+    /* patterns may match nothing yet */
+    if (parser->check_paths && !facron_glob_is_pattern (path) && access (path, R_OK))
     {
         fprintf (stderr, "warning: No such file or directory: \"%s\"\n", path);
-        free (path);
-        goto fail_early;
+        goto fail;
     }
 
     facron_lexer_skip_spaces (parser->lexer);
@@ -54,59 +252,100 @@ facron_parser_parse_entry (FacronParser *parser)
     if (facron_lexer_end_of_line (parser->lexer))
     {
         fprintf (stderr, "Error: no Fanotify mask has been specified.\n");
-        goto fail_early;
+        goto fail;
     }
 
-    FacronConfEntry *entry = facron_conf_entry_new (parser->previous_entry, path);
-
-    int n = 0;
+    size_t n_masks = 0;
+    unsigned long long current = 0;
     FacronResult result;
-    unsigned long long mask;
-    while (n < 511 && (result = facron_lexer_next_token (parser->lexer, &mask))) /* != S_END */
+    unsigned long long mask = 0;
+    while ((result = facron_lexer_next_token (parser->lexer, &mask))) /* != S_END */
     {
         switch (result)
         {
         case R_ERROR:
             goto fail;
         case R_COMMA:
-            entry->mask[n++] |= mask;
+            if (current | mask)
+            {
+                parser->mask = (unsigned long long *) grow (parser->mask, &parser->mask_size, n_masks + 1, sizeof (unsigned long long));
+                parser->mask[n_masks++] = current | mask;
+            }
+            current = 0;
             break;
         case R_PIPE:
-            entry->mask[n] |= mask;
+            current |= mask;
             break;
         default:
             break;
         }
     }
-    entry->mask[n] |= mask;
+    if (current | mask)
+    {
+        parser->mask = (unsigned long long *) grow (parser->mask, &parser->mask_size, n_masks + 1, sizeof (unsigned long long));
+        parser->mask[n_masks++] = current | mask;
+    }
 
-    if (n == 0 && !entry->mask[n])
+    if (n_masks == 0)
     {
         fprintf (stderr, "Error: no Fanotify mask has been specified.\n");
         goto fail;
     }
 
-    n = 0;
+    FacronConfOptions options = { 0 };
+    char *block;
+    facron_lexer_skip_spaces (parser->lexer);
+    if (!facron_lexer_read_block (parser->lexer, '[', ']', &block))
+        goto fail;
+    if (block)
+    {
+        bool valid = parse_options (parser, block, &options);
+        free (block);
+        if (!valid)
+            goto fail;
+    }
+
+    if (options.recursive)
+    {
+        if (facron_glob_is_pattern (path))
+        {
+            fprintf (stderr, "Error: option \"recursive\" cannot be used with a wildcard path: \"%s\"\n", path);
+            goto fail;
+        }
+        /* a tree is only about the events of its children */
+        for (size_t i = 0; i < n_masks; ++i)
+            parser->mask[i] |= FAN_EVENT_ON_CHILD;
+    }
+
+    size_t argc = 0;
     facron_lexer_skip_spaces (parser->lexer);
-    while (!facron_lexer_end_of_line (parser->lexer) && n < 511)
+    while (!facron_lexer_end_of_line (parser->lexer))
     {
-        entry->command[n++] = facron_lexer_read_string (parser->lexer);
+        parser->command = (char **) grow (parser->command, &parser->command_size, argc + 1, sizeof (char *));
+        parser->command[argc++] = facron_lexer_read_string (parser->lexer);
         facron_lexer_skip_spaces (parser->lexer);
     }
 
-    if (n == 0)
+    if (argc == 0)
     {
-        fprintf (stderr, "Error: no command line specified for \"%s\"\n", entry->path);
+        fprintf (stderr, "Error: no command line specified for \"%s\"\n", path);
         goto fail;
     }
 
-    entry->command[n] = NULL;
+    FacronConfEntry *entry = facron_conf_entry_new (parser->previous_entry, path, parser->mask, n_masks,
+                                                    parser->command, argc, parser->exclude, parser->n_excludes, &options);
     parser->previous_entry = entry;
 
+    for (size_t i = 0; i < argc; ++i)
+        free (parser->command[i]);
+    free_excludes (parser);
+    free (path);
+
     return entry;
 
 fail:
-    facron_conf_entry_free (entry, false);
+    free_excludes (parser);
+    free (path);
 fail_early:
     return facron_parser_parse_entry (parser);
 }
@@ -122,16 +361,27 @@ void
 facron_parser_free (FacronParser *parser)
 {
     facron_lexer_free (parser->lexer);
+    free (parser->mask);
+    free (parser->command);
+    free (parser->exclude);
     free (parser);
 }
 
 FacronParser *
-facron_parser_new (void)
+facron_parser_new (const char *path, bool check_paths)
 {
     FacronParser *parser = (FacronParser *) malloc (sizeof (FacronParser));
 
-    parser->lexer = facron_lexer_new ();
+    parser->lexer = facron_lexer_new (path);
     parser->previous_entry = NULL;
+    parser->check_paths = check_paths;
+    parser->mask = NULL;
+    parser->mask_size = 0;
+    parser->command = NULL;
+    parser->command_size = 0;
+    parser->exclude = NULL;
+    parser->exclude_size = 0;
+    parser->n_excludes = 0;
 
     return parser;
 }
@@ -20,6 +20,7 @@
 #ifndef __FACRON_CONF_PARSER_H__
 #define __FACRON_CONF_PARSER_H__
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -31,6 +32,7 @@ bool facron_parser_reload (FacronParser *parser);
 
 void facron_parser_free (FacronParser *parser);
 
-FacronParser *facron_parser_new (void);
+/* check_paths drops the entries whose path cannot be read */
+FacronParser *facron_parser_new (const char *path, bool check_paths);
     
 #endif /* __FACRON_CONF_PARSER_H_ */
@@ -0,0 +1,448 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "facron-pipeline.h"
+#include "facron-hash.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <linux/limits.h>
+
+/*
+ * Each worker has two single producer single consumer rings: the events
+ * the loop pushes to it, and the actions it hands back to the loop. Both
+ * sides only ever wait when a ring is full, by running what the other side
+ * may be waiting for and yielding, or when a worker has nothing to do, in
+ * which case it sleeps on an eventfd the loop writes to when it kicks it.
+ */
+
+#define MAX_WORKERS 64
+#define RING_SIZE   256 /* a power of two */
+
+typedef struct
+{
+    FacronConfGeneration *generation; /* a reference handed over with the item */
+    const FacronConfEntry *entry; /* of a deferred action */
+    unsigned long long read_ns;
+    unsigned long long mask;
+    int pid;
+    size_t len;
+    char path[PATH_MAX];
+} FacronPipelineItem;
+
+typedef struct
+{
+    /* each index is only written by one side, on its own cache line */
+    _Alignas (64) atomic_size_t head; /* the next item to write */
+    _Alignas (64) atomic_size_t tail; /* the next item to read */
+    FacronPipelineItem *items;
+} FacronPipelineRing;
+
+typedef struct
+{
+    FacronPipeline *pipeline;
+    FacronDispatch *dispatch;
+    FacronPipelineRing in; /* loop -> worker */
+    FacronPipelineRing out; /* worker -> loop */
+    const FacronPipelineItem *current; /* being dispatched */
+    int wake_fd;
+    atomic_bool sleeping;
+    bool pushed; /* since the last kick, only used by the loop */
+    bool deferred; /* since the loop was last notified, only used by the worker */
+    atomic_ullong n_events;
+    pthread_t thread;
+    bool running;
+} FacronPipelineWorker;
+
+struct FacronPipeline
+{
+    FacronLoop *loop;
+    FacronPipelineFunc func;
+    FacronDispatchFunc deferred;
+    void *user_data;
+    FacronPipelineWorker *workers;
+    unsigned int n_workers;
+    int notify_fd; /* workers -> loop */
+    atomic_size_t pending; /* events pushed but not dispatched yet */
+    atomic_bool quit;
+    atomic_ullong n_deferred;
+    unsigned long long stalls; /* pushes which found a full ring */
+};
+
+static FacronPipelineItem *
+facron_pipeline_ring_reserve (FacronPipelineRing *ring)
+{
+    size_t head = atomic_load_explicit (&ring->head, memory_order_relaxed);
+
+    if (head - atomic_load_explicit (&ring->tail, memory_order_acquire) == RING_SIZE)
+        return NULL;
+    return &ring->items[head & (RING_SIZE - 1)];
+}
+
+static void
+facron_pipeline_ring_publish (FacronPipelineRing *ring)
+{
+    atomic_store_explicit (&ring->head, atomic_load_explicit (&ring->head, memory_order_relaxed) + 1, memory_order_release);
+}
+
+static FacronPipelineItem *
+facron_pipeline_ring_peek (FacronPipelineRing *ring)
+{
+    size_t tail = atomic_load_explicit (&ring->tail, memory_order_relaxed);
+
+    if (tail == atomic_load_explicit (&ring->head, memory_order_acquire))
+        return NULL;
+    return &ring->items[tail & (RING_SIZE - 1)];
+}
+
+static void
+facron_pipeline_ring_consume (FacronPipelineRing *ring)
+{
+    atomic_store_explicit (&ring->tail, atomic_load_explicit (&ring->tail, memory_order_relaxed) + 1, memory_order_release);
+}
+
+static void
+facron_pipeline_signal (int fd)
+{
+    uint64_t one = 1;
+
+    if (write (fd, &one, sizeof (one)) < 0 && errno != EAGAIN)
+        fprintf (stderr, "Error: could not wake the pipeline up: %s\n", strerror (errno));
+}
+
+static void
+facron_pipeline_fill (FacronPipelineItem *item, FacronConfGeneration *generation, const FacronConfEntry *entry,
+                      const FacronEvent *event, unsigned long long read_ns)
+{
+    item->generation = facron_conf_generation_ref (generation);
+    item->entry = entry;
+    item->read_ns = read_ns;
+    item->mask = event->mask;
+    item->pid = event->pid;
+    item->len = event->len;
+    memcpy (item->path, event->path, event->len);
+    item->path[event->len] = '\0';
+}
+
+/* Called on the worker for each action of the event it dispatches */
+static void
+facron_pipeline_action (const FacronConfEntry *entry, const FacronEvent *event, void *user_data)
+{
+    FacronPipelineWorker *worker = (FacronPipelineWorker *) user_data;
+    FacronPipeline *pipeline = worker->pipeline;
+    FacronPipelineItem *item;
+
+    if (pipeline->func (entry, event, worker->current->read_ns, pipeline->user_data))
+        return;
+
+    while (!(item = facron_pipeline_ring_reserve (&worker->out)))
+    {
+        facron_pipeline_signal (pipeline->notify_fd);
+        sched_yield ();
+    }
+    facron_pipeline_fill (item, worker->current->generation, entry, event, worker->current->read_ns);
+    facron_pipeline_ring_publish (&worker->out);
+    atomic_fetch_add_explicit (&pipeline->n_deferred, 1, memory_order_relaxed);
+    worker->deferred = true;
+}
+
+static void *
+facron_pipeline_thread (void *user_data)
+{
+    FacronPipelineWorker *worker = (FacronPipelineWorker *) user_data;
+    FacronPipeline *pipeline = worker->pipeline;
+    uint64_t n;
+
+    for (;;)
+    {
+        const FacronPipelineItem *item;
+
+        while ((item = facron_pipeline_ring_peek (&worker->in)))
+        {
+            FacronEvent event = { item->mask, item->pid, item->path, item->len };
+
+            worker->current = item;
+            facron_dispatch_event (worker->dispatch, item->generation, &event);
+            facron_conf_generation_unref (item->generation);
+            facron_pipeline_ring_consume (&worker->in);
+            atomic_fetch_add_explicit (&worker->n_events, 1, memory_order_relaxed);
+            /* after its deferred actions were published */
+            atomic_fetch_sub_explicit (&pipeline->pending, 1, memory_order_release);
+        }
+        if (worker->deferred)
+        {
+            worker->deferred = false;
+            facron_pipeline_signal (pipeline->notify_fd);
+        }
+        if (atomic_load (&pipeline->quit))
+            break;
+
+        /* the loop checks whether we sleep after it pushed, we check for a push after saying so */
+        atomic_store (&worker->sleeping, true);
+        atomic_thread_fence (memory_order_seq_cst);
+        if (facron_pipeline_ring_peek (&worker->in))
+        {
+            atomic_store (&worker->sleeping, false);
+            continue;
+        }
+        if (read (worker->wake_fd, &n, sizeof (n)) < 0 && errno != EINTR)
+            break;
+        atomic_store (&worker->sleeping, false);
+    }
+
+    return NULL;
+}
+
+static void
+facron_pipeline_wake (FacronPipelineWorker *worker)
+{
+    atomic_thread_fence (memory_order_seq_cst);
+    if (atomic_exchange (&worker->sleeping, false))
+        facron_pipeline_signal (worker->wake_fd);
+}
+
+/* Runs the actions the workers handed back, in order for each of them */
+static void
+facron_pipeline_run_deferred (FacronPipeline *pipeline)
+{
+    for (unsigned int i = 0; i < pipeline->n_workers; ++i)
+    {
+        FacronPipelineRing *ring = &pipeline->workers[i].out;
+        FacronPipelineItem *item;
+
+        while ((item = facron_pipeline_ring_peek (ring)))
+        {
+            FacronEvent event = { item->mask, item->pid, item->path, item->len };
+
+            pipeline->deferred (item->entry, &event, pipeline->user_data);
+            facron_conf_generation_unref (item->generation);
+            facron_pipeline_ring_consume (ring);
+        }
+    }
+}
+
+static void
+facron_pipeline_notified (int fd, unsigned int events, void *user_data)
+{
+    uint64_t n;
+    (void) events;
+
+    if (read (fd, &n, sizeof (n)) < 0 && errno != EAGAIN)
+        return;
+    facron_pipeline_run_deferred ((FacronPipeline *) user_data);
+}
+
+void
+facron_pipeline_push (FacronPipeline *pipeline, const FacronConfGeneration *generation, const FacronEvent *event, unsigned long long read_ns)
+{
+    FacronPipelineWorker *worker = &pipeline->workers[facron_hash_bytes (event->path, event->len) % pipeline->n_workers];
+    FacronPipelineItem *item;
+
+    if (!(item = facron_pipeline_ring_reserve (&worker->in)))
+        ++pipeline->stalls;
+    while (!item && !(item = facron_pipeline_ring_reserve (&worker->in)))
+    {
+        /* the worker may itself wait for us to run its deferred actions */
+        facron_pipeline_wake (worker);
+        facron_pipeline_run_deferred (pipeline);
+        sched_yield ();
+    }
+
+    facron_pipeline_fill (item, (FacronConfGeneration *) generation, NULL, event, read_ns);
+    atomic_fetch_add_explicit (&pipeline->pending, 1, memory_order_relaxed);
+    facron_pipeline_ring_publish (&worker->in);
+    worker->pushed = true;
+}
+
+void
+facron_pipeline_kick (FacronPipeline *pipeline)
+{
+    for (unsigned int i = 0; i < pipeline->n_workers; ++i)
+    {
+        FacronPipelineWorker *worker = &pipeline->workers[i];
+
+        if (!worker->pushed)
+            continue;
+        worker->pushed = false;
+        facron_pipeline_wake (worker);
+    }
+}
+
+void
+facron_pipeline_drain (FacronPipeline *pipeline)
+{
+    facron_pipeline_kick (pipeline);
+    while (atomic_load_explicit (&pipeline->pending, memory_order_acquire))
+    {
+        facron_pipeline_run_deferred (pipeline);
+        sched_yield ();
+    }
+    facron_pipeline_run_deferred (pipeline);
+}
+
+void
+facron_pipeline_dump_stats (const FacronPipeline *pipeline)
+{
+    unsigned long long total = 0;
+    unsigned long long min = ~0ULL;
+    unsigned long long max = 0;
+
+    for (unsigned int i = 0; i < pipeline->n_workers; ++i)
+    {
+        unsigned long long n = atomic_load_explicit (&pipeline->workers[i].n_events, memory_order_relaxed);
+
+        total += n;
+        min = (n < min) ? n : min;
+        max = (n > max) ? n : max;
+    }
+
+    fprintf (stderr, "Notice: %u workers dispatched %llu events (%llu to %llu each), %llu actions handed back to the loop, %llu pushes stalled on a full ring\n",
+             pipeline->n_workers,
+             total,
+             min,
+             max,
+             atomic_load_explicit (&pipeline->n_deferred, memory_order_relaxed),
+             pipeline->stalls);
+}
+
+void
+facron_pipeline_free (FacronPipeline *pipeline)
+{
+    if (pipeline->notify_fd >= 0)
+        facron_pipeline_drain (pipeline);
+
+    atomic_store (&pipeline->quit, true);
+    for (unsigned int i = 0; i < pipeline->n_workers; ++i)
+    {
+        FacronPipelineWorker *worker = &pipeline->workers[i];
+
+        if (worker->running)
+        {
+            facron_pipeline_signal (worker->wake_fd);
+            pthread_join (worker->thread, NULL);
+        }
+        if (worker->wake_fd >= 0)
+            close (worker->wake_fd);
+        if (worker->dispatch)
+            facron_dispatch_free (worker->dispatch);
+        free (worker->in.items);
+        free (worker->out.items);
+    }
+
+    if (pipeline->notify_fd >= 0)
+    {
+        facron_loop_remove_fd (pipeline->loop, pipeline->notify_fd);
+        close (pipeline->notify_fd);
+    }
+    free (pipeline->workers);
+    free (pipeline);
+}
+
+FacronPipeline *
+facron_pipeline_new (FacronLoop *loop, FacronMetrics *metrics, unsigned int n_workers,
+                     FacronPipelineFunc func, FacronDispatchFunc deferred, void *user_data)
+{
+    FacronPipeline *pipeline = (FacronPipeline *) calloc (1, sizeof (FacronPipeline));
+    sigset_t all, old;
+
+    if (!n_workers)
+    {
+        long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+        n_workers = (n_cpus > 0) ? (unsigned int) n_cpus : 1;
+    }
+    if (n_workers > MAX_WORKERS)
+        n_workers = MAX_WORKERS;
+
+    pipeline->loop = loop;
+    pipeline->func = func;
+    pipeline->deferred = deferred;
+    pipeline->user_data = user_data;
+    pipeline->workers = (FacronPipelineWorker *) calloc (n_workers, sizeof (FacronPipelineWorker));
+    pipeline->n_workers = n_workers;
+    pipeline->notify_fd = eventfd (0, EFD_CLOEXEC|EFD_NONBLOCK);
+    atomic_init (&pipeline->pending, 0);
+    atomic_init (&pipeline->quit, false);
+    atomic_init (&pipeline->n_deferred, 0);
+
+    if (pipeline->notify_fd < 0 ||
+        !facron_loop_add_fd (loop, pipeline->notify_fd, EPOLLIN, &facron_pipeline_notified, pipeline))
+    {
+        fprintf (stderr, "Error: could not set up the pipeline\n");
+        if (pipeline->notify_fd >= 0)
+            close (pipeline->notify_fd);
+        pipeline->notify_fd = -1;
+        pipeline->n_workers = 0;
+        facron_pipeline_free (pipeline);
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < n_workers; ++i)
+        pipeline->workers[i].wake_fd = -1;
+
+    /* signals are for the main thread */
+    sigfillset (&all);
+    pthread_sigmask (SIG_SETMASK, &all, &old);
+    for (unsigned int i = 0; i < n_workers; ++i)
+    {
+        FacronPipelineWorker *worker = &pipeline->workers[i];
+
+        worker->pipeline = pipeline;
+        worker->dispatch = facron_dispatch_new (metrics, NULL, &facron_pipeline_action, worker);
+        worker->in.items = (FacronPipelineItem *) malloc (RING_SIZE * sizeof (FacronPipelineItem));
+        worker->out.items = (FacronPipelineItem *) malloc (RING_SIZE * sizeof (FacronPipelineItem));
+        atomic_init (&worker->in.head, 0);
+        atomic_init (&worker->in.tail, 0);
+        atomic_init (&worker->out.head, 0);
+        atomic_init (&worker->out.tail, 0);
+        atomic_init (&worker->sleeping, false);
+        atomic_init (&worker->n_events, 0);
+        worker->wake_fd = eventfd (0, EFD_CLOEXEC);
+        /* the workers get a reference to the generation with each event, they must never acquire one */
+        worker->running = worker->wake_fd >= 0 && !pthread_create (&worker->thread, NULL, &facron_pipeline_thread, worker);
+        if (!worker->running)
+            break;
+    }
+    pthread_sigmask (SIG_SETMASK, &old, NULL);
+
+    for (unsigned int i = 0; i < n_workers; ++i)
+    {
+        if (!pipeline->workers[i].running)
+        {
+            fprintf (stderr, "Error: could not start the pipeline workers\n");
+            facron_pipeline_free (pipeline);
+            return NULL;
+        }
+    }
+
+    fprintf (stderr, "Notice: dispatching the events on %u workers\n", n_workers);
+    return pipeline;
+}
@@ -0,0 +1,57 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_PIPELINE_H__
+#define __FACRON_PIPELINE_H__
+
+#include "facron-dispatch.h"
+#include "facron-loop.h"
+#include "facron-metrics.h"
+
+#include <stdbool.h>
+
+/*
+ * Spreads the dispatch of the events over worker threads. The loop thread
+ * pushes each event to the worker its path hashes to, so that the events of
+ * a path keep their order, and the worker matches it against the generation
+ * it was read with. The actions are run from the workers when func allows
+ * it, the others are handed back to the loop thread and run by deferred, in
+ * the order they were matched in.
+ */
+typedef struct FacronPipeline FacronPipeline;
+
+/* Called from a worker, false hands the action back to the loop */
+typedef bool (*FacronPipelineFunc) (const FacronConfEntry *entry, const FacronEvent *event, unsigned long long read_ns, void *user_data);
+
+/* read_ns is the time the event was read at, the generation is kept alive until the event is dispatched */
+void facron_pipeline_push  (FacronPipeline *pipeline, const FacronConfGeneration *generation, const FacronEvent *event, unsigned long long read_ns);
+/* Wakes the workers up for the events pushed since the last kick */
+void facron_pipeline_kick  (FacronPipeline *pipeline);
+/* Waits for every pushed event to be dispatched, and their deferred actions run */
+void facron_pipeline_drain (FacronPipeline *pipeline);
+
+void facron_pipeline_dump_stats (const FacronPipeline *pipeline);
+
+void facron_pipeline_free (FacronPipeline *pipeline);
+
+/* n_workers 0 means one per CPU */
+FacronPipeline *facron_pipeline_new (FacronLoop *loop, FacronMetrics *metrics, unsigned int n_workers,
+                                     FacronPipelineFunc func, FacronDispatchFunc deferred, void *user_data);
+
+#endif /* __FACRON_PIPELINE_H__ */
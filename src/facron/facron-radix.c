@@ -0,0 +1,161 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "facron-radix.h"
+#include "facron-hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/limits.h>
+
+/*
+ * The tree is stored as a single hash table of edges, keyed by the parent
+ * node and the path component, so that walking down one level is a single
+ * lookup no matter how many children a directory has.
+ */
+
+typedef struct FacronRadixNode FacronRadixNode;
+
+struct FacronRadixNode
+{
+    void **values;
+    size_t n_values;
+};
+
+struct FacronRadix
+{
+    FacronRadixNode root;
+    FacronHash *edges;
+};
+
+typedef struct
+{
+    const FacronRadixNode *parent;
+    char component[NAME_MAX + 1];
+} FacronRadixEdge;
+
+static inline size_t
+facron_radix_edge (FacronRadixEdge *edge, const FacronRadixNode *parent, const char *component, size_t len)
+{
+    edge->parent = parent;
+    memcpy (edge->component, component, len);
+    return offsetof (FacronRadixEdge, component) + len;
+}
+
+static const char *
+next_component (const char *path, const char *end, size_t *len)
+{
+    while (path < end && *path == '/')
+        ++path;
+
+    const char *c = path;
+    while (c < end && *c != '/')
+        ++c;
+    *len = c - path;
+
+    return path;
+}
+
+void
+facron_radix_insert (FacronRadix *radix, const char *path, void *value)
+{
+    const char *end = path + strlen (path);
+    FacronRadixNode *node = &radix->root;
+    FacronRadixEdge edge;
+    size_t len;
+
+    for (const char *c = next_component (path, end, &len); len; c = next_component (c + len, end, &len))
+    {
+        if (len > NAME_MAX)
+            return;
+
+        size_t key_len = facron_radix_edge (&edge, node, c, len);
+        FacronRadixNode *child = (FacronRadixNode *) facron_hash_lookup (radix->edges, &edge, key_len);
+        if (!child)
+        {
+            child = (FacronRadixNode *) calloc (1, sizeof (FacronRadixNode));
+            facron_hash_insert (radix->edges, &edge, key_len, child);
+        }
+        node = child;
+    }
+
+    node->values = (void **) realloc (node->values, (node->n_values + 1) * sizeof (void *));
+    node->values[node->n_values++] = value;
+}
+
+size_t
+facron_radix_foreach_ancestor (const FacronRadix *radix, const char *path, size_t len, FacronRadixFunc func, void *user_data)
+{
+    const char *end = path + len;
+    size_t depth = 0;
+    size_t clen;
+
+    for (const char *c = next_component (path, end, &clen); clen; c = next_component (c + clen, end, &clen))
+        ++depth;
+
+    const FacronRadixNode *node = &radix->root;
+    FacronRadixEdge edge;
+    size_t visited = 0;
+
+    for (const char *c = next_component (path, end, &clen); depth > 0; c = next_component (c + clen, end, &clen), --depth)
+    {
+        for (size_t i = 0; i < node->n_values; ++i)
+            func (node->values[i], depth, user_data);
+        visited += node->n_values;
+
+        if (clen > NAME_MAX)
+            break;
+
+        node = (const FacronRadixNode *) facron_hash_lookup (radix->edges, &edge, facron_radix_edge (&edge, node, c, clen));
+        if (!node)
+            break;
+    }
+
+    return visited;
+}
+
+static void
+facron_radix_node_free (void *data)
+{
+    FacronRadixNode *node = (FacronRadixNode *) data;
+
+    free (node->values);
+    free (node);
+}
+
+void
+facron_radix_free (FacronRadix *radix)
+{
+    facron_hash_free (radix->edges, &facron_radix_node_free);
+    free (radix->root.values);
+    free (radix);
+}
+
+FacronRadix *
+facron_radix_new (void)
+{
+    FacronRadix *radix = (FacronRadix *) malloc (sizeof (FacronRadix));
+
+    radix->root.values = NULL;
+    radix->root.n_values = 0;
+    radix->edges = facron_hash_new ();
+
+    return radix;
+}
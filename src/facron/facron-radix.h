@@ -0,0 +1,38 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_RADIX_H__
+#define __FACRON_RADIX_H__
+
+#include <stddef.h>
+
+typedef struct FacronRadix FacronRadix;
+
+/* distance is the number of path components between the ancestor and the looked up path, 1 being its parent */
+typedef void (*FacronRadixFunc) (void *value, size_t distance, void *user_data);
+
+void facron_radix_insert (FacronRadix *radix, const char *path, void *value);
+
+size_t facron_radix_foreach_ancestor (const FacronRadix *radix, const char *path, size_t len, FacronRadixFunc func, void *user_data);
+
+void facron_radix_free (FacronRadix *radix);
+
+FacronRadix *facron_radix_new (void);
+
+#endif /* __FACRON_RADIX_H__ */
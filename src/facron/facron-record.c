@@ -0,0 +1,103 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "facron-loop.h"
+#include "facron-record.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct FacronRecord
+{
+    FILE *file;
+    char *path;
+    unsigned long long start;
+    unsigned long long n_events;
+    bool failed;
+};
+
+void
+facron_record_event (FacronRecord *record, unsigned long long read_ns, unsigned long long mask, int pid, const char *path, size_t len)
+{
+    char header[FACRON_RECORD_HEADER_LEN];
+    uint64_t ns = read_ns - record->start;
+    uint32_t mask32 = mask;
+    int32_t pid32 = pid;
+    uint16_t len16 = len;
+
+    if (record->failed)
+        return;
+
+    memcpy (header, &ns, sizeof (ns));
+    memcpy (header + 8, &mask32, sizeof (mask32));
+    memcpy (header + 12, &pid32, sizeof (pid32));
+    memcpy (header + 16, &len16, sizeof (len16));
+    fwrite (header, sizeof (header), 1, record->file);
+    fwrite (path, len, 1, record->file);
+    ++record->n_events;
+}
+
+void
+facron_record_flush (FacronRecord *record)
+{
+    if (record->failed || (!fflush (record->file) && !ferror (record->file)))
+        return;
+
+    /* a full disk must not take the daemon down */
+    fprintf (stderr, "Error: could not write to \"%s\", no longer recording: %s\n", record->path, strerror (errno));
+    record->failed = true;
+}
+
+void
+facron_record_free (FacronRecord *record)
+{
+    facron_record_flush (record);
+    fprintf (stderr, "Notice: %llu events recorded to \"%s\"\n", record->n_events, record->path);
+    fclose (record->file);
+    free (record->path);
+    free (record);
+}
+
+FacronRecord *
+facron_record_new (const char *path)
+{
+    FILE *file = fopen (path, "we");
+
+    if (!file || fwrite (FACRON_RECORD_MAGIC, FACRON_RECORD_MAGIC_LEN, 1, file) != 1)
+    {
+        fprintf (stderr, "Error: could not record the events to \"%s\": %s\n", path, strerror (errno));
+        if (file)
+            fclose (file);
+        return NULL;
+    }
+
+    FacronRecord *record = (FacronRecord *) malloc (sizeof (FacronRecord));
+
+    record->file = file;
+    record->path = strdup (path);
+    record->start = facron_loop_now ();
+    record->n_events = 0;
+    record->failed = false;
+
+    return record;
+}
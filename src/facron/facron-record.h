@@ -0,0 +1,52 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_RECORD_H__
+#define __FACRON_RECORD_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A log of the events facron resolved, to be replayed offline. It starts
+ * with FACRON_RECORD_MAGIC, then each event takes FACRON_RECORD_HEADER_LEN
+ * bytes in host byte order, followed by its path without a terminator:
+ *
+ *   uint64_t ns;   since the start of the recording, shared by the events of a read
+ *   uint32_t mask; the event bits, all of them fit in 32 bits
+ *   int32_t  pid;
+ *   uint16_t len;  of the path
+ */
+typedef struct FacronRecord FacronRecord;
+
+#define FACRON_RECORD_MAGIC      "FACRON\0\1"
+#define FACRON_RECORD_MAGIC_LEN  8
+#define FACRON_RECORD_HEADER_LEN 18
+
+/* read_ns is the time of the read, as given by facron_loop_now */
+void facron_record_event (FacronRecord *record, unsigned long long read_ns, unsigned long long mask, int pid, const char *path, size_t len);
+/* Writes the events recorded so far, once per read */
+void facron_record_flush (FacronRecord *record);
+
+void facron_record_free (FacronRecord *record);
+
+/* Truncates path */
+FacronRecord *facron_record_new (const char *path);
+
+#endif /* __FACRON_RECORD_H__ */
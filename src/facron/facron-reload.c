@@ -0,0 +1,159 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "facron-reload.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+struct FacronReload
+{
+    FacronLoop *loop;
+    FacronConf *conf;
+    FacronReloadPrepareFunc prepare;
+    FacronReloadFunc func;
+    void *user_data;
+    int request_fd; /* loop -> thread */
+    int done_fd; /* thread -> loop */
+    pthread_t thread;
+    bool running;
+    atomic_bool quit;
+};
+
+void
+facron_reload_request (FacronReload *reload)
+{
+    uint64_t one = 1;
+
+    if (write (reload->request_fd, &one, sizeof (one)) < 0)
+        return;
+}
+
+static void *
+facron_reload_thread (void *user_data)
+{
+    FacronReload *reload = (FacronReload *) user_data;
+    uint64_t n;
+
+    for (;;)
+    {
+        if (read (reload->request_fd, &n, sizeof (n)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (atomic_load (&reload->quit))
+            break;
+
+        FacronConfGeneration *generation = facron_conf_build (reload->conf);
+        if (!generation)
+            continue;
+        if (reload->prepare)
+            reload->prepare (generation, reload->user_data);
+
+        facron_conf_offer (reload->conf, generation);
+        n = 1;
+        if (write (reload->done_fd, &n, sizeof (n)) < 0)
+            fprintf (stderr, "Error: could not notify the new configuration\n");
+    }
+
+    return NULL;
+}
+
+static void
+facron_reload_done (int fd, unsigned int events, void *user_data)
+{
+    FacronReload *reload = (FacronReload *) user_data;
+    uint64_t n;
+    (void) events;
+
+    if (read (fd, &n, sizeof (n)) == sizeof (n))
+        reload->func (reload->user_data);
+}
+
+void
+facron_reload_free (FacronReload *reload)
+{
+    if (reload->running)
+    {
+        atomic_store (&reload->quit, true);
+        facron_reload_request (reload);
+        pthread_join (reload->thread, NULL);
+    }
+    if (reload->done_fd >= 0)
+    {
+        facron_loop_remove_fd (reload->loop, reload->done_fd);
+        close (reload->done_fd);
+    }
+    if (reload->request_fd >= 0)
+        close (reload->request_fd);
+    free (reload);
+}
+
+FacronReload *
+facron_reload_new (FacronLoop *loop, FacronConf *conf, FacronReloadPrepareFunc prepare, FacronReloadFunc func, void *user_data)
+{
+    FacronReload *reload = (FacronReload *) calloc (1, sizeof (FacronReload));
+    sigset_t all, old;
+
+    reload->loop = loop;
+    reload->conf = conf;
+    reload->prepare = prepare;
+    reload->func = func;
+    reload->user_data = user_data;
+    atomic_init (&reload->quit, false);
+    reload->request_fd = eventfd (0, EFD_CLOEXEC);
+    reload->done_fd = eventfd (0, EFD_CLOEXEC|EFD_NONBLOCK);
+
+    if (reload->request_fd < 0 || reload->done_fd < 0 ||
+        !facron_loop_add_fd (loop, reload->done_fd, EPOLLIN, &facron_reload_done, reload))
+    {
+        fprintf (stderr, "Error: could not set up the configuration reloader\n");
+        if (reload->done_fd >= 0)
+            close (reload->done_fd);
+        reload->done_fd = -1;
+        facron_reload_free (reload);
+        return NULL;
+    }
+
+    /* signals are for the main thread */
+    sigfillset (&all);
+    pthread_sigmask (SIG_SETMASK, &all, &old);
+    reload->running = !pthread_create (&reload->thread, NULL, &facron_reload_thread, reload);
+    pthread_sigmask (SIG_SETMASK, &old, NULL);
+
+    if (!reload->running)
+    {
+        fprintf (stderr, "Error: could not start the configuration reloader\n");
+        facron_reload_free (reload);
+        return NULL;
+    }
+
+    return reload;
+}
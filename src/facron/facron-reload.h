@@ -0,0 +1,46 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_RELOAD_H__
+#define __FACRON_RELOAD_H__
+
+#include "facron-conf.h"
+#include "facron-loop.h"
+
+/*
+ * Builds new configuration generations on a dedicated thread, so that the
+ * loop keeps dispatching events while a large configuration is parsed, and
+ * while whatever else the generation needs is prepared.
+ */
+typedef struct FacronReload FacronReload;
+
+/* Called from the loop once a new generation has been offered to the conf */
+typedef void (*FacronReloadFunc) (void *user_data);
+/* Called from the reload thread with each generation built, before it is offered */
+typedef void (*FacronReloadPrepareFunc) (FacronConfGeneration *generation, void *user_data);
+
+/* Async-signal-safe */
+void facron_reload_request (FacronReload *reload);
+
+void facron_reload_free (FacronReload *reload);
+
+/* prepare may be NULL */
+FacronReload *facron_reload_new (FacronLoop *loop, FacronConf *conf, FacronReloadPrepareFunc prepare, FacronReloadFunc func, void *user_data);
+
+#endif /* __FACRON_RELOAD_H__ */
@@ -0,0 +1,246 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "facron-record.h"
+#include "facron-replay.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/limits.h>
+
+/* Untimed, the loop gets a chance to run its other sources after that many reads */
+#define MAX_READS_PER_STEP 64
+
+typedef struct
+{
+    uint64_t ns;
+    uint32_t mask;
+    int32_t pid;
+    uint16_t len;
+} FacronReplayHeader;
+
+struct FacronReplay
+{
+    FacronLoop *loop;
+    FILE *file;
+    char *path;
+    bool timed;
+    FacronReplayFunc func;
+    FacronReplayDoneFunc done;
+    void *user_data;
+    FacronLoopTimer *timer;
+
+    FacronReplayHeader next;
+    bool has_next;
+    FacronEvent *events;
+    size_t events_size;
+    char *paths;
+    size_t paths_size;
+
+    unsigned long long start;
+    unsigned long long last_ns;
+    unsigned long long reads;
+    unsigned long long n_events;
+};
+
+/* 1 for a header, 0 at the end of the log, -1 when truncated */
+static int
+facron_replay_read_header (FacronReplay *replay)
+{
+    char buf[FACRON_RECORD_HEADER_LEN];
+    size_t n = fread (buf, 1, sizeof (buf), replay->file);
+
+    if (!n && feof (replay->file))
+        return 0;
+    if (n != sizeof (buf))
+        return -1;
+
+    memcpy (&replay->next.ns, buf, sizeof (replay->next.ns));
+    memcpy (&replay->next.mask, buf + 8, sizeof (replay->next.mask));
+    memcpy (&replay->next.pid, buf + 12, sizeof (replay->next.pid));
+    memcpy (&replay->next.len, buf + 16, sizeof (replay->next.len));
+    return 1;
+}
+
+/* Reads the events sharing the timestamp of the next one, -1 on a truncated or corrupted log */
+static ssize_t
+facron_replay_next_read (FacronReplay *replay)
+{
+    uint64_t ns = replay->next.ns;
+    size_t n = 0;
+    size_t paths_len = 0;
+
+    while (replay->has_next && replay->next.ns == ns)
+    {
+        const FacronReplayHeader *header = &replay->next;
+
+        /* no path facron resolves is that long */
+        if (header->len >= PATH_MAX)
+            return -1;
+        if (n == replay->events_size)
+        {
+            replay->events_size = (replay->events_size) ? replay->events_size * 2 : 256;
+            replay->events = (FacronEvent *) realloc (replay->events, replay->events_size * sizeof (FacronEvent));
+        }
+        if (paths_len + header->len + 1 > replay->paths_size)
+        {
+            while (paths_len + header->len + 1 > replay->paths_size)
+                replay->paths_size = (replay->paths_size) ? replay->paths_size * 2 : 65536;
+            replay->paths = (char *) realloc (replay->paths, replay->paths_size);
+        }
+
+        if (fread (replay->paths + paths_len, 1, header->len, replay->file) != header->len)
+            return -1;
+        replay->paths[paths_len + header->len] = '\0';
+        /* the paths may still move, they are pointed to once all read */
+        replay->events[n++] = (FacronEvent) { header->mask, header->pid, NULL, header->len };
+        paths_len += header->len + 1;
+
+        switch (facron_replay_read_header (replay))
+        {
+        case 0:
+            replay->has_next = false;
+            break;
+        case -1:
+            return -1;
+        }
+    }
+
+    paths_len = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        replay->events[i].path = replay->paths + paths_len;
+        paths_len += replay->events[i].len + 1;
+    }
+
+    replay->last_ns = ns;
+    ++replay->reads;
+    replay->n_events += n;
+    return n;
+}
+
+static void
+facron_replay_step (void *user_data)
+{
+    FacronReplay *replay = (FacronReplay *) user_data;
+
+    replay->timer = NULL;
+    if (!replay->start)
+        replay->start = facron_loop_now ();
+
+    for (unsigned int n_reads = 0; replay->has_next; ++n_reads)
+    {
+        unsigned long long elapsed = facron_loop_now () - replay->start;
+
+        if (replay->timed && replay->next.ns > elapsed)
+        {
+            replay->timer = facron_loop_add_timer (replay->loop, (replay->next.ns - elapsed + 999999) / 1000000, &facron_replay_step, replay);
+            return;
+        }
+        if (!replay->timed && n_reads == MAX_READS_PER_STEP)
+        {
+            replay->timer = facron_loop_add_timer (replay->loop, 0, &facron_replay_step, replay);
+            return;
+        }
+
+        ssize_t n = facron_replay_next_read (replay);
+        if (n < 0)
+        {
+            fprintf (stderr, "Error: \"%s\" is truncated or corrupted after %llu events\n", replay->path, replay->n_events);
+            replay->done (false, replay->user_data);
+            return;
+        }
+        replay->func (replay->events, n, replay->user_data);
+    }
+
+    replay->done (true, replay->user_data);
+}
+
+void
+facron_replay_dump_stats (const FacronReplay *replay)
+{
+    fprintf (stderr, "Notice: %llu events replayed in %llu reads over %.2fs, recorded over %.2fs\n",
+             replay->n_events,
+             replay->reads,
+             (replay->start) ? (facron_loop_now () - replay->start) / 1000000000.0 : 0.0,
+             replay->last_ns / 1000000000.0);
+}
+
+void
+facron_replay_free (FacronReplay *replay)
+{
+    if (replay->timer)
+        facron_loop_remove_timer (replay->loop, replay->timer);
+    fclose (replay->file);
+    free (replay->path);
+    free (replay->events);
+    free (replay->paths);
+    free (replay);
+}
+
+FacronReplay *
+facron_replay_new (FacronLoop *loop, const char *path, bool timed,
+                   FacronReplayFunc func, FacronReplayDoneFunc done, void *user_data)
+{
+    char magic[FACRON_RECORD_MAGIC_LEN];
+    FILE *file = fopen (path, "re");
+
+    if (!file)
+    {
+        fprintf (stderr, "Error: could not open \"%s\": %s\n", path, strerror (errno));
+        return NULL;
+    }
+    if (fread (magic, sizeof (magic), 1, file) != 1 || memcmp (magic, FACRON_RECORD_MAGIC, sizeof (magic)))
+    {
+        fprintf (stderr, "Error: \"%s\" is not a facron event log\n", path);
+        fclose (file);
+        return NULL;
+    }
+
+    FacronReplay *replay = (FacronReplay *) calloc (1, sizeof (FacronReplay));
+
+    replay->loop = loop;
+    replay->file = file;
+    replay->path = strdup (path);
+    replay->timed = timed;
+    replay->func = func;
+    replay->done = done;
+    replay->user_data = user_data;
+
+    switch (facron_replay_read_header (replay))
+    {
+    case 1:
+        replay->has_next = true;
+        break;
+    case -1:
+        fprintf (stderr, "Error: \"%s\" is truncated\n", path);
+        facron_replay_free (replay);
+        return NULL;
+    }
+
+    /* starts once the loop runs */
+    replay->timer = facron_loop_add_timer (loop, 0, &facron_replay_step, replay);
+
+    return replay;
+}
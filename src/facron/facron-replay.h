@@ -0,0 +1,47 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_REPLAY_H__
+#define __FACRON_REPLAY_H__
+
+#include "facron-dispatch.h"
+#include "facron-loop.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Reads back a log written by FacronRecord, handing its events over one
+ * recorded read at a time from the loop, either as fast as possible or
+ * with the pacing they were recorded with.
+ */
+typedef struct FacronReplay FacronReplay;
+
+typedef void (*FacronReplayFunc)     (const FacronEvent *events, size_t n_events, void *user_data);
+/* Called once the whole log has been replayed, or on a truncated or unreadable one */
+typedef void (*FacronReplayDoneFunc) (bool success, void *user_data);
+
+void facron_replay_dump_stats (const FacronReplay *replay);
+
+void facron_replay_free (FacronReplay *replay);
+
+FacronReplay *facron_replay_new (FacronLoop *loop, const char *path, bool timed,
+                                 FacronReplayFunc func, FacronReplayDoneFunc done, void *user_data);
+
+#endif /* __FACRON_REPLAY_H__ */
@@ -0,0 +1,340 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "facron-rescan.h"
+#include "facron-glob.h"
+#include "facron-hash.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+
+#include <linux/limits.h>
+
+/* Overflows are usually reported in bursts, a single rescan covers them */
+#define RESCAN_DELAY_MS 100
+
+/* The events after which the times of a path are worth refreshing */
+#define CHANGE_MASK (FAN_MODIFY|FAN_CLOSE_WRITE|FAN_ATTRIB|FAN_CREATE|FAN_MOVED_TO)
+/* What a change found by a rescan is reported as */
+#define SYNTHESIZED_MASK (FAN_MODIFY|FAN_CLOSE_WRITE)
+
+typedef struct
+{
+    struct timespec mtime;
+    struct timespec ctime;
+    unsigned int scan; /* the last scan that saw the path */
+    bool root; /* a watched path */
+    bool children; /* its direct children are tracked too */
+} FacronRescanStamp;
+
+struct FacronRescan
+{
+    FacronLoop *loop;
+    FacronHash *stamps;
+    char **roots;
+    size_t n_roots;
+    FacronLoopTimer *timer;
+    unsigned int scan;
+    FacronRescanFunc func;
+    void *user_data;
+
+    unsigned long long rescans;
+    unsigned long long synthesized;
+    size_t last_paths;
+    double last_ms;
+};
+
+static inline bool
+timespec_equal (const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/* Returns the stamp of path, which is added if new */
+static FacronRescanStamp *
+facron_rescan_stamp (FacronRescan *rescan, const char *path, size_t len, bool *added)
+{
+    FacronRescanStamp *stamp = (FacronRescanStamp *) facron_hash_lookup (rescan->stamps, path, len);
+
+    *added = !stamp;
+    if (!stamp)
+    {
+        stamp = (FacronRescanStamp *) calloc (1, sizeof (FacronRescanStamp));
+        facron_hash_insert (rescan->stamps, path, len, stamp);
+    }
+
+    return stamp;
+}
+
+static void
+facron_rescan_visit (FacronRescan *rescan, const char *path, size_t len, const struct stat *st, bool synthesize)
+{
+    bool added;
+    FacronRescanStamp *stamp = facron_rescan_stamp (rescan, path, len, &added);
+    bool changed = added || !timespec_equal (&stamp->mtime, &st->st_mtim) || !timespec_equal (&stamp->ctime, &st->st_ctim);
+
+    stamp->mtime = st->st_mtim;
+    stamp->ctime = st->st_ctim;
+    stamp->scan = rescan->scan;
+
+    /* what happened to a directory cannot be told from its times */
+    if (synthesize && changed && !S_ISDIR (st->st_mode))
+    {
+        ++rescan->synthesized;
+        rescan->func (path, len, SYNTHESIZED_MASK, rescan->user_data);
+    }
+}
+
+static size_t
+facron_rescan_children (FacronRescan *rescan, const char *root, bool synthesize)
+{
+    char path[PATH_MAX];
+    size_t root_len = strlen (root);
+    size_t n_paths = 0;
+    DIR *dir = opendir (root);
+    struct stat st;
+
+    if (!dir)
+        return 0;
+
+    memcpy (path, root, root_len);
+    if (root_len && path[root_len - 1] != '/')
+        path[root_len++] = '/';
+
+    for (struct dirent *child; (child = readdir (dir));)
+    {
+        size_t name_len = strlen (child->d_name);
+
+        if (!strcmp (child->d_name, ".") || !strcmp (child->d_name, ".."))
+            continue;
+        if (root_len + name_len >= PATH_MAX ||
+            fstatat (dirfd (dir), child->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                continue;
+
+        memcpy (path + root_len, child->d_name, name_len + 1);
+        facron_rescan_visit (rescan, path, root_len + name_len, &st, synthesize);
+        ++n_paths;
+    }
+
+    closedir (dir);
+    return n_paths;
+}
+
+static void
+prune_stamp (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronRescanStamp *stamp = (FacronRescanStamp *) value;
+    FacronRescan *rescan = (FacronRescan *) user_data;
+
+    if (stamp->root || stamp->scan == rescan->scan)
+        return;
+
+    facron_hash_remove (rescan->stamps, key, key_len);
+    free (stamp);
+}
+
+static void
+facron_rescan_run (FacronRescan *rescan, bool synthesize)
+{
+    unsigned long long start = facron_loop_now ();
+    size_t n_paths = 0;
+    struct stat st;
+
+    ++rescan->scan;
+    for (size_t i = 0; i < rescan->n_roots; ++i)
+    {
+        const char *root = rescan->roots[i];
+        size_t len = strlen (root);
+
+        if (stat (root, &st) < 0)
+            continue;
+
+        facron_rescan_visit (rescan, root, len, &st, synthesize);
+        ++n_paths;
+
+        FacronRescanStamp *stamp = (FacronRescanStamp *) facron_hash_lookup (rescan->stamps, root, len);
+        if (stamp->children && S_ISDIR (st.st_mode))
+            n_paths += facron_rescan_children (rescan, root, synthesize);
+    }
+
+    /* forget about the files which are gone */
+    facron_hash_foreach (rescan->stamps, &prune_stamp, rescan);
+
+    rescan->last_paths = n_paths;
+    rescan->last_ms = (facron_loop_now () - start) / 1000000.0;
+}
+
+static void
+unroot_stamp (const void *key, size_t key_len, void *value, void *user_data)
+{
+    FacronRescanStamp *stamp = (FacronRescanStamp *) value;
+    (void) key;
+    (void) key_len;
+    (void) user_data;
+
+    stamp->root = false;
+    stamp->children = false;
+}
+
+static void
+facron_rescan_clear_roots (FacronRescan *rescan)
+{
+    for (size_t i = 0; i < rescan->n_roots; ++i)
+        free (rescan->roots[i]);
+    free (rescan->roots);
+    rescan->roots = NULL;
+    rescan->n_roots = 0;
+}
+
+static void
+facron_rescan_add_root (FacronRescan *rescan, const char *path, bool children)
+{
+    bool added;
+    FacronRescanStamp *stamp = facron_rescan_stamp (rescan, path, strlen (path), &added);
+
+    /* the stamps of the paths known already are kept, so that a reload does not hide their changes */
+    if (!stamp->root)
+    {
+        rescan->roots = (char **) realloc (rescan->roots, (rescan->n_roots + 1) * sizeof (char *));
+        rescan->roots[rescan->n_roots++] = strdup (path);
+    }
+    stamp->root = true;
+    stamp->children |= children;
+}
+
+static void
+facron_rescan_add_dir (const char *dir, void *user_data)
+{
+    facron_rescan_add_root ((FacronRescan *) user_data, dir, true);
+}
+
+void
+facron_rescan_snapshot (FacronRescan *rescan, const FacronConfEntry *entries)
+{
+    facron_hash_foreach (rescan->stamps, &unroot_stamp, NULL);
+    facron_rescan_clear_roots (rescan);
+
+    for (const FacronConfEntry *entry = entries; entry; entry = entry->next)
+    {
+        bool children = false;
+
+        for (size_t i = 0; i < entry->n_masks; ++i)
+        {
+            if (entry->mask[i] & FAN_EVENT_ON_CHILD)
+                children = true;
+        }
+
+        /* the changes found in the directories a pattern may match in are filtered by the matcher */
+        if (entry->is_pattern)
+            facron_glob_expand (entry->path, children, &facron_rescan_add_dir, rescan);
+        else
+            facron_rescan_add_root (rescan, entry->path, children);
+    }
+
+    facron_rescan_run (rescan, false);
+}
+
+void
+facron_rescan_update (FacronRescan *rescan, const char *path, size_t len, unsigned long long mask)
+{
+    struct stat st;
+
+    if (!(mask & CHANGE_MASK))
+        return;
+
+    if (!facron_hash_lookup (rescan->stamps, path, len))
+    {
+        /* a new child of a directory watched with FAN_EVENT_ON_CHILD */
+        const char *slash = (const char *) memrchr (path, '/', len);
+        size_t parent_len = (slash == path) ? 1 : (size_t) (slash - path);
+        const FacronRescanStamp *parent = (slash) ? (const FacronRescanStamp *) facron_hash_lookup (rescan->stamps, path, parent_len) : NULL;
+
+        if (!parent || !parent->children)
+            return;
+    }
+
+    if (stat (path, &st) < 0)
+        return;
+
+    facron_rescan_visit (rescan, path, len, &st, false);
+}
+
+static void
+facron_rescan_timeout (void *user_data)
+{
+    FacronRescan *rescan = (FacronRescan *) user_data;
+    unsigned long long synthesized = rescan->synthesized;
+
+    rescan->timer = NULL;
+    ++rescan->rescans;
+    facron_rescan_run (rescan, true);
+
+    fprintf (stderr, "Notice: rescanned %zu paths after a queue overflow in %.2fms, %llu changed\n",
+             rescan->last_paths,
+             rescan->last_ms,
+             rescan->synthesized - synthesized);
+}
+
+void
+facron_rescan_schedule (FacronRescan *rescan)
+{
+    if (!rescan->timer)
+        rescan->timer = facron_loop_add_timer (rescan->loop, RESCAN_DELAY_MS, &facron_rescan_timeout, rescan);
+}
+
+void
+facron_rescan_dump_stats (const FacronRescan *rescan)
+{
+    fprintf (stderr, "Notice: %zu paths in the rescan snapshot, %llu rescans (last one of %zu paths in %.2fms), %llu events synthesized\n",
+             facron_hash_size (rescan->stamps),
+             rescan->rescans,
+             rescan->last_paths,
+             rescan->last_ms,
+             rescan->synthesized);
+}
+
+void
+facron_rescan_free (FacronRescan *rescan)
+{
+    if (rescan->timer)
+        facron_loop_remove_timer (rescan->loop, rescan->timer);
+    facron_rescan_clear_roots (rescan);
+    facron_hash_free (rescan->stamps, &free);
+    free (rescan);
+}
+
+FacronRescan *
+facron_rescan_new (FacronLoop *loop, FacronRescanFunc func, void *user_data)
+{
+    FacronRescan *rescan = (FacronRescan *) calloc (1, sizeof (FacronRescan));
+
+    rescan->loop = loop;
+    rescan->stamps = facron_hash_new ();
+    rescan->func = func;
+    rescan->user_data = user_data;
+
+    return rescan;
+}
@@ -0,0 +1,49 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_RESCAN_H__
+#define __FACRON_RESCAN_H__
+
+#include "facron-conf-entry.h"
+#include "facron-loop.h"
+
+/*
+ * Keeps the mtime and ctime of the watched paths, and of the direct children
+ * of the ones watched with FAN_EVENT_ON_CHILD. After a queue overflow, the
+ * paths are stat'ed again and an event is synthesized for each file whose
+ * times changed since it was last seen.
+ */
+typedef struct FacronRescan FacronRescan;
+
+typedef void (*FacronRescanFunc) (const char *path, size_t len, unsigned long long mask, void *user_data);
+
+/* Takes a new snapshot of the paths watched by entries */
+void facron_rescan_snapshot (FacronRescan *rescan, const FacronConfEntry *entries);
+/* Refreshes the snapshot of a path whose event has been handled */
+void facron_rescan_update   (FacronRescan *rescan, const char *path, size_t len, unsigned long long mask);
+/* Rescans shortly, once the queue had a chance to drain */
+void facron_rescan_schedule (FacronRescan *rescan);
+
+void facron_rescan_dump_stats (const FacronRescan *rescan);
+
+void facron_rescan_free (FacronRescan *rescan);
+
+FacronRescan *facron_rescan_new (FacronLoop *loop, FacronRescanFunc func, void *user_data);
+
+#endif /* __FACRON_RESCAN_H__ */
@@ -0,0 +1,236 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "facron-rule.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/fanotify.h>
+
+/*
+ * The event bits mentioned by the masks of the path are numbered, and an
+ * event mask is reduced to the index made of the ones it carries. Both
+ * tables hold the list of actions of each index, computed once, so that an
+ * event costs a few bit tests however many entries and masks the path has.
+ * The masks the parser accepts mention at most ten distinct bits.
+ */
+
+#define MAX_BITS 16
+
+typedef struct
+{
+    uint32_t offset; /* in rule->decided */
+    uint32_t n_actions;
+} FacronRuleDecision;
+
+struct FacronRule
+{
+    const char *path;
+    const FacronConfEntry **actions;
+    size_t n_actions;
+    unsigned long long bits[MAX_BITS];
+    size_t n_bits;
+    FacronRuleDecision *exact; /* 1 << n_bits decisions each */
+    FacronRuleDecision *children;
+    const FacronConfEntry **decided; /* the action lists of all the decisions */
+    size_t n_decided;
+    size_t decided_size;
+    bool watches_children;
+    /* statistics, the only thing that changes once the rule is compiled */
+    atomic_ullong n_matched;
+};
+
+static size_t
+facron_rule_index (const FacronRule *rule, unsigned long long mask)
+{
+    size_t index = 0;
+
+    for (size_t i = 0; i < rule->n_bits; ++i)
+    {
+        if (mask & rule->bits[i])
+            index |= (size_t) 1 << i;
+    }
+    return index;
+}
+
+/* Whether one of the masks of entry asks for an event carrying mask */
+static bool
+facron_rule_entry_matches (const FacronConfEntry *entry, unsigned long long mask, bool child)
+{
+    /* the marks of a tree report its directories to follow them, not for the entry's sake */
+    bool skip_dirs = child && entry->options.recursive && (mask & FAN_ONDIR);
+
+    for (size_t i = 0; i < entry->n_masks; ++i)
+    {
+        unsigned long long wanted = entry->mask[i] & ~FAN_EVENT_ON_CHILD;
+
+        if (!(entry->mask[i] & FAN_EVENT_ON_CHILD) != !child)
+            continue;
+        if ((wanted & mask) == wanted && !(skip_dirs && !(wanted & FAN_ONDIR)))
+            return true;
+    }
+    return false;
+}
+
+static FacronRuleDecision *
+facron_rule_build_table (FacronRule *rule, FacronConfEntry *const *members, const size_t *action_of, size_t n_members, bool child)
+{
+    size_t n_indexes = (size_t) 1 << rule->n_bits;
+    FacronRuleDecision *table = (FacronRuleDecision *) malloc (n_indexes * sizeof (FacronRuleDecision));
+    bool *hit = (bool *) malloc (rule->n_actions * sizeof (bool));
+
+    for (size_t index = 0; index < n_indexes; ++index)
+    {
+        unsigned long long mask = 0;
+        for (size_t i = 0; i < rule->n_bits; ++i)
+        {
+            if (index & ((size_t) 1 << i))
+                mask |= rule->bits[i];
+        }
+
+        /* an action shared by several entries, or matched by several masks, runs once */
+        memset (hit, 0, rule->n_actions * sizeof (bool));
+        for (size_t i = 0; i < n_members; ++i)
+        {
+            if (!hit[action_of[i]] && facron_rule_entry_matches (members[i], mask, child))
+                hit[action_of[i]] = true;
+        }
+
+        table[index].offset = rule->n_decided;
+        for (size_t a = 0; a < rule->n_actions; ++a)
+        {
+            if (!hit[a])
+                continue;
+            if (rule->n_decided == rule->decided_size)
+            {
+                rule->decided_size = (rule->decided_size) ? rule->decided_size * 2 : 16;
+                rule->decided = (const FacronConfEntry **) realloc (rule->decided, rule->decided_size * sizeof (FacronConfEntry *));
+            }
+            rule->decided[rule->n_decided++] = rule->actions[a];
+        }
+        table[index].n_actions = rule->n_decided - table[index].offset;
+    }
+
+    free (hit);
+    return table;
+}
+
+const FacronConfEntry *const *
+facron_rule_decide (const FacronRule *rule, unsigned long long mask, bool child, size_t *n_actions)
+{
+    const FacronRuleDecision *decision = &((child) ? rule->children : rule->exact)[facron_rule_index (rule, mask)];
+
+    *n_actions = decision->n_actions;
+    return rule->decided + decision->offset;
+}
+
+const FacronConfEntry *const *
+facron_rule_get_actions (const FacronRule *rule, size_t *n_actions)
+{
+    *n_actions = rule->n_actions;
+    return rule->actions;
+}
+
+const char *
+facron_rule_get_path (const FacronRule *rule)
+{
+    return rule->path;
+}
+
+bool
+facron_rule_watches_children (const FacronRule *rule)
+{
+    return rule->watches_children;
+}
+
+void
+facron_rule_count_match (const FacronRule *rule)
+{
+    atomic_fetch_add_explicit (&((FacronRule *) rule)->n_matched, 1, memory_order_relaxed);
+}
+
+unsigned long long
+facron_rule_get_n_matched (const FacronRule *rule)
+{
+    return atomic_load_explicit (&rule->n_matched, memory_order_relaxed);
+}
+
+void
+facron_rule_free (FacronRule *rule)
+{
+    free (rule->actions);
+    free (rule->exact);
+    free (rule->children);
+    free (rule->decided);
+    free (rule);
+}
+
+FacronRule *
+facron_rule_new (FacronConfEntry *entries)
+{
+    FacronRule *rule = (FacronRule *) calloc (1, sizeof (FacronRule));
+    unsigned long long bits = 0;
+    size_t n_members = 0;
+
+    for (const FacronConfEntry *entry = entries; entry; entry = entry->same_path)
+        ++n_members;
+
+    FacronConfEntry **members = (FacronConfEntry **) malloc (n_members * sizeof (FacronConfEntry *));
+    size_t *action_of = (size_t *) malloc (n_members * sizeof (size_t));
+
+    rule->path = entries->path;
+    rule->actions = (const FacronConfEntry **) malloc (n_members * sizeof (FacronConfEntry *));
+
+    size_t i = 0;
+    for (FacronConfEntry *entry = entries; entry; entry = entry->same_path, ++i)
+    {
+        size_t a = 0;
+        while (a < rule->n_actions && !facron_conf_entry_same_action (rule->actions[a], entry))
+            ++a;
+        if (a == rule->n_actions)
+            rule->actions[rule->n_actions++] = entry;
+        entry->is_duplicate = (rule->actions[a] != entry);
+        members[i] = entry;
+        action_of[i] = a;
+
+        for (size_t j = 0; j < entry->n_masks; ++j)
+        {
+            bits |= entry->mask[j] & ~FAN_EVENT_ON_CHILD;
+            if (entry->mask[j] & FAN_EVENT_ON_CHILD)
+                rule->watches_children = true;
+        }
+        if (entry->options.recursive)
+            bits |= FAN_ONDIR;
+    }
+
+    for (; bits && rule->n_bits < MAX_BITS; bits &= bits - 1)
+        rule->bits[rule->n_bits++] = bits & -bits;
+
+    rule->exact = facron_rule_build_table (rule, members, action_of, n_members, false);
+    rule->children = facron_rule_build_table (rule, members, action_of, n_members, true);
+
+    free (members);
+    free (action_of);
+
+    return rule;
+}
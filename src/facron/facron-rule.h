@@ -0,0 +1,56 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_RULE_H__
+#define __FACRON_RULE_H__
+
+#include "facron-conf-entry.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Everything the configuration does about one path, compiled from all the
+ * entries watching it: the distinct actions they run, and two decision
+ * tables giving, for any event mask, the actions to run for an event of the
+ * path itself and for an event of one of its children, each of them once.
+ */
+typedef struct FacronRule FacronRule;
+
+/* The actions mask runs, in file order */
+const FacronConfEntry *const *facron_rule_decide (const FacronRule *rule, unsigned long long mask, bool child, size_t *n_actions);
+const FacronConfEntry *const *facron_rule_get_actions (const FacronRule *rule, size_t *n_actions);
+
+const char *facron_rule_get_path        (const FacronRule *rule);
+bool        facron_rule_watches_children (const FacronRule *rule);
+
+/* Counts an event which ran some actions of the rule */
+void               facron_rule_count_match   (const FacronRule *rule);
+unsigned long long facron_rule_get_n_matched (const FacronRule *rule);
+
+void facron_rule_free (FacronRule *rule);
+
+/*
+ * entries is the first of the entries of a path, chained by same_path in
+ * file order. Entries running the same action as an earlier one are merged
+ * into it, and flagged as duplicates.
+ */
+FacronRule *facron_rule_new (FacronConfEntry *entries);
+
+#endif /* __FACRON_RULE_H__ */
@@ -0,0 +1,412 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "facron-uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/io_uring.h>
+
+#define RING_ENTRIES 256
+
+/* what a completion is about */
+#define READ_TAG   1
+#define CLOSE_TAG  2
+#define CANCEL_TAG 3
+
+/*
+ * The ring is driven with raw syscalls: a single read is kept in flight and
+ * re-armed from the loop, its completion being noticed through the ring fd.
+ * Multishot reads would need provided buffer rings, which are not worth it
+ * for a single fd whose buffer is processed before the next read anyway.
+ */
+
+struct FacronUring
+{
+    FacronLoop *loop;
+    int ring_fd;
+    int fd;
+    char *buf;
+    size_t size;
+    FacronUringReadFunc func;
+    void *user_data;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+
+    unsigned int queued; /* sqes not submitted yet */
+    bool reading;
+
+    unsigned long long reads;
+    unsigned long long closes;
+    unsigned long long enters;
+};
+
+static bool
+facron_uring_enter (FacronUring *uring, unsigned int min_complete)
+{
+    unsigned int flags = (min_complete) ? IORING_ENTER_GETEVENTS : 0;
+
+    do
+    {
+        int ret = syscall (__NR_io_uring_enter, uring->ring_fd, uring->queued, min_complete, flags, NULL, 0);
+
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf (stderr, "Error: could not submit to io_uring: %s\n", strerror (errno));
+            return false;
+        }
+        if (!ret && uring->queued)
+            return false;
+
+        ++uring->enters;
+        uring->queued -= ret;
+        min_complete = 0;
+        flags = 0;
+    } while (uring->queued);
+
+    return true;
+}
+
+static void facron_uring_reap (FacronUring *uring);
+
+static struct io_uring_sqe *
+facron_uring_get_sqe (FacronUring *uring)
+{
+    unsigned int tail = *uring->sq_tail;
+
+    if (tail - __atomic_load_n (uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries)
+    {
+        /* make room in both rings */
+        facron_uring_reap (uring);
+        if (!facron_uring_enter (uring, 0))
+            return NULL;
+    }
+
+    struct io_uring_sqe *sqe = &uring->sqes[tail & uring->sq_mask];
+    memset (sqe, 0, sizeof (struct io_uring_sqe));
+    return sqe;
+}
+
+static void
+facron_uring_queue (FacronUring *uring)
+{
+    unsigned int tail = *uring->sq_tail;
+
+    uring->sq_array[tail & uring->sq_mask] = tail & uring->sq_mask;
+    __atomic_store_n (uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++uring->queued;
+}
+
+static bool
+facron_uring_read (FacronUring *uring)
+{
+    struct io_uring_sqe *sqe = facron_uring_get_sqe (uring);
+
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = uring->fd;
+    sqe->addr = (unsigned long) uring->buf;
+    sqe->len = uring->size;
+    sqe->off = (unsigned long long) -1; /* not seekable */
+    sqe->user_data = READ_TAG;
+    facron_uring_queue (uring);
+    uring->reading = true;
+
+    return facron_uring_enter (uring, 0);
+}
+
+void
+facron_uring_close (FacronUring *uring, int fd)
+{
+    struct io_uring_sqe *sqe = facron_uring_get_sqe (uring);
+
+    if (!sqe)
+    {
+        close (fd);
+        return;
+    }
+
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = CLOSE_TAG;
+    facron_uring_queue (uring);
+    ++uring->closes;
+}
+
+/* Consumes the completions, the read one is returned through res */
+static bool
+facron_uring_reap_read (FacronUring *uring, int *res)
+{
+    bool read = false;
+
+    for (;;)
+    {
+        unsigned int head = *uring->cq_head;
+
+        if (head == __atomic_load_n (uring->cq_tail, __ATOMIC_ACQUIRE))
+            return read;
+
+        struct io_uring_cqe cqe = uring->cqes[head & uring->cq_mask];
+        __atomic_store_n (uring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        if (cqe.user_data == READ_TAG)
+        {
+            uring->reading = false;
+            *res = cqe.res;
+            read = true;
+        }
+    }
+}
+
+static void
+facron_uring_reap (FacronUring *uring)
+{
+    int res;
+
+    /* the read is re-armed only once its buffer has been processed, it cannot complete here */
+    facron_uring_reap_read (uring, &res);
+}
+
+static void
+facron_uring_ready (int fd, unsigned int events, void *user_data)
+{
+    FacronUring *uring = (FacronUring *) user_data;
+    int res;
+    (void) fd;
+    (void) events;
+
+    if (!facron_uring_reap_read (uring, &res))
+        return;
+
+    if (res != -EINTR && res != -EAGAIN)
+    {
+        ++uring->reads;
+        uring->func (uring->buf, (res < 0) ? -1 : res, uring->user_data);
+    }
+
+    /* the closes queued by func go along with the next read */
+    if (!facron_uring_read (uring))
+        uring->func (uring->buf, -1, uring->user_data);
+}
+
+void
+facron_uring_dump_stats (const FacronUring *uring)
+{
+    fprintf (stderr, "Notice: %llu reads and %llu closes through io_uring in %llu submissions\n",
+             uring->reads,
+             uring->closes,
+             uring->enters);
+}
+
+void
+facron_uring_free (FacronUring *uring)
+{
+    if (uring->ring_fd >= 0)
+    {
+        facron_loop_remove_fd (uring->loop, uring->ring_fd);
+
+        /* the buffer must not be written once we are gone */
+        struct io_uring_sqe *sqe = (uring->reading) ? facron_uring_get_sqe (uring) : NULL;
+        if (sqe)
+        {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = READ_TAG;
+            sqe->user_data = CANCEL_TAG;
+            facron_uring_queue (uring);
+            int res;
+            while (uring->reading && facron_uring_enter (uring, 1))
+                facron_uring_reap_read (uring, &res);
+        }
+
+        close (uring->ring_fd);
+    }
+    if (uring->sqes)
+        munmap (uring->sqes, uring->sqes_size);
+    if (uring->cq_ring && uring->cq_ring != uring->sq_ring)
+        munmap (uring->cq_ring, uring->cq_ring_size);
+    if (uring->sq_ring)
+        munmap (uring->sq_ring, uring->sq_ring_size);
+    free (uring);
+}
+
+static bool
+facron_uring_map (FacronUring *uring, const struct io_uring_params *params)
+{
+    uring->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof (unsigned int);
+    uring->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof (struct io_uring_cqe);
+    uring->sqes_size = params->sq_entries * sizeof (struct io_uring_sqe);
+
+    if (params->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (uring->cq_ring_size > uring->sq_ring_size)
+            uring->sq_ring_size = uring->cq_ring_size;
+        uring->cq_ring_size = uring->sq_ring_size;
+    }
+
+    uring->sq_ring = mmap (NULL, uring->sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, uring->ring_fd, IORING_OFF_SQ_RING);
+    if (uring->sq_ring == MAP_FAILED)
+    {
+        uring->sq_ring = NULL;
+        return false;
+    }
+
+    if (params->features & IORING_FEAT_SINGLE_MMAP)
+        uring->cq_ring = uring->sq_ring;
+    else
+    {
+        uring->cq_ring = mmap (NULL, uring->cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, uring->ring_fd, IORING_OFF_CQ_RING);
+        if (uring->cq_ring == MAP_FAILED)
+        {
+            uring->cq_ring = NULL;
+            return false;
+        }
+    }
+
+    uring->sqes = (struct io_uring_sqe *) mmap (NULL, uring->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, uring->ring_fd, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED)
+    {
+        uring->sqes = NULL;
+        return false;
+    }
+
+    char *sq = (char *) uring->sq_ring;
+    char *cq = (char *) uring->cq_ring;
+
+    uring->sq_head = (unsigned int *) (sq + params->sq_off.head);
+    uring->sq_tail = (unsigned int *) (sq + params->sq_off.tail);
+    uring->sq_mask = *(unsigned int *) (sq + params->sq_off.ring_mask);
+    uring->sq_entries = *(unsigned int *) (sq + params->sq_off.ring_entries);
+    uring->sq_array = (unsigned int *) (sq + params->sq_off.array);
+    uring->cq_head = (unsigned int *) (cq + params->cq_off.head);
+    uring->cq_tail = (unsigned int *) (cq + params->cq_off.tail);
+    uring->cq_mask = *(unsigned int *) (cq + params->cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *) (cq + params->cq_off.cqes);
+
+    return true;
+}
+
+FacronUring *
+facron_uring_new (FacronLoop *loop, int fd, char *buf, size_t size, FacronUringReadFunc func, void *user_data)
+{
+    FacronUring *uring = (FacronUring *) calloc (1, sizeof (FacronUring));
+    struct io_uring_params params;
+
+    uring->loop = loop;
+    uring->fd = fd;
+    uring->buf = buf;
+    uring->size = size;
+    uring->func = func;
+    uring->user_data = user_data;
+
+    memset (&params, 0, sizeof (params));
+    uring->ring_fd = syscall (__NR_io_uring_setup, RING_ENTRIES, &params);
+
+    if (uring->ring_fd < 0 || !facron_uring_map (uring, &params) ||
+        !facron_loop_add_fd (loop, uring->ring_fd, EPOLLIN, &facron_uring_ready, uring))
+    {
+        fprintf (stderr, "Notice: io_uring is not available, reading events with read ()\n");
+        if (uring->ring_fd >= 0)
+            close (uring->ring_fd);
+        uring->ring_fd = -1;
+        facron_uring_free (uring);
+        return NULL;
+    }
+
+    /* a non-blocking read would complete right away with -EAGAIN instead of waiting for events */
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) & ~O_NONBLOCK);
+
+    if (!facron_uring_read (uring))
+    {
+        fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+        facron_uring_free (uring);
+        return NULL;
+    }
+
+    fprintf (stderr, "Notice: reading events through io_uring\n");
+    return uring;
+}
+
+#else /* !HAVE_IO_URING */
+
+#include <unistd.h>
+
+void
+facron_uring_close (FacronUring *uring, int fd)
+{
+    (void) uring;
+    close (fd);
+}
+
+void
+facron_uring_dump_stats (const FacronUring *uring)
+{
+    (void) uring;
+}
+
+void
+facron_uring_free (FacronUring *uring)
+{
+    (void) uring;
+}
+
+FacronUring *
+facron_uring_new (FacronLoop *loop, int fd, char *buf, size_t size, FacronUringReadFunc func, void *user_data)
+{
+    (void) loop;
+    (void) fd;
+    (void) buf;
+    (void) size;
+    (void) func;
+    (void) user_data;
+    return NULL;
+}
+
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,47 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_URING_H__
+#define __FACRON_URING_H__
+
+#include "facron-loop.h"
+
+#include <stddef.h>
+
+#include <sys/types.h>
+
+/*
+ * Reads an fd through io_uring: each completed read is handed to func, and
+ * the closes queued meanwhile are submitted along with the next read.
+ */
+typedef struct FacronUring FacronUring;
+
+/* len is negative on error */
+typedef void (*FacronUringReadFunc) (char *buf, ssize_t len, void *user_data);
+
+void facron_uring_close (FacronUring *uring, int fd);
+
+void facron_uring_dump_stats (const FacronUring *uring);
+
+void facron_uring_free (FacronUring *uring);
+
+/* NULL if io_uring is not available, fd is switched to blocking mode otherwise */
+FacronUring *facron_uring_new (FacronLoop *loop, int fd, char *buf, size_t size, FacronUringReadFunc func, void *user_data);
+
+#endif /* __FACRON_URING_H__ */
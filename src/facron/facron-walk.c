@@ -0,0 +1,256 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "facron-walk.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <linux/limits.h>
+
+/*
+ * The directories left to read sit in a shared stack, which the threads
+ * pop one directory at a time. Each thread reads its directory without the
+ * lock, then pushes the subdirectories it found in a single go. The walk is
+ * over once the stack is empty and no thread is reading anymore.
+ *
+ * Paths are built by the threads and handed over to the caller once done,
+ * so that the callback never has to be thread safe.
+ */
+
+#define MAX_THREADS 16
+#define DENTS_SIZE  (32 * 1024)
+
+/* The records filled by getdents64, which the C library may not expose */
+typedef struct
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} FacronDirent;
+
+typedef struct
+{
+    char **dirs;
+    size_t n_dirs;
+    size_t size;
+} FacronWalkList;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    FacronWalkList pending;
+    size_t busy; /* threads reading a directory */
+    FacronWalkFilter filter;
+    void *user_data;
+} FacronWalk;
+
+typedef struct
+{
+    FacronWalk *walk;
+    FacronWalkList found;
+    FacronWalkList children; /* of the directory being read */
+    pthread_t thread;
+    bool running;
+} FacronWalker;
+
+static void
+facron_walk_list_push (FacronWalkList *list, char *dir)
+{
+    if (list->n_dirs == list->size)
+    {
+        list->size = (list->size) ? list->size * 2 : 64;
+        list->dirs = (char **) realloc (list->dirs, list->size * sizeof (char *));
+    }
+    list->dirs[list->n_dirs++] = dir;
+}
+
+static bool
+facron_walk_is_dir (int fd, const FacronDirent *dirent)
+{
+    struct stat st;
+
+    if (dirent->d_type != DT_UNKNOWN)
+        return dirent->d_type == DT_DIR;
+
+    /* some filesystems do not fill d_type */
+    return !fstatat (fd, dirent->d_name, &st, AT_SYMLINK_NOFOLLOW) && S_ISDIR (st.st_mode);
+}
+
+static inline bool
+facron_walk_is_dot (const char *name)
+{
+    return name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]));
+}
+
+/* Lists the subdirectories of dir into walker->children, false if dir could not be read */
+static bool
+facron_walk_read (FacronWalker *walker, const char *dir)
+{
+    const FacronWalk *walk = walker->walk;
+    char buf[DENTS_SIZE];
+    size_t len = strlen (dir);
+    size_t prefix_len = (len && dir[len - 1] == '/') ? len : len + 1;
+    int fd = openat (AT_FDCWD, dir, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+    ssize_t n;
+
+    if (fd < 0)
+        return false;
+
+    while ((n = syscall (SYS_getdents64, fd, buf, sizeof (buf))) > 0)
+    {
+        for (ssize_t offset = 0; offset < n;)
+        {
+            const FacronDirent *dirent = (const FacronDirent *) (buf + offset);
+            size_t name_len;
+
+            offset += dirent->d_reclen;
+            if (facron_walk_is_dot (dirent->d_name) || !facron_walk_is_dir (fd, dirent))
+                continue;
+
+            name_len = strlen (dirent->d_name);
+            if (prefix_len + name_len >= PATH_MAX)
+                continue;
+
+            char *child = (char *) malloc (prefix_len + name_len + 1);
+            memcpy (child, dir, len);
+            child[prefix_len - 1] = '/';
+            memcpy (child + prefix_len, dirent->d_name, name_len + 1);
+
+            if (walk->filter && walk->filter (child, prefix_len + name_len, walk->user_data))
+                free (child);
+            else
+                facron_walk_list_push (&walker->children, child);
+        }
+    }
+
+    close (fd);
+    return true;
+}
+
+static void *
+facron_walk_thread (void *user_data)
+{
+    FacronWalker *walker = (FacronWalker *) user_data;
+    FacronWalk *walk = walker->walk;
+
+    pthread_mutex_lock (&walk->lock);
+    for (;;)
+    {
+        while (!walk->pending.n_dirs && walk->busy)
+            pthread_cond_wait (&walk->cond, &walk->lock);
+        if (!walk->pending.n_dirs)
+            break;
+
+        char *dir = walk->pending.dirs[--walk->pending.n_dirs];
+        ++walk->busy;
+        pthread_mutex_unlock (&walk->lock);
+
+        if (facron_walk_read (walker, dir))
+            facron_walk_list_push (&walker->found, dir);
+        else
+            free (dir);
+
+        pthread_mutex_lock (&walk->lock);
+        for (size_t i = 0; i < walker->children.n_dirs; ++i)
+            facron_walk_list_push (&walk->pending, walker->children.dirs[i]);
+        --walk->busy;
+        /* wake the idle threads up for the new work, or for the end of the walk */
+        if (walker->children.n_dirs > 1 || !walk->busy)
+            pthread_cond_broadcast (&walk->cond);
+        walker->children.n_dirs = 0;
+    }
+    pthread_cond_broadcast (&walk->cond);
+    pthread_mutex_unlock (&walk->lock);
+
+    return NULL;
+}
+
+static unsigned int
+facron_walk_n_threads (unsigned int n_threads)
+{
+    if (!n_threads)
+    {
+        long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+        n_threads = (n_cpus > 0) ? (unsigned int) n_cpus : 1;
+    }
+
+    return (n_threads > MAX_THREADS) ? MAX_THREADS : n_threads;
+}
+
+size_t
+facron_walk (const char *root, unsigned int n_threads, FacronWalkFilter filter, FacronWalkFunc func, void *user_data)
+{
+    FacronWalk walk = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, { NULL, 0, 0 }, 0, filter, user_data };
+    FacronWalker walkers[MAX_THREADS];
+    size_t n_dirs = 0;
+
+    n_threads = facron_walk_n_threads (n_threads);
+    memset (walkers, 0, sizeof (walkers));
+    facron_walk_list_push (&walk.pending, strdup (root));
+
+    /* the calling thread walks too, the others must leave the signals to the loop */
+    sigset_t all, old;
+    sigfillset (&all);
+    pthread_sigmask (SIG_SETMASK, &all, &old);
+    for (unsigned int i = 0; i < n_threads; ++i)
+    {
+        walkers[i].walk = &walk;
+        if (i)
+            walkers[i].running = !pthread_create (&walkers[i].thread, NULL, &facron_walk_thread, &walkers[i]);
+    }
+    pthread_sigmask (SIG_SETMASK, &old, NULL);
+
+    facron_walk_thread (&walkers[0]);
+
+    for (unsigned int i = 0; i < n_threads; ++i)
+    {
+        FacronWalker *walker = &walkers[i];
+
+        if (walker->running)
+            pthread_join (walker->thread, NULL);
+        for (size_t j = 0; j < walker->found.n_dirs; ++j)
+        {
+            func (walker->found.dirs[j], strlen (walker->found.dirs[j]), user_data);
+            free (walker->found.dirs[j]);
+        }
+        n_dirs += walker->found.n_dirs;
+        free (walker->found.dirs);
+        free (walker->children.dirs);
+    }
+
+    free (walk.pending.dirs);
+    pthread_mutex_destroy (&walk.lock);
+    pthread_cond_destroy (&walk.cond);
+
+    return n_dirs;
+}
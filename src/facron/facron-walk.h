@@ -0,0 +1,43 @@
+/*
+ *      This file is part of facron.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      facron is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      facron is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with facron.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FACRON_WALK_H__
+#define __FACRON_WALK_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Lists the directories of a tree, reading several of them at once from a
+ * pool of threads through openat and getdents64.
+ */
+
+/* Called from the walking threads, returns true to leave a directory and its subtree out */
+typedef bool (*FacronWalkFilter) (const char *path, size_t len, void *user_data);
+/* Called from the calling thread once the walk is over */
+typedef void (*FacronWalkFunc) (const char *path, size_t len, void *user_data);
+
+/*
+ * Walks the tree below root, root included, with up to n_threads threads, 0
+ * picking one per CPU. Symbolic links are not followed. Returns the number of
+ * directories found.
+ */
+size_t facron_walk (const char *root, unsigned int n_threads, FacronWalkFilter filter, FacronWalkFunc func, void *user_data);
+
+#endif /* __FACRON_WALK_H__ */
@@ -18,237 +18,886 @@
  */
 
 #include "config.h"
+#include "facron-batch.h"
 #include "facron-conf.h"
-
+#include "facron-coprocess.h"
+#include "facron-debounce.h"
+#include "facron-dispatch.h"
+#include "facron-executor.h"
+#include "facron-fid.h"
+#include "facron-glob.h"
+#include "facron-hash.h"
+#include "facron-limiter.h"
+#include "facron-loop.h"
+#include "facron-marks.h"
+#include "facron-metrics.h"
+#include "facron-pipeline.h"
+#include "facron-record.h"
+#include "facron-reload.h"
+#include "facron-replay.h"
+#include "facron-rescan.h"
+#include "facron-uring.h"
+
+#include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
-#define basename
 #include <string.h>
-#undef basename
 #include <unistd.h>
 
+#include <sys/epoll.h>
 #include <sys/fanotify.h>
 #include <sys/wait.h>
 
 #include <linux/fanotify.h>
 #include <linux/limits.h>
 
-static int fanotify_fd;
+static int fanotify_fd = -1;
 static FacronConf *_conf = NULL;
+static FacronReload *reload = NULL;
+static FacronLoop *loop = NULL;
+static FacronMarks *marks = NULL;
+static FacronExecutor *executor = NULL;
+static FacronDebounce *debounce = NULL;
+static FacronBatch *batch = NULL;
+static FacronCoprocess *coprocess = NULL;
+static FacronLimiter *limiter = NULL;
+/* set when fanotify reports file handles and names instead of file descriptors */
+static FacronFid *fid = NULL;
+/* set when the events are read through io_uring instead of the loop */
+static FacronUring *uring = NULL;
+/* set when the watched paths are rescanned after a queue overflow */
+static FacronRescan *rescan = NULL;
+
+static FacronMetrics *metrics = NULL;
+static FacronDispatch *dispatch = NULL;
+/* set when the events are logged as they are read */
+static FacronRecord *record = NULL;
+/* set when the events come from a log instead of fanotify */
+static FacronReplay *replay = NULL;
+/* set when replaying without running anything, counts the runs of each entry */
+static FacronHash *dry_run = NULL;
+/* set when the events are dispatched by worker threads */
+static FacronPipeline *pipeline = NULL;
 
 typedef struct fanotify_event_metadata FacronMetadata;
 
-typedef enum
+static struct
 {
-    ADD,
-    REMOVE
-} FacronAction;
+    char *buf;
+    size_t size;
+} reader;
+
+/* when the events this thread dispatches were read, 0 outside of a read */
+static _Thread_local unsigned long long read_ns;
 
 static inline void
-walk_conf (FacronAction action)
+start_coprocesses (void)
 {
-    int flag;
-    bool notice = false;
-
-    switch (action) {
-    case ADD:
-        flag = FAN_MARK_ADD;
-        notice = true;
-        break;
-    default:
-        flag = FAN_MARK_REMOVE;
-        break;
-    }
+    if (!coprocess)
+        return;
 
-    for (const FacronConfEntry *entry = facron_conf_get_entries (_conf); entry; entry = entry->next)
+    /* the workers were retired before the generation of their entries is released */
+    FacronConfGeneration *generation = facron_conf_acquire (_conf);
+    for (const FacronConfEntry *entry = facron_conf_get_entries (generation); entry; entry = entry->next)
     {
-        if (notice)
-            fprintf (stderr, "Notice: tracking \"%s\"\n", entry->path);
-
-        for (int i = 0; i < 512 && entry->mask[i]; ++i)
-            fanotify_mark (fanotify_fd, flag, entry->mask[i], AT_FDCWD, entry->path);
+        if (entry->options.coprocess && !entry->is_duplicate)
+            facron_coprocess_start (coprocess, entry);
     }
+    facron_coprocess_stop_retired (coprocess);
+    facron_conf_generation_unref (generation);
 }
 
+static void
+pin_dir (const char *dir, void *user_data)
+{
+    (void) user_data;
+    facron_fid_pin (fid, dir);
+}
 
 static inline void
 apply_conf (void)
 {
-    walk_conf (ADD);
+    FacronConfGeneration *generation = facron_conf_acquire (_conf);
+    const FacronConfEntry *entries = facron_conf_get_entries (generation);
+
+    for (const FacronConfEntry *entry = entries; entry; entry = entry->next)
+    {
+        fprintf (stderr, "Notice: tracking \"%s\"\n", entry->path);
+        if (!fid)
+            continue;
+        /* the handles of the directories a pattern may match in must be resolvable */
+        if (entry->is_pattern)
+            facron_glob_expand (entry->path, true, &pin_dir, NULL);
+        else
+            facron_fid_pin (fid, entry->path);
+    }
+
+    if (marks)
+    {
+        /* a reload planned the marks on its own thread */
+        FacronMarksPlan *plan = (FacronMarksPlan *) facron_conf_generation_take (generation);
+
+        if (plan)
+            facron_marks_apply_plan (marks, plan);
+        else
+            facron_marks_apply (marks, entries);
+    }
+    if (rescan)
+        facron_rescan_snapshot (rescan, entries);
+    facron_conf_generation_unref (generation);
+    start_coprocesses ();
 }
 
 static inline void
 unapply_conf (void)
 {
-    walk_conf (REMOVE);
+    if (marks)
+        facron_marks_clear (marks);
 }
 
-static inline void
-reapply_conf (void)
+/* From the reload thread, which walks the trees while the loop goes on */
+static void
+prepare_conf (FacronConfGeneration *generation, void *user_data)
 {
-    if (facron_conf_reload (_conf))
+    (void) user_data;
+
+    if (marks)
+        facron_conf_generation_attach (generation, facron_marks_plan (marks, facron_conf_get_entries (generation)), &facron_marks_plan_free);
+}
+
+static void
+reapply_conf (void *user_data)
+{
+    (void) user_data;
+
+    /* the counts of the old rules are final once the workers are done with them */
+    if (pipeline)
+        facron_pipeline_drain (pipeline);
+
+    FacronConfGeneration *old = facron_conf_acquire (_conf);
+
+    if (!facron_conf_publish (_conf))
     {
-        unapply_conf ();
-        apply_conf ();
+        facron_conf_generation_unref (old);
+        return;
     }
+    facron_metrics_retire (metrics, old);
+
+    /* pending commands reference the entries of the old generation, which we keep alive until then */
+    if (debounce)
+        facron_debounce_flush (debounce);
+    if (batch)
+        facron_batch_flush (batch);
+    if (coprocess)
+        facron_coprocess_retire (coprocess);
+    /* only the marks that changed are touched */
+    if (fid)
+        facron_fid_clear (fid);
+    apply_conf ();
+
+    facron_conf_generation_unref (old);
 }
 
 static inline void
 cleanup (void)
 {
+    if (reload)
+        facron_reload_free (reload);
+    /* the deferred actions still need everything else */
+    if (pipeline)
+        facron_pipeline_free (pipeline);
     unapply_conf ();
-    facron_conf_free (_conf);
-    close (fanotify_fd);
+    if (debounce)
+    {
+        facron_debounce_flush (debounce);
+        facron_debounce_free (debounce);
+    }
+    if (batch)
+    {
+        facron_batch_flush (batch);
+        facron_batch_free (batch);
+    }
+    if (coprocess)
+        facron_coprocess_free (coprocess);
+    /* after everything that may still run a command */
+    if (limiter)
+        facron_limiter_free (limiter);
+    if (fid)
+        facron_fid_free (fid);
+    if (rescan)
+        facron_rescan_free (rescan);
+    if (marks)
+        facron_marks_free (marks);
+    if (_conf)
+        facron_conf_free (_conf);
+    /* an in-flight read must be cancelled before its buffer goes away */
+    if (uring)
+        facron_uring_free (uring);
+    free (reader.buf);
+    if (replay)
+        facron_replay_free (replay);
+    if (record)
+        facron_record_free (record);
+    if (executor)
+        facron_executor_free (executor);
+    if (dispatch)
+        facron_dispatch_free (dispatch);
+    if (dry_run)
+        facron_hash_free (dry_run, &free);
+    if (metrics)
+        facron_metrics_free (metrics);
+    if (loop)
+        facron_loop_free (loop);
+    if (fanotify_fd >= 0)
+        close (fanotify_fd);
 }
 
 static void
-signal_handler (int signum)
+dump_stats (void)
 {
+    unsigned long long events = facron_metrics_get (metrics, FACRON_METRIC_EVENTS_DISPATCHED);
+    unsigned long long candidates = facron_metrics_get (metrics, FACRON_METRIC_CANDIDATES);
+    unsigned long long reads = facron_metrics_get (metrics, FACRON_METRIC_READS);
+
+    fprintf (stderr, "Notice: %llu events dispatched, %llu candidate rules examined (%.2f per event, %llu max), %llu excluded, %llu unresolved\n",
+             events,
+             candidates,
+             events ? (double) candidates / events : 0.0,
+             facron_metrics_get (metrics, FACRON_METRIC_MAX_CANDIDATES),
+             facron_metrics_get (metrics, FACRON_METRIC_EXCLUDED),
+             facron_metrics_get (metrics, FACRON_METRIC_UNRESOLVED));
+    fprintf (stderr, "Notice: %llu reads of %zu bytes, %.2f events per read (%llu max), %llu nearly full, %llu duplicate events dropped, %llu queue overflows\n",
+             reads,
+             reader.size,
+             reads ? (double) facron_metrics_get (metrics, FACRON_METRIC_EVENTS_READ) / reads : 0.0,
+             facron_metrics_get (metrics, FACRON_METRIC_MAX_READ_EVENTS),
+             facron_metrics_get (metrics, FACRON_METRIC_FULL_READS),
+             facron_metrics_get (metrics, FACRON_METRIC_DUPLICATES),
+             facron_metrics_get (metrics, FACRON_METRIC_OVERFLOWS));
+    facron_metrics_dump_stats (metrics);
+    if (marks)
+        facron_marks_dump_stats (marks);
+    if (executor)
+        facron_executor_dump_stats (executor);
+    if (limiter)
+        facron_limiter_dump_stats (limiter);
+    if (debounce)
+        facron_debounce_dump_stats (debounce);
+    if (batch)
+        facron_batch_dump_stats (batch);
+    if (coprocess)
+        facron_coprocess_dump_stats (coprocess);
+    if (fid)
+        facron_fid_dump_stats (fid);
+    if (uring)
+        facron_uring_dump_stats (uring);
+    if (rescan)
+        facron_rescan_dump_stats (rescan);
+    if (replay)
+        facron_replay_dump_stats (replay);
+    if (pipeline)
+        facron_pipeline_dump_stats (pipeline);
+}
+
+/* Delivered by the loop, outside of any signal context */
+static void
+handle_signal (int signum, void *user_data)
+{
+    (void) user_data;
+
     switch (signum)
     {
     case SIGUSR1:
-        reapply_conf ();
+        /* the configuration is parsed on the reload thread, then applied from the loop */
+        facron_reload_request (reload);
+        break;
+    case SIGUSR2:
+        dump_stats ();
         break;
-    case SIGTERM:
-        signum = EXIT_SUCCESS;
     default:
         fprintf (stderr, "Signal %d received, exiting.\n", signum);
-        cleanup ();
-        exit (signum);
+        facron_loop_quit (loop, signum == SIGTERM);
+        break;
     }
 }
 
+/* Beyond that many watched paths, a filesystem is watched with a single mark */
+#define DEFAULT_FILESYSTEM_THRESHOLD 1000
+#define DEFAULT_BUFFER_SIZE (256 * 1024)
+#define MIN_BUFFER_SIZE     4096
+/* Commands waiting for the limits, all rules together */
+#define DEFAULT_MAX_QUEUE 1024
+#define MAX_READS_PER_WAKEUP 16
+/* A read leaving less room than that may have been cut short by the buffer */
+#define MAX_EVENT_LEN (sizeof (FacronMetadata) + sizeof (struct fanotify_event_info_fid) + MAX_HANDLE_SZ + NAME_MAX + 1)
+
 static inline void
 usage (char *callee)
 {
-    fprintf (stderr, "USAGE: %s [--background]", callee);
+    fprintf (stderr, "USAGE: %s [--background] [--filesystem-threshold=<paths>] [--buffer-size=<bytes>] [--no-io-uring] [--unlimited-queue] [--rescan-on-overflow] [--metrics-socket=<path>] [--workers=<n>]\n"
+                     "       [--max-children=<n>] [--max-queue=<n>] [--overflow=<policy>] [--config=<file>] [--record=<file>] [--replay=<file> [--dry-run] [--timed]]\n", callee);
     exit (EXIT_FAILURE);
 }
 
-static inline char *
-print_number (unsigned int n)
+/* Commands are rendered on the stack, unless a batch needs more room */
+#define STACK_ARGS_LEN 16384
+#define STACK_ARGC     256
+
+static void
+exec_command (const FacronConfEntry *entry,
+              char *const           *paths,
+              size_t                 n_paths)
 {
-    char *tmp = NULL;
-    if (asprintf (&tmp, "%u", n) < 1)
-        return strdup ("0");
-    return tmp;
+    static unsigned int count = 0;
+    /* the workers of a pipeline share the counter, the other commands render without the lock */
+    static pthread_mutex_t count_lock = PTHREAD_MUTEX_INITIALIZER;
+    bool counted = facron_command_uses_counter (entry->command_template);
+
+    FacronCommandContext context = { paths, n_paths, &count };
+    char stack_buf[STACK_ARGS_LEN];
+    char *stack_argv[STACK_ARGC];
+    size_t argc;
+
+    if (counted)
+        pthread_mutex_lock (&count_lock);
+    size_t size = facron_command_measure (entry->command_template, &context, &argc);
+    char *buf = (size <= sizeof (stack_buf)) ? stack_buf : (char *) malloc (size);
+    char **argv = (argc < STACK_ARGC) ? stack_argv : (char **) malloc ((argc + 1) * sizeof (char *));
+
+    facron_command_render (entry->command_template, &context, buf, argv);
+    if (counted)
+        pthread_mutex_unlock (&count_lock);
+    bool started = true;
+    if (facron_limiter_limits (limiter, entry))
+        started = facron_limiter_run (limiter, entry, (n_paths == 1) ? paths[0] : NULL, argv);
+    else
+        facron_executor_spawn (executor, argv);
+    /* the commands run from a timer, debounced or batched, wait on purpose, as do the ones held by a limit */
+    if (read_ns && started)
+        facron_metrics_observe (metrics, FACRON_HISTOGRAM_EVENT_TO_SPAWN, facron_loop_now () - read_ns);
+
+    if (buf != stack_buf)
+        free (buf);
+    if (argv != stack_argv)
+        free (argv);
 }
 
-typedef struct CommandBackup CommandBackup;
-struct CommandBackup
+static void
+run_batch (const FacronConfEntry *entry, char *const *paths, size_t n_paths, void *user_data)
 {
-    int index;
-    char *field;
-    CommandBackup *next;
-};
+    (void) user_data;
+    exec_command (entry, paths, n_paths);
+}
 
-static inline char *
-basename (const char *filename)
+static void
+run_now (const FacronConfEntry *entry, const FacronEvent *event)
 {
-    char *bn = strrchr (filename, '/');
-    return strdup (bn ? bn + 1 : filename);
+    if (entry->options.coprocess)
+        facron_coprocess_send (coprocess, entry, event->path, event->len, event->mask, event->pid);
+    else if (entry->options.batch_size)
+        facron_batch_push (batch, entry, event->path, event->len);
+    else
+        exec_command (entry, (char *const *) &event->path, 1);
 }
 
-static inline char *
-substr (const char *str, size_t len)
+static void
+run_debounced (const FacronConfEntry *entry, const char *path, unsigned long long mask, int pid, void *user_data)
 {
-    return (char *) memcpy (calloc (len + 1, sizeof (char)), str, len);
+    FacronEvent event = { mask, pid, path, strlen (path) };
+    (void) user_data;
+    run_now (entry, &event);
 }
 
-static inline char *
-dirname (const char *filename)
+static void
+run_entry (const FacronConfEntry *entry, const FacronEvent *event, void *user_data)
 {
-    char *c = strrchr (filename, '/');
-    if (!c)
-        return strdup (".");
+    (void) user_data;
+    if (entry->options.debounce_ms)
+        facron_debounce_push (debounce, entry, event->path, event->len, event->mask, event->pid);
+    else
+        run_now (entry, event);
+}
+
+/* Plain commands are spawned right from the workers, the rest belongs to the loop */
+static bool
+run_on_worker (const FacronConfEntry *entry, const FacronEvent *event, unsigned long long event_read_ns, void *user_data)
+{
+    (void) user_data;
+    if (dry_run || entry->options.debounce_ms || entry->options.batch_size || entry->options.coprocess ||
+        facron_limiter_limits (limiter, entry))
+        return false;
+
+    read_ns = event_read_ns;
+    exec_command (entry, (char *const *) &event->path, 1);
+    read_ns = 0;
+    return true;
+}
+
+static void
+grow_tree (const FacronConfEntry *entry, const FacronEvent *event, void *user_data)
+{
+    (void) user_data;
+    facron_marks_grow (marks, entry, event->path);
+}
 
-    if (c[1] == '\0')
+/* Follows the directories coming and going in the trees of recursive entries */
+static void
+track_dir (const FacronConfGeneration *generation, const FacronEvent *event)
+{
+    if (event->mask & (FAN_DELETE|FAN_MOVED_FROM))
+        facron_marks_forget (marks, event->path, event->len, event->mask & FAN_MOVED_FROM);
+    if (event->mask & (FAN_CREATE|FAN_MOVED_TO))
+        facron_dispatch_foreach_tree (dispatch, generation, event, &grow_tree, NULL);
+}
+
+/* The path of the event has been resolved in the room reserved by the dispatch */
+static void
+push_event (const FacronMetadata *metadata, const char *path, size_t len)
+{
+    if (record)
+        facron_record_event (record, read_ns, metadata->mask, metadata->pid, path, len);
+    facron_dispatch_push (dispatch, metadata, len);
+}
+
+static void
+collect_fd_event (const FacronMetadata *metadata)
+{
+    char proc_path[32];
+    char *path = facron_dispatch_reserve (dispatch);
+
+    if (metadata->fd < 0)
+        return;
+
+    sprintf (proc_path, "/proc/self/fd/%d", metadata->fd);
+    ssize_t path_len = readlink (proc_path, path, PATH_MAX - 1);
+    if (path_len >= 0)
     {
-        while (c != filename && c[-1] == '/')
-            --c;
-        c = memrchr (filename, '/', c - filename);
+        push_event (metadata, path, path_len);
     }
+    else
+        facron_metrics_add (metrics, FACRON_METRIC_UNRESOLVED, 1);
 
-    while (c != filename && c[-1] == '/')
-        --c;
-    return (c != filename) ? substr (filename, c - filename) :
-                             (filename[1] == '/') ? strdup ("//") :
-                                                    strdup ("/");
+    /* closes are batched with the next read when going through io_uring */
+    if (uring)
+        facron_uring_close (uring, metadata->fd);
+    else
+        close (metadata->fd);
 }
 
 static void
-exec_command (char       *command[512],
-              const char *path)
+collect_fid_event (const FacronMetadata *metadata)
 {
-    static unsigned int count = 0;
+    const char *info = (const char *) metadata + metadata->metadata_len;
+    const char *end = (const char *) metadata + metadata->event_len;
+    char *path = facron_dispatch_reserve (dispatch);
+    size_t path_len;
 
-    CommandBackup *backup = NULL;
-    for (unsigned int i = 0; i < 512 && command[i]; ++i)
+    while (info < end)
     {
-        char *field = command[i];
-        char *subst = NULL;
-
-        if (!strcmp ("$$", field))
-            subst = strdup (path);
-        else if (!strcmp ("$@", field))
-            subst = dirname (path);
-        else if (!strcmp ("$#", field))
-            subst = basename (path);
-        else if (!strcmp ("$+", field))
-            subst = print_number (++count);
-        else if (!strcmp ("$-", field))
-            subst = print_number (--count);
-        else if (!strcmp ("$=", field))
-            subst = print_number (count);
-
-        if (subst)
+        const struct fanotify_event_info_header *header = (const struct fanotify_event_info_header *) info;
+
+        if (!header->len)
+            return;
+
+        switch (header->info_type)
         {
-            CommandBackup *b = (CommandBackup *) malloc (sizeof (CommandBackup));
-            b->index = i;
-            b->field = field;
-            b->next = backup;
-            backup = b;
-            command[i] = subst;
+        case FAN_EVENT_INFO_TYPE_FID:
+        case FAN_EVENT_INFO_TYPE_DFID:
+        case FAN_EVENT_INFO_TYPE_DFID_NAME:
+            if (facron_fid_resolve (fid, (const struct fanotify_event_info_fid *) info, path, &path_len))
+                push_event (metadata, path, path_len);
+            else
+                facron_metrics_add (metrics, FACRON_METRIC_UNRESOLVED, 1);
+            return;
         }
+
+        info += header->len;
     }
-   
-    pid_t p = fork ();
-    if (p)
-        waitpid (p, NULL, 0);
-    else
+}
+
+/* Sees the events of a read before their dispatch */
+static bool
+filter_event (const FacronConfGeneration *generation, const FacronEvent *event, void *user_data)
+{
+    (void) user_data;
+
+    if (event->mask & FACRON_MARKS_TREE_EVENTS)
+    {
+        /* replayed trees have nothing to follow */
+        if ((event->mask & FAN_ONDIR) && marks)
+            track_dir (generation, event);
+    }
+    /* a directory moved out of its tree still reports, from where it went */
+    if (marks)
+        facron_marks_unmark_moved (marks, event->path, event->len, event->mask);
+    /* no entry can ask for these alone */
+    if ((event->mask & FACRON_MARKS_TREE_EVENTS) && !(event->mask & ~(FACRON_MARKS_TREE_EVENTS|FAN_ONDIR)))
+        return false;
+
+    if (rescan)
+        facron_rescan_update (rescan, event->path, event->len, event->mask);
+    /* matched by a worker instead */
+    if (pipeline)
     {
-        if (fork ())
-            exit (EXIT_SUCCESS);
+        facron_pipeline_push (pipeline, generation, event, read_ns);
+        return false;
+    }
+    return true;
+}
+
+/* Feeds the changes found by a rescan to the current configuration */
+static void
+dispatch_rescanned (const char *path, size_t len, unsigned long long mask, void *user_data)
+{
+    FacronConfGeneration *generation = facron_conf_acquire (_conf);
+    FacronEvent event = { mask, 0, path, len };
+    (void) user_data;
+
+    facron_dispatch_event (dispatch, generation, &event);
+    facron_conf_generation_unref (generation);
+}
+
+static bool
+process_events (ssize_t len)
+{
+    unsigned long long n_events = 0;
+    bool overflowed = false;
+    bool ok = true;
+
+    read_ns = facron_loop_now ();
+    facron_metrics_add (metrics, FACRON_METRIC_READS, 1);
+    if (reader.size - len < MAX_EVENT_LEN)
+        facron_metrics_add (metrics, FACRON_METRIC_FULL_READS, 1);
+
+    for (FacronMetadata *metadata = (FacronMetadata *) reader.buf; FAN_EVENT_OK (metadata, len); metadata = FAN_EVENT_NEXT (metadata, len))
+    {
+        if (metadata->vers < 2)
+        {
+            fprintf (stderr, "Kernel fanotify version too old\n");
+            if (metadata->fd >= 0)
+                close (metadata->fd);
+            ok = false;
+            break;
+        }
+
+        /* carries neither a file descriptor nor a file handle */
+        if (metadata->mask & FAN_Q_OVERFLOW)
+        {
+            facron_metrics_add (metrics, FACRON_METRIC_OVERFLOWS, 1);
+            overflowed = true;
+            continue;
+        }
+
+        ++n_events;
+        if (fid)
+            collect_fid_event (metadata);
         else
-            execv (command[0], command);
+            collect_fd_event (metadata);
     }
 
-    for (CommandBackup *next; backup != NULL; next = backup->next, free (backup), backup = next)
+    facron_metrics_add (metrics, FACRON_METRIC_EVENTS_READ, n_events);
+    facron_metrics_raise (metrics, FACRON_METRIC_MAX_READ_EVENTS, n_events);
+
+    FacronConfGeneration *generation = facron_conf_acquire (_conf);
+    facron_dispatch_flush (dispatch, generation);
+    facron_conf_generation_unref (generation);
+    read_ns = 0;
+    if (pipeline)
+        facron_pipeline_kick (pipeline);
+    if (record)
+        facron_record_flush (record);
+
+    if (overflowed)
+    {
+        if (rescan)
+            facron_rescan_schedule (rescan);
+        else
+            fprintf (stderr, "Warning: the fanotify queue overflowed, some events were lost\n");
+    }
+
+    return ok;
+}
+
+static void
+handle_events (int fd, unsigned int events, void *user_data)
+{
+    (void) events;
+    (void) user_data;
+
+    /* drain the queue, but let the other sources of the loop breathe */
+    for (unsigned int n_reads = 0; n_reads < MAX_READS_PER_WAKEUP; ++n_reads)
+    {
+        ssize_t len = read (fd, reader.buf, reader.size);
+
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0 && errno == EAGAIN)
+            return;
+        if (len <= 0)
+        {
+            fprintf (stderr, "Error: could not read fanotify events\n");
+            facron_loop_quit (loop, false);
+            return;
+        }
+        if (!process_events (len))
+        {
+            facron_loop_quit (loop, false);
+            return;
+        }
+    }
+}
+
+static void
+handle_uring_events (char *buf, ssize_t len, void *user_data)
+{
+    (void) buf;
+    (void) user_data;
+
+    if (len <= 0)
+    {
+        fprintf (stderr, "Error: could not read fanotify events\n");
+        facron_loop_quit (loop, false);
+        return;
+    }
+    if (!process_events (len))
+        facron_loop_quit (loop, false);
+}
+
+/* Feeds a recorded read to the dispatch, the way process_events does */
+static void
+replay_read (const FacronEvent *events, size_t n_events, void *user_data)
+{
+    (void) user_data;
+
+    read_ns = facron_loop_now ();
+    facron_metrics_add (metrics, FACRON_METRIC_READS, 1);
+    facron_metrics_add (metrics, FACRON_METRIC_EVENTS_READ, n_events);
+    facron_metrics_raise (metrics, FACRON_METRIC_MAX_READ_EVENTS, n_events);
+
+    for (size_t i = 0; i < n_events; ++i)
+    {
+        FacronMetadata metadata = { .mask = events[i].mask, .pid = events[i].pid, .fd = FAN_NOFD };
+
+        memcpy (facron_dispatch_reserve (dispatch), events[i].path, events[i].len);
+        facron_dispatch_push (dispatch, &metadata, events[i].len);
+    }
+
+    FacronConfGeneration *generation = facron_conf_acquire (_conf);
+    facron_dispatch_flush (dispatch, generation);
+    facron_conf_generation_unref (generation);
+    read_ns = 0;
+    if (pipeline)
+        facron_pipeline_kick (pipeline);
+}
+
+static void
+count_entry (const FacronConfEntry *entry, const FacronEvent *event, void *user_data)
+{
+    unsigned long long *runs = (unsigned long long *) facron_hash_lookup (dry_run, &entry, sizeof (const FacronConfEntry *));
+    (void) event;
+    (void) user_data;
+
+    if (!runs)
+    {
+        runs = (unsigned long long *) calloc (1, sizeof (unsigned long long));
+        facron_hash_insert (dry_run, &entry, sizeof (const FacronConfEntry *), runs);
+    }
+    ++*runs;
+}
+
+/* The entries which would have run, in file order */
+static void
+dump_dry_run (void)
+{
+    FacronConfGeneration *generation = facron_conf_acquire (_conf);
+    size_t n_rules;
+    const FacronRule *const *rules = facron_conf_get_rules (generation, &n_rules);
+
+    for (size_t i = 0; i < n_rules; ++i)
+    {
+        size_t n_actions;
+        const FacronConfEntry *const *actions = facron_rule_get_actions (rules[i], &n_actions);
+
+        for (size_t j = 0; j < n_actions; ++j)
+        {
+            const unsigned long long *runs = (const unsigned long long *) facron_hash_lookup (dry_run, &actions[j], sizeof (const FacronConfEntry *));
+
+            if (!runs)
+                continue;
+            fprintf (stderr, "Notice: \"%s\" would have run", actions[j]->path);
+            for (size_t k = 0; k < actions[j]->argc; ++k)
+                fprintf (stderr, " %s", actions[j]->command[k]);
+            fprintf (stderr, " %llu times\n", *runs);
+        }
+    }
+    facron_conf_generation_unref (generation);
+}
+
+static void
+replay_done (bool success, void *user_data)
+{
+    (void) user_data;
+
+    /* what is still pending runs now rather than never */
+    if (pipeline)
+        facron_pipeline_drain (pipeline);
+    if (debounce)
+        facron_debounce_flush (debounce);
+    if (batch)
+        facron_batch_flush (batch);
+    if (dry_run)
+        dump_dry_run ();
+    dump_stats ();
+    facron_loop_quit (loop, success);
+}
+
+static bool
+parse_size (const char *str, size_t *size)
+{
+    char *end;
+
+    errno = 0;
+    *size = strtoul (str, &end, 10);
+    if (errno || end == str)
+        return false;
+
+    switch (*end)
     {
-        free (command[backup->index]);
-        command[backup->index] = backup->field;
+    case 'k':
+    case 'K':
+        *size *= 1024;
+        ++end;
+        break;
+    case 'm':
+    case 'M':
+        *size *= 1024 * 1024;
+        ++end;
+        break;
     }
+
+    return !*end;
 }
 
 int
 main (int argc, char *argv[])
 {
     bool background = false;
-
-    switch (argc)
+    bool use_io_uring = true;
+    bool rescan_on_overflow = false;
+    const char *metrics_socket = NULL;
+    const char *conf_path = SYSCONFDIR "/facron.conf";
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    bool dry = false;
+    bool timed = false;
+    bool pipelined = false;
+    unsigned int n_workers = 0;
+    unsigned int max_children = 0;
+    unsigned int max_queue = DEFAULT_MAX_QUEUE;
+    FacronOverflow overflow = FACRON_OVERFLOW_DROP_OLDEST;
+    /* a recursive entry easily needs more marks than the default limit */
+    unsigned int init_flags = FAN_UNLIMITED_MARKS;
+    size_t filesystem_threshold = DEFAULT_FILESYSTEM_THRESHOLD;
+    static const struct option options[] = {
+        { "background",           no_argument,       NULL, 'b' },
+        { "filesystem-threshold", required_argument, NULL, 't' },
+        { "buffer-size",          required_argument, NULL, 's' },
+        { "no-io-uring",          no_argument,       NULL, 'u' },
+        { "unlimited-queue",      no_argument,       NULL, 'q' },
+        { "rescan-on-overflow",   no_argument,       NULL, 'r' },
+        { "metrics-socket",       required_argument, NULL, 'm' },
+        { "config",               required_argument, NULL, 'c' },
+        { "record",               required_argument, NULL, 'R' },
+        { "replay",               required_argument, NULL, 'p' },
+        { "dry-run",              no_argument,       NULL, 'n' },
+        { "timed",                no_argument,       NULL, 'T' },
+        { "workers",              required_argument, NULL, 'w' },
+        { "max-children",         required_argument, NULL, 'C' },
+        { "max-queue",            required_argument, NULL, 'Q' },
+        { "overflow",             required_argument, NULL, 'o' },
+        { NULL,                   0,                 NULL, 0   }
+    };
+    char *end;
+
+    for (int opt; (opt = getopt_long (argc, argv, "", options, NULL)) != -1;)
     {
-    case 1:
-        break;
-    case 2:
-        if (strcmp (argv[1], "--background"))
+        switch (opt)
+        {
+        case 'b':
+            background = true;
+            break;
+        case 's':
+            if (!parse_size (optarg, &reader.size) || reader.size < MIN_BUFFER_SIZE)
+                usage (argv[0]);
+            break;
+        case 'u':
+            use_io_uring = false;
+            break;
+        case 'q':
+            init_flags |= FAN_UNLIMITED_QUEUE;
+            break;
+        case 'r':
+            rescan_on_overflow = true;
+            break;
+        case 'm':
+            metrics_socket = optarg;
+            break;
+        case 'c':
+            conf_path = optarg;
+            break;
+        case 'R':
+            record_path = optarg;
+            break;
+        case 'p':
+            replay_path = optarg;
+            break;
+        case 'n':
+            dry = true;
+            break;
+        case 'T':
+            timed = true;
+            break;
+        case 'w':
+            errno = 0;
+            n_workers = strtoul (optarg, &end, 10);
+            if (errno || end == optarg || *end)
+                usage (argv[0]);
+            pipelined = true;
+            break;
+        case 'C':
+            errno = 0;
+            max_children = strtoul (optarg, &end, 10);
+            if (errno || end == optarg || *end)
+                usage (argv[0]);
+            break;
+        case 'Q':
+            errno = 0;
+            max_queue = strtoul (optarg, &end, 10);
+            if (errno || end == optarg || *end)
+                usage (argv[0]);
+            break;
+        case 'o':
+            if (!facron_conf_overflow_parse (optarg, &overflow))
+                usage (argv[0]);
+            break;
+        case 't':
+            errno = 0;
+            filesystem_threshold = strtoul (optarg, &end, 10);
+            if (errno || end == optarg || *end)
+                usage (argv[0]);
+            break;
+        default:
             usage (argv[0]);
-        background = true;
-        break;
-    default:
-        usage (argv[0]);
+        }
     }
+    if (optind != argc || ((dry || timed) && !replay_path) || (record_path && replay_path))
+        usage (argv[0]);
+    if (!reader.size)
+        reader.size = DEFAULT_BUFFER_SIZE;
 
     if (background)
     {
@@ -265,77 +914,103 @@ main (int argc, char *argv[])
         }
     }
 
-    signal (SIGTERM, &signal_handler);
-    signal (SIGINT, &signal_handler);
-    signal (SIGUSR1, &signal_handler);
+    /* a dead coprocess must not kill us */
+    signal (SIGPIPE, SIG_IGN);
 
-    if ((fanotify_fd = fanotify_init (FAN_CLASS_NOTIF, O_RDONLY|O_LARGEFILE)) < 0)
+    if (replay_path)
+    {
+        /* the paths of a log recorded elsewhere need not exist here */
+        _conf = facron_conf_new (conf_path, false);
+        if (dry)
+            dry_run = facron_hash_new ();
+    }
+    /* Reporting directory handles and names spares us an open fd and a readlink per event */
+    else if ((fanotify_fd = fanotify_init (FAN_CLASS_NOTIF|FAN_CLOEXEC|FAN_NONBLOCK|FAN_REPORT_DFID_NAME|init_flags, O_RDONLY|O_LARGEFILE|O_CLOEXEC)) >= 0)
+        fid = facron_fid_new ();
+    else if ((fanotify_fd = fanotify_init (FAN_CLASS_NOTIF|FAN_CLOEXEC|FAN_NONBLOCK|init_flags, O_RDONLY|O_LARGEFILE|O_CLOEXEC)) >= 0)
+        fprintf (stderr, "Notice: fanotify cannot report file handles, falling back to file descriptors\n");
+    else
     {
         fprintf (stderr, "Could not initialize fanotify\n");
         return EXIT_FAILURE;
     }
 
-    _conf = facron_conf_new ();
-    apply_conf ();
+    if (!_conf)
+        _conf = facron_conf_new (conf_path, true);
+
+    if (!(loop = facron_loop_new ()) ||
+        !(metrics = facron_metrics_new (_conf)) ||
+        !(dispatch = facron_dispatch_new (metrics, &filter_event, (dry_run) ? &count_entry : &run_entry, NULL)) ||
+        (metrics_socket && !facron_metrics_listen (metrics, loop, metrics_socket)))
+    {
+        cleanup ();
+        return EXIT_FAILURE;
+    }
 
-    char buf[4096];
-    size_t len;
+    if (!dry_run &&
+        (!(executor = facron_executor_new (loop, metrics)) ||
+         !(debounce = facron_debounce_new (loop, &run_debounced, NULL)) ||
+         !(batch = facron_batch_new (loop, &run_batch, NULL)) ||
+         !(coprocess = facron_coprocess_new (loop, executor)) ||
+         !(limiter = facron_limiter_new (executor, metrics, max_children, max_queue, overflow))))
+    {
+        cleanup ();
+        return EXIT_FAILURE;
+    }
 
-    while ((len = read (fanotify_fd, buf, sizeof (buf))) > 0)
+    if (pipelined &&
+        !(pipeline = facron_pipeline_new (loop, metrics, n_workers, &run_on_worker, (dry_run) ? &count_entry : &run_entry, NULL)))
     {
-        char path[PATH_MAX];
-        int path_len;
+        cleanup ();
+        return EXIT_FAILURE;
+    }
 
-        for (FacronMetadata *metadata = (FacronMetadata *) buf; FAN_EVENT_OK (metadata, len); metadata = FAN_EVENT_NEXT (metadata, len))
+    if (replay_path)
+    {
+        if (!(replay = facron_replay_new (loop, replay_path, timed, &replay_read, &replay_done, NULL)))
         {
-            if (metadata->vers < 2)
-            {
-                fprintf (stderr, "Kernel fanotify version too old\n");
-                close (metadata->fd);
-                goto fail;
-            }
+            cleanup ();
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        reader.buf = (char *) malloc (reader.size);
 
-            if (metadata->fd < 0)
-                continue;
+        if (!(marks = facron_marks_new (fanotify_fd, filesystem_threshold, fid != NULL)) ||
+            (record_path && !(record = facron_record_new (record_path))))
+        {
+            cleanup ();
+            return EXIT_FAILURE;
+        }
 
-            sprintf (path, "/proc/self/fd/%d", metadata->fd);
-            path_len = readlink (path, path, sizeof (path) - 1);
-            if (path_len < 0)
-                goto next;
-            path[path_len] = '\0';
-
-            for (const FacronConfEntry *entry = facron_conf_get_entries (_conf); entry; entry = entry->next)
-            {
-                if (!strcmp (entry->path, path))
-                {
-                    for (int i = 0; i < 512 && entry->mask[i]; ++i)
-                    {
-                        if ((entry->mask[i] & metadata->mask) == entry->mask[i])
-                            exec_command ((char **) entry->command, path);
-                    }
-                }
-                else
-                {
-                    size_t plen = strlen (entry->path);
-                    for (int i = 0; i < 512 && entry->mask[i]; ++i)
-                    {
-                        if ((entry->mask[i] & FAN_EVENT_ON_CHILD) &&
-                            (size_t)path_len >= plen &&
-                            (entry->path[plen - 1] == '/' || path[plen] == '/') &&
-                            !memcmp (entry->path, path, plen) &&
-                            (entry->mask[i] & metadata->mask) == (entry->mask[i] & ~FAN_EVENT_ON_CHILD))
-                                exec_command ((char **) entry->command, path);
-                    }
-                }
-            }
-
-next:
-            close (metadata->fd);
+        if (use_io_uring)
+            uring = facron_uring_new (loop, fanotify_fd, reader.buf, reader.size, &handle_uring_events, NULL);
+        if (!uring && !facron_loop_add_fd (loop, fanotify_fd, EPOLLIN, &handle_events, NULL))
+        {
+            cleanup ();
+            return EXIT_FAILURE;
         }
+
+        if (rescan_on_overflow)
+            rescan = facron_rescan_new (loop, &dispatch_rescanned, NULL);
     }
 
-fail:
+    apply_conf ();
+
+    if (!(reload = facron_reload_new (loop, _conf, &prepare_conf, &reapply_conf, NULL)) ||
+        !facron_loop_add_signal (loop, SIGTERM, &handle_signal, NULL) ||
+        !facron_loop_add_signal (loop, SIGINT, &handle_signal, NULL) ||
+        !facron_loop_add_signal (loop, SIGUSR1, &handle_signal, NULL) ||
+        !facron_loop_add_signal (loop, SIGUSR2, &handle_signal, NULL))
+    {
+        cleanup ();
+        return EXIT_FAILURE;
+    }
+
+    bool success = facron_loop_run (loop);
+
     cleanup ();
 
-    return EXIT_FAILURE;
+    return (success) ? EXIT_SUCCESS : EXIT_FAILURE;
 }